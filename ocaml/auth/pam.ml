@@ -12,8 +12,73 @@
  * GNU Lesser General Public License for more details.
  *)
 
+(** Raised by [authenticate] if too many authentications are already waiting
+    for a worker of the pool *)
+exception Queue_full
+
+let () = Callback.register_exception "Pam.Queue_full" Queue_full
+
+(** [authenticate username password] runs the PAM authentication on a worker
+    thread of a bounded pool, see [Pool] *)
 external authenticate : string -> string -> unit = "stub_XA_mh_authorize"
 
+module Pool = struct
+  (** Counters since startup. Histograms have [buckets] entries, entry [i]
+      counts durations below [bucket_bound_us i] and not counted by a lower
+      entry. *)
+  type stats = {
+      submitted: int
+    ; rejected: int  (** Failed with [Queue_full] *)
+    ; completed: int
+    ; cache_hits: int  (** Verified by [Cache], not counted as submitted *)
+    ; queued: int  (** Waiting for a worker now *)
+    ; running: int  (** Running PAM now *)
+    ; workers: int
+    ; max_workers: int
+    ; max_queue: int
+    ; queue_wait_us: int array
+    ; pam_time_us: int array
+  }
+
+  (** Set the number of concurrent PAM authentications and how many more can
+      wait for one to complete before being rejected. Defaults to 8 and 256. *)
+  external configure : max_workers:int -> max_queue:int -> unit
+    = "stub_XA_pool_configure"
+
+  external stats : unit -> stats = "stub_XA_pool_stats"
+
+  let buckets = 24
+
+  let bucket_bound_us i = if i >= buckets - 1 then max_int else 1 lsl i
+end
+
+module Cache = struct
+  (** Accept credentials that PAM verified less than [ttl] seconds ago without
+      running PAM again, [0] (the default) disables the cache. Account checks
+      like expiry are not repeated within the TTL. The cache is dropped when
+      /etc/shadow changes and the entry of a user when [change_password] is
+      called for them. *)
+  external configure : ttl:int -> unit = "stub_XA_cache_configure"
+end
+
+module Local_shadow = struct
+  (** [configure enable] verifies local passwords with crypt_r against
+      /etc/shadow instead of going through the PAM module stack. It is only
+      enabled if the auth and account rules of the PAM configuration of xapi,
+      following the configurations it includes, all use pam_unix, the result
+      tells whether it is. The default configuration includes system-auth,
+      which must then use pam_unix alone for those rules. Wrong passwords and
+      accounts needing any attention still go through PAM. Disabled by
+      default. *)
+  external configure : bool -> bool = "stub_XA_shadow_configure"
+
+  (** [verify username password] is whether the fast path accepts the
+      credentials, even if not enabled. For benchmarks and tests,
+      [authenticate] uses it already when enabled. *)
+  external verify : username:string -> password:string -> bool
+    = "stub_XA_shadow_authorize"
+end
+
 external change_password : string -> string -> unit = "stub_XA_mh_chpasswd"
 
 include (
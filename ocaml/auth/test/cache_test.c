@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) Cloud Software Group, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+/* Test of the cache of verified credentials, watching a temporary file
+ * instead of /etc/shadow. PAM is faked so that XA_mh_chpasswd can be run
+ * with the change succeeding or failing. */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static char shadow_path[] = "/tmp/cache_test.XXXXXX";
+#define SHADOW_FILE shadow_path
+
+#include "../xa_auth_cache.c"
+
+#include <security/pam_appl.h>
+
+static int chauthtok_rc;
+
+int
+pam_start(const char *service_name, const char *user,
+          const struct pam_conv *pam_conversation, pam_handle_t **pamh)
+{
+    static int handle;
+
+    *pamh = (pam_handle_t *) &handle;
+    return PAM_SUCCESS;
+}
+
+int
+pam_end(pam_handle_t *pamh, int pam_status)
+{
+    return PAM_SUCCESS;
+}
+
+int
+pam_authenticate(pam_handle_t *pamh, int flags)
+{
+    return PAM_AUTH_ERR;
+}
+
+int
+pam_acct_mgmt(pam_handle_t *pamh, int flags)
+{
+    return PAM_AUTH_ERR;
+}
+
+int
+pam_chauthtok(pam_handle_t *pamh, int flags)
+{
+    return chauthtok_rc;
+}
+
+const char *
+pam_strerror(pam_handle_t *pamh, int errnum)
+{
+    return "Authentication token manipulation error";
+}
+
+bool
+XA_shadow_enabled(void)
+{
+    return false;
+}
+
+bool
+XA_shadow_authorize(const char *username, const char *password)
+{
+    return false;
+}
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+/* Change the modification time of the shadow file, as a write would */
+static void
+touch_shadow(void)
+{
+    static time_t next = 1000000000;
+    struct timespec times[2] = { { next, 0 }, { next, 0 } };
+
+    next++;
+    CHECK(utimensat(AT_FDCWD, shadow_path, times, 0) == 0);
+}
+
+/* Insert credentials as verified against the current shadow file */
+static void
+insert(const char *username, const char *password)
+{
+    struct timespec mtime;
+
+    XA_cache_shadow_mtime(&mtime);
+    XA_cache_insert(username, password, &mtime);
+}
+
+static void
+test_disabled(void)
+{
+    XA_cache_configure(0);
+    insert("alice", "secret");
+    CHECK(!XA_cache_check("alice", "secret"));
+}
+
+static void
+test_check(void)
+{
+    XA_cache_configure(60);
+    insert("alice", "secret");
+    CHECK(XA_cache_check("alice", "secret"));
+    CHECK(!XA_cache_check("alice", "wrong"));
+    CHECK(!XA_cache_check("alice", ""));
+    CHECK(!XA_cache_check("bob", "secret"));
+
+    /* disabling drops the entries */
+    XA_cache_configure(0);
+    XA_cache_configure(60);
+    CHECK(!XA_cache_check("alice", "secret"));
+}
+
+static void
+test_expiry(void)
+{
+    XA_cache_configure(1);
+    insert("alice", "secret");
+    CHECK(XA_cache_check("alice", "secret"));
+    usleep(1100 * 1000);
+    CHECK(!XA_cache_check("alice", "secret"));
+}
+
+static void
+test_shadow_changed(void)
+{
+    struct timespec before;
+
+    XA_cache_configure(60);
+    insert("alice", "secret");
+    insert("bob", "password");
+    CHECK(XA_cache_check("alice", "secret"));
+    touch_shadow();
+    CHECK(!XA_cache_check("alice", "secret"));
+    CHECK(!XA_cache_check("bob", "password"));
+
+    /* the file changed while PAM was verifying the password */
+    XA_cache_shadow_mtime(&before);
+    touch_shadow();
+    XA_cache_insert("alice", "secret", &before);
+    CHECK(!XA_cache_check("alice", "secret"));
+}
+
+static void
+test_chpasswd(void)
+{
+    const char *error = NULL;
+
+    XA_cache_configure(60);
+
+    /* a failed change drops the entry of the user all the same */
+    insert("alice", "secret");
+    insert("bob", "password");
+    chauthtok_rc = PAM_AUTHTOK_ERR;
+    CHECK(XA_mh_chpasswd("alice", "new", &error) == XA_ERR_EXTERNAL);
+    CHECK(error);
+    CHECK(!XA_cache_check("alice", "secret"));
+    CHECK(XA_cache_check("bob", "password"));
+
+    insert("alice", "secret");
+    chauthtok_rc = PAM_SUCCESS;
+    CHECK(XA_mh_chpasswd("alice", "new", NULL) == XA_SUCCESS);
+    CHECK(!XA_cache_check("alice", "secret"));
+    CHECK(!XA_cache_check("alice", "new"));
+    CHECK(XA_cache_check("bob", "password"));
+}
+
+int
+main(void)
+{
+    int fd = mkstemp(shadow_path);
+
+    CHECK(fd >= 0);
+    close(fd);
+    touch_shadow();
+
+    test_disabled();
+    test_check();
+    test_expiry();
+    test_shadow_changed();
+    test_chpasswd();
+
+    unlink(shadow_path);
+    printf("OK\n");
+    return 0;
+}
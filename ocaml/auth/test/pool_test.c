@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) Cloud Software Group, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+/* Test of the authentication pool with a fake PAM authentication that
+ * blocks until released, so that the state of the pool can be checked
+ * while requests are running or waiting. */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../xa_auth.h"
+
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static unsigned releases;
+
+int
+XA_mh_authorize(const char *username, const char *password,
+                const char **error)
+{
+    pthread_mutex_lock(&mtx);
+    while (!releases)
+        pthread_cond_wait(&cond, &mtx);
+    releases--;
+    pthread_mutex_unlock(&mtx);
+
+    if (strcmp(password, "good") == 0)
+        return XA_SUCCESS;
+    if (error) *error = "Authentication failure";
+    return XA_ERR_EXTERNAL;
+}
+
+bool
+XA_cache_check(const char *username, const char *password)
+{
+    return false;
+}
+
+static void
+release(unsigned n)
+{
+    pthread_mutex_lock(&mtx);
+    releases += n;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mtx);
+}
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+struct login {
+    pthread_t thread;
+    const char *password;
+    int rc;
+};
+
+static void *
+login_proc(void *arg)
+{
+    struct login *l = arg;
+
+    l->rc = XA_pool_authorize("user", l->password, NULL);
+    return NULL;
+}
+
+static void
+login_start(struct login *l, const char *password)
+{
+    l->password = password;
+    l->rc = -1;
+    CHECK(pthread_create(&l->thread, NULL, login_proc, l) == 0);
+}
+
+static int
+login_wait(struct login *l)
+{
+    CHECK(pthread_join(l->thread, NULL) == 0);
+    return l->rc;
+}
+
+/* Wait for the pool to have given running and queued requests */
+static void
+wait_pool(unsigned running, unsigned queued)
+{
+    struct xa_pool_stats stats;
+
+    for (int i = 0; i < 5000; ++i) {
+        XA_pool_get_stats(&stats);
+        if (stats.running == running && stats.queued == queued)
+            return;
+        usleep(1000);
+    }
+    fprintf(stderr, "pool has %u running and %u queued, expected %u and %u\n",
+            stats.running, stats.queued, running, queued);
+    exit(1);
+}
+
+/* Try a login that must be rejected while the pool is full */
+static void
+check_rejected(void)
+{
+    const char *error = NULL;
+
+    CHECK(XA_pool_authorize("user", "good", &error) == XA_ERR_BUSY);
+    CHECK(error && strstr(error, "Too many"));
+}
+
+static void
+test_no_queue(void)
+{
+    struct xa_pool_stats before, after;
+    struct login a;
+
+    /* a queue of 0 still accepts what the worker can run */
+    XA_pool_configure(1, 0);
+    XA_pool_get_stats(&before);
+    login_start(&a, "good");
+    wait_pool(1, 0);
+    check_rejected();
+    release(1);
+    CHECK(login_wait(&a) == XA_SUCCESS);
+
+    XA_pool_get_stats(&after);
+    CHECK(after.submitted - before.submitted == 2);
+    CHECK(after.rejected - before.rejected == 1);
+    CHECK(after.completed - before.completed == 1);
+    CHECK(after.max_workers == 1 && after.max_queue == 0);
+}
+
+static void
+test_queue(void)
+{
+    struct xa_pool_stats before, after;
+    struct login a, b;
+
+    XA_pool_configure(1, 1);
+    XA_pool_get_stats(&before);
+    login_start(&a, "good");
+    wait_pool(1, 0);
+    login_start(&b, "bad");
+    wait_pool(1, 1);
+    check_rejected();
+    release(2);
+    CHECK(login_wait(&a) == XA_SUCCESS);
+    CHECK(login_wait(&b) == XA_ERR_EXTERNAL);
+
+    XA_pool_get_stats(&after);
+    CHECK(after.submitted - before.submitted == 3);
+    CHECK(after.rejected - before.rejected == 1);
+    CHECK(after.completed - before.completed == 2);
+    CHECK(after.queued == 0 && after.running == 0);
+}
+
+static void
+test_workers(void)
+{
+    struct xa_pool_stats before, after;
+    struct login a, b;
+
+    XA_pool_configure(2, 0);
+    XA_pool_get_stats(&before);
+    login_start(&a, "good");
+    login_start(&b, "good");
+    wait_pool(2, 0);
+    check_rejected();
+    release(2);
+    CHECK(login_wait(&a) == XA_SUCCESS);
+    CHECK(login_wait(&b) == XA_SUCCESS);
+
+    XA_pool_get_stats(&after);
+    CHECK(after.submitted - before.submitted == 3);
+    CHECK(after.rejected - before.rejected == 1);
+    CHECK(after.completed - before.completed == 2);
+    CHECK(after.workers <= 2);
+}
+
+int
+main(void)
+{
+    test_no_queue();
+    test_queue();
+    test_workers();
+    printf("pool tests passed\n");
+    return 0;
+}
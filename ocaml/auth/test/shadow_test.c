@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) Cloud Software Group, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+/* Test of the checks deciding whether passwords can be verified without
+ * PAM: the parser of PAM configurations, run on a temporary directory, and
+ * the checks of shadow entries. The source is included to reach its static
+ * functions. */
+
+#include "../xa_auth_shadow.c"
+
+#include <unistd.h>
+
+bool
+XA_hash_equal(const char *a, const char *b)
+{
+    return strcmp(a, b) == 0;
+}
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+static char dir[] = "/tmp/shadow_test.XXXXXX";
+
+static void
+write_config(const char *service, const char *content)
+{
+    char path[PATH_MAX];
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, service);
+    f = fopen(path, "w");
+    CHECK(f);
+    fputs(content, f);
+    CHECK(fclose(f) == 0);
+}
+
+static bool
+is_unix(const char *content)
+{
+    int rules = 0;
+
+    write_config("xapi", content);
+    return pam_stack_is_unix(dir, "xapi", 0, &rules) && rules > 0;
+}
+
+static void
+test_config(void)
+{
+    CHECK(is_unix("#%PAM-1.0\n"
+                  "\n"
+                  "auth       required    pam_unix.so nullok\n"
+                  "account    required    /lib64/security/pam_unix.so\n"));
+    CHECK(is_unix("auth [success=done default=die] pam_unix.so\n"
+                  "-account sufficient pam_unix.so\n"));
+    /* only auth and account rules run for a login */
+    CHECK(is_unix("auth required pam_unix.so\n"
+                  "password required pam_pwquality.so\n"
+                  "session optional pam_keyinit.so\n"));
+    CHECK(!is_unix("# no rules\n"));
+    CHECK(!is_unix("auth required pam_unix.so\n"
+                   "auth required pam_faillock.so\n"));
+    CHECK(!is_unix("auth [success=ok default=die pam_unix.so\n"));
+    CHECK(!is_unix("auth required\n"));
+
+    write_config("system-auth", "auth sufficient pam_unix.so\n"
+                                "account required pam_unix.so\n"
+                                "password required pam_pwquality.so\n");
+    CHECK(is_unix("auth include system-auth\n"
+                  "account substack system-auth\n"));
+    CHECK(is_unix("@include system-auth\n"));
+    CHECK(!is_unix("auth include missing\n"));
+    CHECK(!is_unix("auth include ../xapi\n"));
+
+    write_config("system-auth", "auth required pam_env.so\n"
+                                "auth sufficient pam_unix.so\n");
+    CHECK(!is_unix("auth include system-auth\n"));
+    CHECK(!is_unix("@include system-auth\n"));
+
+    /* included configurations including each other */
+    write_config("system-auth", "auth include xapi\n");
+    CHECK(!is_unix("auth include system-auth\n"));
+}
+
+static void
+test_entry(void)
+{
+    long today = time(NULL) / (60 * 60 * 24);
+    struct spwd sp = {
+        .sp_namp = "user",
+        .sp_pwdp = "$6$salt$hash",
+        .sp_lstchg = today - 10,
+        .sp_min = 0,
+        .sp_max = 99999,
+        .sp_warn = 7,
+        .sp_inact = -1,
+        .sp_expire = -1,
+    };
+    struct spwd s;
+
+    CHECK(shadow_entry_usable(&sp));
+
+    s = sp;
+    s.sp_pwdp = "!$6$salt$hash";
+    CHECK(!shadow_entry_usable(&s));
+    s.sp_pwdp = "*";
+    CHECK(!shadow_entry_usable(&s));
+    s.sp_pwdp = "";
+    CHECK(!shadow_entry_usable(&s));
+
+    /* expired accounts */
+    s = sp;
+    s.sp_expire = today + 1;
+    CHECK(shadow_entry_usable(&s));
+    s.sp_expire = today;
+    CHECK(!shadow_entry_usable(&s));
+
+    /* change forced by the administrator */
+    s = sp;
+    s.sp_lstchg = 0;
+    CHECK(!shadow_entry_usable(&s));
+    s.sp_lstchg = -1;
+    CHECK(shadow_entry_usable(&s));
+
+    /* password older than its maximum age */
+    s = sp;
+    s.sp_max = 10;
+    CHECK(shadow_entry_usable(&s));
+    s.sp_max = 9;
+    CHECK(!shadow_entry_usable(&s));
+    s.sp_max = -1;
+    CHECK(shadow_entry_usable(&s));
+}
+
+int
+main(void)
+{
+    char path[PATH_MAX];
+
+    CHECK(mkdtemp(dir));
+    test_config();
+    test_entry();
+
+    snprintf(path, sizeof(path), "%s/xapi", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/system-auth", dir);
+    unlink(path);
+    rmdir(dir);
+    printf("OK\n");
+    return 0;
+}
@@ -75,7 +75,13 @@ int XA_mh_authorize (const char *username, const char *password,
     struct pam_conv xa_conv = {xa_auth_conv, &auth_info};
     pam_handle_t *pamh;
     int rc = XA_SUCCESS;
+    struct timespec shadow_mtime;
 
+    XA_cache_shadow_mtime(&shadow_mtime);
+    if (XA_shadow_enabled() && XA_shadow_authorize(username, password)) {
+        XA_cache_insert(username, password, &shadow_mtime);
+        return XA_SUCCESS;
+    }
     if ((rc = pam_start(SERVICE_NAME, username, &xa_conv, &pamh))
         != PAM_SUCCESS) {
         goto exit;
@@ -94,6 +100,7 @@ int XA_mh_authorize (const char *username, const char *password,
         rc = XA_ERR_EXTERNAL;
     }
     else {
+        XA_cache_insert(username, password, &shadow_mtime);
         rc = XA_SUCCESS;
     }
     return rc;
@@ -106,11 +113,15 @@ int XA_mh_chpasswd (const char *username, const char *new_passwd, const char **e
     pam_handle_t *pamh;
     int rc = XA_SUCCESS;
 
+    /* the old password must not be accepted from the cache, even if the
+       change fails half way */
+    XA_cache_invalidate(username);
     if ((rc = pam_start(SERVICE_NAME, username, &xa_conv, &pamh))
         != PAM_SUCCESS) {
         goto exit;
     }
     rc = pam_chauthtok(pamh, 0);
+    XA_cache_invalidate(username);
 
  exit:
     if (rc != PAM_SUCCESS) {
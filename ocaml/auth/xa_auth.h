@@ -14,8 +14,17 @@
 #ifndef XA_AUTH_H_
 #define XA_AUTH_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
 #define XA_SUCCESS 0
 #define XA_ERR_EXTERNAL 1
+#define XA_ERR_BUSY 2
+
+/* Histogram bucket i counts durations below 2^i microseconds not counted in
+   a previous bucket, the last bucket counts all longer durations */
+#define XA_POOL_HIST_BUCKETS 24
 
 extern int XA_mh_authorize (const char *username, const char *password, 
 			    const char **error);
@@ -23,4 +32,60 @@ extern int XA_mh_authorize (const char *username, const char *password,
 extern int XA_mh_chpasswd (const char *username, const char *new_passwd, 
 			   const char **error);
 
+struct xa_pool_stats {
+    uint64_t submitted;
+    uint64_t rejected;
+    uint64_t completed;
+    uint64_t cache_hits;
+    unsigned queued;
+    unsigned running;
+    unsigned workers;
+    unsigned max_workers;
+    unsigned max_queue;
+    uint64_t queue_wait[XA_POOL_HIST_BUCKETS];
+    uint64_t pam_time[XA_POOL_HIST_BUCKETS];
+};
+
+/* Set the maximum number of worker threads running PAM and the maximum number
+   of requests waiting for a busy worker, requests a free worker can run
+   straight away are always accepted */
+extern void XA_pool_configure (unsigned max_workers, unsigned max_queue);
+
+/* Same as XA_mh_authorize but executed by a worker of the pool, returns
+   XA_ERR_BUSY without waiting if the queue is full */
+extern int XA_pool_authorize (const char *username, const char *password,
+                              const char **error);
+
+extern void XA_pool_get_stats (struct xa_pool_stats *stats);
+
+/* Cache of verified credentials, disabled if the TTL is 0 (the default) */
+extern void XA_cache_configure (unsigned ttl_seconds);
+
+/* Whether password was verified for username within the TTL */
+extern bool XA_cache_check (const char *username, const char *password);
+
+/* Record a successful verification, verified_mtime is the modification time
+   of the shadow file taken before the verification started */
+extern void XA_cache_insert (const char *username, const char *password,
+                             const struct timespec *verified_mtime);
+
+extern void XA_cache_invalidate (const char *username);
+
+extern void XA_cache_shadow_mtime (struct timespec *mtime);
+
+/* Compare two password hashes in constant time */
+extern bool XA_hash_equal (const char *a, const char *b);
+
+/* Enable verifying passwords against the shadow file without PAM, only
+   enabled if the auth and account rules of the PAM configuration, including
+   the configurations it includes, use just pam_unix. Returns whether it is
+   enabled. */
+extern bool XA_shadow_configure (bool enable);
+
+extern bool XA_shadow_enabled (void);
+
+/* Whether the shadow file verifies password for username, false if that
+   cannot be decided without PAM. Does not check XA_shadow_enabled. */
+extern bool XA_shadow_authorize (const char *username, const char *password);
+
 #endif /* _XA_AUTH_H_ */
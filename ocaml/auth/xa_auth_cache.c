@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) Cloud Software Group, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+/* Cache of credentials recently verified by PAM.
+ * Passwords are never stored, only a SHA-512 crypt of them with a random
+ * per-entry salt, cheaper than a PAM round but still slow enough to make
+ * guessing from a memory dump expensive.
+ * Entries expire after the TTL, the whole cache is dropped when /etc/shadow
+ * changes and the entry of a user when their password is changed through
+ * XA_mh_chpasswd. */
+
+#define _GNU_SOURCE
+
+#include <crypt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "xa_auth.h"
+
+#define CACHE_ENTRIES 128
+#ifndef SHADOW_FILE
+#define SHADOW_FILE "/etc/shadow"
+#endif
+#define HASH_PREFIX "$6$rounds=1000$"
+#define SALT_LEN 16
+
+struct entry {
+    char *username;
+    char hash[CRYPT_OUTPUT_SIZE];
+    uint64_t expire_ns;
+};
+
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct entry entries[CACHE_ENTRIES];
+static uint64_t ttl_ns;
+static struct timespec shadow_mtime;
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void
+clear_entry(struct entry *e)
+{
+    free(e->username);
+    memset(e, 0, sizeof(*e));
+}
+
+static void
+flush(void)
+{
+    for (int i = 0; i < CACHE_ENTRIES; i++)
+        clear_entry(&entries[i]);
+}
+
+/* Drop everything if the shadow file changed, called with mtx held */
+static void
+check_shadow(const struct timespec *mtime)
+{
+    if (mtime->tv_sec != shadow_mtime.tv_sec
+        || mtime->tv_nsec != shadow_mtime.tv_nsec) {
+        flush();
+        shadow_mtime = *mtime;
+    }
+}
+
+void
+XA_cache_shadow_mtime(struct timespec *mtime)
+{
+    struct stat st;
+
+    /* a missing file never matches a real modification time */
+    if (stat(SHADOW_FILE, &st) == 0)
+        *mtime = st.st_mtim;
+    else
+        *mtime = (struct timespec) { -1, 0 };
+}
+
+static struct entry *
+find(const char *username)
+{
+    for (int i = 0; i < CACHE_ENTRIES; i++)
+        if (entries[i].username && strcmp(entries[i].username, username) == 0)
+            return &entries[i];
+    return NULL;
+}
+
+/* Hash password with the salt from setting, NULL on failure */
+static const char *
+hash_password(const char *password, const char *setting,
+              struct crypt_data *data)
+{
+    const char *hash = crypt_r(password, setting, data);
+
+    if (!hash || *hash == '*' || strlen(hash) >= CRYPT_OUTPUT_SIZE)
+        return NULL;
+    return hash;
+}
+
+bool
+XA_hash_equal(const char *a, const char *b)
+{
+    size_t len = strlen(a);
+    unsigned char diff = 0;
+
+    if (len != strlen(b))
+        return false;
+    for (size_t i = 0; i < len; i++)
+        diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+void
+XA_cache_configure(unsigned ttl_seconds)
+{
+    pthread_mutex_lock(&mtx);
+    ttl_ns = ttl_seconds * 1000000000ull;
+    if (!ttl_ns)
+        flush();
+    pthread_mutex_unlock(&mtx);
+}
+
+bool
+XA_cache_check(const char *username, const char *password)
+{
+    struct timespec mtime;
+    char setting[CRYPT_OUTPUT_SIZE];
+    char hash[CRYPT_OUTPUT_SIZE];
+    struct entry *e;
+
+    XA_cache_shadow_mtime(&mtime);
+    pthread_mutex_lock(&mtx);
+    check_shadow(&mtime);
+    e = ttl_ns ? find(username) : NULL;
+    if (e && e->expire_ns <= now_ns()) {
+        clear_entry(e);
+        e = NULL;
+    }
+    if (e) {
+        strcpy(hash, e->hash);
+        strcpy(setting, e->hash);
+    }
+    pthread_mutex_unlock(&mtx);
+    if (!e)
+        return false;
+
+    struct crypt_data *data = calloc(1, sizeof(*data));
+    if (!data)
+        return false;
+    const char *computed = hash_password(password, setting, data);
+    bool ok = computed && XA_hash_equal(computed, hash);
+    explicit_bzero(data, sizeof(*data));
+    free(data);
+    return ok;
+}
+
+void
+XA_cache_insert(const char *username, const char *password,
+                const struct timespec *verified_mtime)
+{
+    static const char alphabet[] =
+        "./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+    unsigned char rnd[SALT_LEN];
+    char setting[sizeof(HASH_PREFIX) + SALT_LEN + 1];
+    struct crypt_data *data;
+    const char *hash;
+    char *name;
+
+    pthread_mutex_lock(&mtx);
+    bool enabled = ttl_ns != 0;
+    pthread_mutex_unlock(&mtx);
+    if (!enabled)
+        return;
+
+    if (getrandom(rnd, sizeof(rnd), 0) != sizeof(rnd))
+        return;
+    strcpy(setting, HASH_PREFIX);
+    for (int i = 0; i < SALT_LEN; i++)
+        setting[strlen(HASH_PREFIX) + i] = alphabet[rnd[i] % 64];
+    strcpy(setting + strlen(HASH_PREFIX) + SALT_LEN, "$");
+
+    data = calloc(1, sizeof(*data));
+    name = strdup(username);
+    hash = data && name ? hash_password(password, setting, data) : NULL;
+    if (!hash) {
+        free(name);
+        free(data);
+        return;
+    }
+
+    pthread_mutex_lock(&mtx);
+    /* the password was verified against this version of the shadow file,
+       do not cache it if the file changed since */
+    struct timespec mtime;
+    XA_cache_shadow_mtime(&mtime);
+    check_shadow(&mtime);
+    if (ttl_ns && verified_mtime->tv_sec == mtime.tv_sec
+        && verified_mtime->tv_nsec == mtime.tv_nsec) {
+        uint64_t now = now_ns();
+        struct entry *e = find(username);
+        /* reuse the entry of the user, an empty or expired one or the one
+           expiring first */
+        for (int i = 0; !e && i < CACHE_ENTRIES; i++)
+            if (!entries[i].username || entries[i].expire_ns <= now)
+                e = &entries[i];
+        if (!e) {
+            e = &entries[0];
+            for (int i = 1; i < CACHE_ENTRIES; i++)
+                if (entries[i].expire_ns < e->expire_ns)
+                    e = &entries[i];
+        }
+        clear_entry(e);
+        e->username = name;
+        name = NULL;
+        strcpy(e->hash, hash);
+        e->expire_ns = now + ttl_ns;
+    }
+    pthread_mutex_unlock(&mtx);
+
+    free(name);
+    explicit_bzero(data, sizeof(*data));
+    free(data);
+}
+
+void
+XA_cache_invalidate(const char *username)
+{
+    pthread_mutex_lock(&mtx);
+    struct entry *e = find(username);
+    if (e)
+        clear_entry(e);
+    pthread_mutex_unlock(&mtx);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-set-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
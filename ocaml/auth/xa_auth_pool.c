@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) Cloud Software Group, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+/* Bounded pool of threads running PAM authentications.
+ * Callers queue a request and wait for a worker to complete it, so no more
+ * than max_workers authentications run at the same time however many
+ * threads try to log in. If max_queue requests are already waiting for a
+ * worker to be free new ones are rejected immediately instead of adding to
+ * the pile. */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "xa_auth.h"
+
+struct request {
+    struct request *next;
+    const char *username;
+    const char *password;
+    const char *error;
+    int rc;
+    bool done;
+    uint64_t queued_ns;
+    pthread_cond_t cond;
+};
+
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static struct request *queue_head, **queue_tail = &queue_head;
+static unsigned idle_workers;
+static struct xa_pool_stats stats = {
+    .max_workers = 8,
+    .max_queue = 256,
+};
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void
+hist_add(uint64_t *hist, uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    unsigned bucket = us ? 64 - __builtin_clzll(us) : 0;
+
+    if (bucket >= XA_POOL_HIST_BUCKETS)
+        bucket = XA_POOL_HIST_BUCKETS - 1;
+    hist[bucket]++;
+}
+
+static void *
+worker(void *arg __attribute__((unused)))
+{
+    pthread_mutex_lock(&mtx);
+    while (stats.workers <= stats.max_workers) {
+        struct request *req = queue_head;
+        if (!req) {
+            idle_workers++;
+            pthread_cond_wait(&work_cond, &mtx);
+            idle_workers--;
+            continue;
+        }
+        queue_head = req->next;
+        if (!queue_head)
+            queue_tail = &queue_head;
+        stats.queued--;
+        stats.running++;
+
+        uint64_t start = now_ns();
+        hist_add(stats.queue_wait, start - req->queued_ns);
+        pthread_mutex_unlock(&mtx);
+
+        const char *error = NULL;
+        int rc = XA_mh_authorize(req->username, req->password, &error);
+        uint64_t end = now_ns();
+
+        pthread_mutex_lock(&mtx);
+        hist_add(stats.pam_time, end - start);
+        stats.running--;
+        stats.completed++;
+        req->rc = rc;
+        req->error = error;
+        req->done = true;
+        pthread_cond_signal(&req->cond);
+    }
+    /* pool was shrunk */
+    stats.workers--;
+    pthread_mutex_unlock(&mtx);
+    return NULL;
+}
+
+/* Start a new worker, called with mtx held.
+ * Signals are blocked as PAM modules do not expect to be interrupted and the
+ * OCaml runtime must handle them in its own threads. */
+static bool
+start_worker(void)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    sigset_t all, old;
+    int rc;
+
+    if (pthread_attr_init(&attr))
+        return false;
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    rc = pthread_create(&thread, &attr, worker, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_attr_destroy(&attr);
+    if (rc)
+        return false;
+    stats.workers++;
+    return true;
+}
+
+void
+XA_pool_configure(unsigned max_workers, unsigned max_queue)
+{
+    pthread_mutex_lock(&mtx);
+    stats.max_workers = max_workers ? max_workers : 1;
+    stats.max_queue = max_queue;
+    /* wake idle workers so surplus ones exit */
+    pthread_cond_broadcast(&work_cond);
+    pthread_mutex_unlock(&mtx);
+}
+
+int
+XA_pool_authorize(const char *username, const char *password,
+                  const char **error)
+{
+    struct request req = {
+        .username = username,
+        .password = password,
+        .queued_ns = now_ns(),
+    };
+
+    if (XA_cache_check(username, password)) {
+        pthread_mutex_lock(&mtx);
+        stats.cache_hits++;
+        pthread_mutex_unlock(&mtx);
+        return XA_SUCCESS;
+    }
+
+    pthread_mutex_lock(&mtx);
+    stats.submitted++;
+    /* requests an idle or a new worker picks straight away do not wait,
+     * so a max_queue of 0 still lets max_workers authentications run */
+    unsigned free_workers = idle_workers;
+    if (stats.workers < stats.max_workers)
+        free_workers += stats.max_workers - stats.workers;
+    if (stats.queued >= free_workers + stats.max_queue) {
+        stats.rejected++;
+        pthread_mutex_unlock(&mtx);
+        if (error) *error = "Too many pending authentication requests";
+        return XA_ERR_BUSY;
+    }
+
+    if (idle_workers <= stats.queued && stats.workers < stats.max_workers
+        && !start_worker() && stats.workers == 0) {
+        /* no worker can pick the request, run it on this thread */
+        stats.running++;
+        pthread_mutex_unlock(&mtx);
+        uint64_t start = now_ns();
+        int rc = XA_mh_authorize(username, password, error);
+        uint64_t end = now_ns();
+        pthread_mutex_lock(&mtx);
+        hist_add(stats.queue_wait, start - req.queued_ns);
+        hist_add(stats.pam_time, end - start);
+        stats.running--;
+        stats.completed++;
+        pthread_mutex_unlock(&mtx);
+        return rc;
+    }
+
+    pthread_cond_init(&req.cond, NULL);
+    *queue_tail = &req;
+    queue_tail = &req.next;
+    stats.queued++;
+    pthread_cond_signal(&work_cond);
+    while (!req.done)
+        pthread_cond_wait(&req.cond, &mtx);
+    pthread_mutex_unlock(&mtx);
+    pthread_cond_destroy(&req.cond);
+
+    if (error) *error = req.error;
+    return req.rc;
+}
+
+void
+XA_pool_get_stats(struct xa_pool_stats *out)
+{
+    pthread_mutex_lock(&mtx);
+    *out = stats;
+    pthread_mutex_unlock(&mtx);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-set-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
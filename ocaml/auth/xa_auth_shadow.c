@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) Cloud Software Group, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+/* Verify local passwords against the shadow file without PAM.
+ * Only used if the auth and account rules of the PAM configuration of the
+ * service, including the configurations it includes, all use pam_unix, in
+ * which case this does what pam_unix would do for a successful login.
+ * Anything else, including a wrong password, is left to PAM so that
+ * failures are delayed, logged and counted as usual. */
+
+#define _GNU_SOURCE
+
+#include <crypt.h>
+#include <ctype.h>
+#include <limits.h>
+#include <pwd.h>
+#include <shadow.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xa_auth.h"
+
+#define PAM_DIR "/etc/pam.d"
+#define PAM_SERVICE "xapi"
+/* Nesting limit of included PAM configurations, also stops loops */
+#define PAM_MAX_DEPTH 8
+#define BUFLEN 4096
+
+static bool shadow_enabled;
+
+/* Next word of the line at *p, NUL terminated, empty at the end of the line.
+ * A word starting with '[' extends to the closing ']'. */
+static char *
+next_word(char **p)
+{
+    char *word = *p + strspn(*p, " \t"), *end;
+
+    if (*word == '[') {
+        end = strchr(word, ']');
+        end = end ? end + 1 : word + strlen(word);
+    } else {
+        end = word + strcspn(word, " \t\n");
+    }
+    *p = *end ? end + 1 : end;
+    *end = 0;
+    return word;
+}
+
+/* Whether every auth and account rule of the PAM configuration of service
+ * in dir uses pam_unix, following include, substack and @include into the
+ * configurations they name. These are the only rules run by a login.
+ * Counts the rules checked in *rules. */
+static bool
+pam_stack_is_unix(const char *dir, const char *service, int depth, int *rules)
+{
+    char path[PATH_MAX], line[1024];
+    bool is_unix = true;
+    FILE *f;
+
+    if (depth > PAM_MAX_DEPTH || !*service || strchr(service, '/'))
+        return false;
+    if (snprintf(path, sizeof(path), "%s/%s", dir, service) >= (int) sizeof(path))
+        return false;
+    f = fopen(path, "re");
+    if (!f)
+        return false;
+    while (is_unix && fgets(line, sizeof(line), f)) {
+        char *p = line, *type, *control, *module;
+
+        while (isspace((unsigned char) *p))
+            p++;
+        if (!*p || *p == '#')
+            continue;
+        type = next_word(&p);
+        if (strcmp(type, "@include") == 0) {
+            is_unix = pam_stack_is_unix(dir, next_word(&p), depth + 1, rules);
+            continue;
+        }
+        /* a leading '-' only silences missing modules */
+        if (*type == '-')
+            type++;
+        control = next_word(&p);
+        module = next_word(&p);
+        if (strcmp(type, "auth") != 0 && strcmp(type, "account") != 0)
+            continue;
+        if (strcmp(control, "include") == 0
+            || strcmp(control, "substack") == 0) {
+            is_unix = pam_stack_is_unix(dir, module, depth + 1, rules);
+            continue;
+        }
+        if (strrchr(module, '/'))
+            module = strrchr(module, '/') + 1;
+        is_unix = strcmp(module, "pam_unix.so") == 0;
+        (*rules)++;
+    }
+    fclose(f);
+    return is_unix;
+}
+
+static bool
+pam_config_is_unix(void)
+{
+    int rules = 0;
+
+    return pam_stack_is_unix(PAM_DIR, PAM_SERVICE, 0, &rules) && rules > 0;
+}
+
+bool
+XA_shadow_configure(bool enable)
+{
+    bool enabled = enable && pam_config_is_unix();
+
+    __atomic_store_n(&shadow_enabled, enabled, __ATOMIC_RELAXED);
+    return enabled;
+}
+
+bool
+XA_shadow_enabled(void)
+{
+    return __atomic_load_n(&shadow_enabled, __ATOMIC_RELAXED);
+}
+
+/* Same checks as the account management of pam_unix */
+static bool
+account_valid(const struct spwd *sp)
+{
+    long today = time(NULL) / (60 * 60 * 24);
+
+    if (sp->sp_expire != -1 && today >= sp->sp_expire)
+        return false;
+    /* password change forced by the administrator */
+    if (sp->sp_lstchg == 0)
+        return false;
+    if (sp->sp_max != -1 && sp->sp_lstchg != -1
+        && today - sp->sp_lstchg > sp->sp_max)
+        return false;
+    return true;
+}
+
+/* Whether sp can be verified here, empty, locked or disabled passwords go
+ * through PAM */
+static bool
+shadow_entry_usable(const struct spwd *sp)
+{
+    return sp->sp_pwdp[0] && sp->sp_pwdp[0] != '!' && sp->sp_pwdp[0] != '*'
+        && account_valid(sp);
+}
+
+bool
+XA_shadow_authorize(const char *username, const char *password)
+{
+    struct passwd pwd, *pw;
+    struct spwd spw, *sp;
+    char pwbuf[BUFLEN], spbuf[BUFLEN];
+    struct crypt_data *data;
+    const char *hash;
+    bool ok;
+
+    if (getpwnam_r(username, &pwd, pwbuf, BUFLEN, &pw) != 0 || !pw
+        || getspnam_r(username, &spw, spbuf, BUFLEN, &sp) != 0 || !sp)
+        return false;
+    if (!shadow_entry_usable(sp))
+        return false;
+
+    data = calloc(1, sizeof(*data));
+    if (!data)
+        return false;
+    hash = crypt_r(password, sp->sp_pwdp, data);
+    ok = hash && *hash != '*' && XA_hash_equal(hash, sp->sp_pwdp);
+    explicit_bzero(data, sizeof(*data));
+    free(data);
+    explicit_bzero(spbuf, sizeof(spbuf));
+    return ok;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-set-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -40,16 +40,94 @@ CAMLprim value stub_XA_mh_authorize(value username, value password){
     int rc;
 
     caml_release_runtime_system();
-    rc = XA_mh_authorize(c_username, c_password, &error);
+    rc = XA_pool_authorize(c_username, c_password, &error);
     free(c_username);
     free(c_password);
     caml_acquire_runtime_system();
 
+    if (rc == XA_ERR_BUSY)
+        caml_raise_constant(*caml_named_value("Pam.Queue_full"));
     if (rc != XA_SUCCESS)
         caml_failwith(error ? error : "Unknown error");
     CAMLreturn(ret);
 }
 
+/* max_workers:int -> max_queue:int -> unit */
+CAMLprim value stub_XA_pool_configure(value max_workers, value max_queue)
+{
+    XA_pool_configure(Long_val(max_workers) > 0 ? Long_val(max_workers) : 1,
+                      Long_val(max_queue) > 0 ? Long_val(max_queue) : 0);
+    return Val_unit;
+}
+
+static value alloc_histogram(const uint64_t *hist)
+{
+    CAMLparam0();
+    CAMLlocal1(res);
+    int i;
+
+    res = caml_alloc(XA_POOL_HIST_BUCKETS, 0);
+    for (i = 0; i < XA_POOL_HIST_BUCKETS; i++)
+        Store_field(res, i, Val_long(hist[i]));
+    CAMLreturn(res);
+}
+
+/* ttl:int -> unit */
+CAMLprim value stub_XA_cache_configure(value ttl)
+{
+    XA_cache_configure(Long_val(ttl) > 0 ? Long_val(ttl) : 0);
+    return Val_unit;
+}
+
+/* bool -> bool */
+CAMLprim value stub_XA_shadow_configure(value enable)
+{
+    return Val_bool(XA_shadow_configure(Bool_val(enable)));
+}
+
+/* username:string -> password:string -> bool */
+CAMLprim value stub_XA_shadow_authorize(value username, value password)
+{
+    CAMLparam2(username, password);
+    char *c_username = caml_stat_strdup(String_val(username));
+    char *c_password = caml_stat_strdup(String_val(password));
+    bool ok;
+
+    caml_release_runtime_system();
+    ok = XA_shadow_authorize(c_username, c_password);
+    caml_stat_free(c_username);
+    caml_stat_free(c_password);
+    caml_acquire_runtime_system();
+
+    CAMLreturn(Val_bool(ok));
+}
+
+/* unit -> Pool.stats */
+CAMLprim value stub_XA_pool_stats(value unit)
+{
+    CAMLparam1(unit);
+    CAMLlocal3(res, queue_wait, pam_time);
+    struct xa_pool_stats stats;
+
+    XA_pool_get_stats(&stats);
+    queue_wait = alloc_histogram(stats.queue_wait);
+    pam_time = alloc_histogram(stats.pam_time);
+
+    res = caml_alloc_tuple(11);
+    Store_field(res, 0, Val_long(stats.submitted));
+    Store_field(res, 1, Val_long(stats.rejected));
+    Store_field(res, 2, Val_long(stats.completed));
+    Store_field(res, 3, Val_long(stats.cache_hits));
+    Store_field(res, 4, Val_long(stats.queued));
+    Store_field(res, 5, Val_long(stats.running));
+    Store_field(res, 6, Val_long(stats.workers));
+    Store_field(res, 7, Val_long(stats.max_workers));
+    Store_field(res, 8, Val_long(stats.max_queue));
+    Store_field(res, 9, queue_wait);
+    Store_field(res, 10, pam_time);
+    CAMLreturn(res);
+}
+
 CAMLprim value stub_XA_mh_chpasswd(value username, value new_password){
     CAMLparam2(username, new_password);
     CAMLlocal1(ret);
@@ -16,6 +16,7 @@
 
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <sys/types.h>
@@ -84,3 +85,23 @@ close_fds_from(int fd_from)
 
     return true;
 }
+
+int
+keep_only_fd(int fd)
+{
+    if (fd != 3) {
+        if (dup2(fd, 3) < 0)
+            return -1;
+        fd = 3;
+    }
+    if (!close_fds_from(4))
+        return -1;
+
+    close(0);
+    close(1);
+    if (open("/dev/null", O_RDONLY) != 0
+        || open("/dev/null", O_WRONLY) != 1
+        || dup2(1, 2) < 0)
+        return -1;
+    return fd;
+}
@@ -17,3 +17,9 @@
 #include <stdbool.h>
 
 bool close_fds_from(int fd);
+
+// Close all file descriptors except "fd", which is moved to 3, and
+// redirect standard ones to /dev/null. Used by long-lived processes
+// which must not keep descriptors inherited from the parent.
+// Returns new file descriptor or -1 on error.
+int keep_only_fd(int fd);
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) Cloud Software Group, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/vfs.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/magic.h>
+
+#include "resource_class.h"
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+// slices created by systemd, see scripts/forkexecd.slice
+#define CGROUP_SLICE CGROUP_ROOT "/forkexecd.slice"
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+
+struct resource_class {
+    const char *name;
+    // fallbacks if the class slice is not available
+    int nice;
+    int ioprio_class, ioprio_level;
+};
+
+// cgroup v2 settings of the classes are in their slices,
+// scripts/forkexecd-<name>.slice
+static const resource_class classes[] = {
+    // latency critical commands like tap-ctl
+    { "interactive", 0, IOPRIO_CLASS_BE, 2 },
+    // periodic or maintenance commands
+    { "background", 5, IOPRIO_CLASS_BE, 6 },
+    // long running data movers and compressors, like sparse_dd,
+    // vhd-util coalesce or gzip
+    { "bulk", 19, IOPRIO_CLASS_IDLE, 0 },
+};
+
+const resource_class *
+resource_class_find(const char *name)
+{
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); ++i)
+        if (strcmp(classes[i].name, name) == 0)
+            return &classes[i];
+    return NULL;
+}
+
+// Write a string to a cgroup file, returns false on failure.
+static bool
+write_file(const char *dir, const char *file, const char *value)
+{
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    int fd = open(path, O_WRONLY|O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    // virtual file system, partial writes are not possible
+    ssize_t written = write(fd, value, strlen(value));
+    close(fd);
+    return written >= 0;
+}
+
+static bool
+is_cgroup2(const char *path)
+{
+    struct statfs st;
+
+    return statfs(path, &st) == 0 && st.f_type == CGROUP2_SUPER_MAGIC;
+}
+
+// Move the process to the slice of the class.
+// Returns false if the class settings could not be applied.
+static bool
+apply_cgroup(const resource_class *rc)
+{
+    char dir[128], pid[32];
+
+    if (!is_cgroup2(CGROUP_ROOT))
+        return false;
+
+    // The slice is configured by systemd, we only join it
+    snprintf(dir, sizeof(dir), CGROUP_SLICE "/forkexecd-%s.slice", rc->name);
+    snprintf(pid, sizeof(pid), "%ld\n", (long int) getpid());
+    if (!write_file(dir, "cgroup.procs", pid))
+        return false;
+
+    // without cpu controller the weights are not applied
+    char path[256];
+    snprintf(path, sizeof(path), "%s/cpu.weight", dir);
+    return access(path, F_OK) == 0;
+}
+
+bool
+resource_class_apply(const resource_class *rc)
+{
+    if (apply_cgroup(rc))
+        return true;
+
+    // no cgroup v2 or controllers, use priorities, inherited by the
+    // executed command
+    bool res = true;
+    if (rc->nice && setpriority(PRIO_PROCESS, 0, rc->nice) < 0)
+        res = false;
+    int ioprio = (rc->ioprio_class << IOPRIO_CLASS_SHIFT) | rc->ioprio_level;
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio) < 0)
+        res = false;
+    return res;
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) Cloud Software Group, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+// Resource classes for executed commands, passed with "-c" option.
+// Each class is a systemd slice, forkexecd-<class>.slice below
+// forkexecd.slice, with its own CPU and I/O weights and memory limit.
+// If the slice or cgroup v2 are not available nice and I/O priority are
+// used instead.
+
+typedef struct resource_class resource_class;
+
+// Returns class with given name or NULL if not found.
+const resource_class *resource_class_find(const char *name);
+
+// Move current process to the class.
+// Failures are not fatal, process keeps running with default
+// priorities, returns false in this case.
+bool resource_class_apply(const resource_class *rc);
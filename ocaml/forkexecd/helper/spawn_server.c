@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) Cloud Software Group, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "close_from.h"
+#include "spawn_server.h"
+
+extern char **environ;
+
+typedef struct {
+    spawn_request req;
+    char strings[SPAWN_SERVER_MAX_REQUEST - sizeof(spawn_request)];
+} request_buf;
+
+// Fork-like clone, the child continues on a copy of the stack.
+static pid_t
+clone_parent(void)
+{
+    return syscall(SYS_clone, CLONE_PARENT | SIGCHLD, NULL, NULL, NULL, NULL);
+}
+
+// Split strings in the request into NULL terminated arrays.
+// Returns 0 on success or error number.
+static int
+parse_strings(char *p, size_t len, unsigned num, char ***out)
+{
+    char **list = calloc(num + 1, sizeof(char *));
+    if (!list)
+        return ENOMEM;
+
+    char *const end = p + len;
+    for (unsigned i = 0; i < num; ++i) {
+        char *nul = memchr(p, 0, end - p);
+        if (!nul) {
+            free(list);
+            return EINVAL;
+        }
+        list[i] = p;
+        p = nul + 1;
+    }
+    *out = list;
+    return 0;
+}
+
+static void
+close_fds(const int *fds, unsigned num)
+{
+    for (unsigned i = 0; i < num; ++i)
+        close(fds[i]);
+}
+
+static int
+send_reply(int sock, int err, pid_t pid)
+{
+    spawn_reply reply = { err, pid };
+    ssize_t res;
+
+    while ((res = send(sock, &reply, sizeof(reply), MSG_NOSIGNAL)) < 0
+           && errno == EINTR)
+        continue;
+    return res == sizeof(reply) ? 0 : -1;
+}
+
+// Handle a received request, returns error number or 0.
+static int
+handle_request(int sock, request_buf *buf, size_t len, const int *fds,
+               unsigned num_fds, pid_t *pid)
+{
+    const spawn_request *req = &buf->req;
+    char **args = NULL, **envs = NULL;
+    int err;
+
+    if (len < sizeof(spawn_request) || req->num_fds != num_fds
+        || req->num_args < 1)
+        return EINVAL;
+
+    len -= sizeof(spawn_request);
+    err = parse_strings(buf->strings, len, req->num_args, &args);
+    if (err)
+        return err;
+    size_t args_len = args[req->num_args - 1] - buf->strings
+        + strlen(args[req->num_args - 1]) + 1;
+    err = parse_strings(buf->strings + args_len, len - args_len,
+                        req->num_envs, &envs);
+    if (err) {
+        free(args);
+        return err;
+    }
+
+    *pid = clone_parent();
+    if (*pid == 0) {
+        // child, it will execute the command
+        close(sock);
+        environ = envs;
+        set_fd_map(req->fds, fds, num_fds);
+        run_helper(req->num_args, args);
+    }
+    err = *pid < 0 ? errno : 0;
+
+    free(envs);
+    free(args);
+    return err;
+}
+
+int
+spawn_server(int sock)
+{
+    static request_buf buf;
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * SPAWN_SERVER_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+
+    // Do not keep any file descriptor inherited from the client, they
+    // could be pipes whose ends would never be closed.
+    sock = keep_only_fd(sock);
+    if (sock < 0)
+        return 1;
+
+    // the socket must not leak to the executed commands
+    if (fcntl(sock, F_SETFD, FD_CLOEXEC) < 0)
+        return 1;
+
+    // the client can disappear, handle the error on send
+    signal(SIGPIPE, SIG_IGN);
+
+    for (;;) {
+        struct iovec iov = { &buf, sizeof(buf) };
+        struct msghdr msg = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control.buf,
+            .msg_controllen = sizeof(control.buf),
+        };
+
+        ssize_t len = recvmsg(sock, &msg, 0);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            return len == 0 ? 0 : 1;
+
+        // collect passed file descriptors
+        int fds[SPAWN_SERVER_MAX_FDS];
+        unsigned num_fds = 0;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+             cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+                continue;
+            unsigned n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            if (n > SPAWN_SERVER_MAX_FDS - num_fds)
+                n = SPAWN_SERVER_MAX_FDS - num_fds;
+            memcpy(fds + num_fds, CMSG_DATA(cmsg), n * sizeof(int));
+            num_fds += n;
+        }
+
+        pid_t pid = -1;
+        int err = EMSGSIZE;
+        if (!(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+            err = handle_request(sock, &buf, len, fds, num_fds, &pid);
+
+        // the child has its copy
+        close_fds(fds, num_fds);
+
+        if (send_reply(sock, err, pid) < 0)
+            return 1;
+    }
+}
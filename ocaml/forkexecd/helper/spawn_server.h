@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) Cloud Software Group, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Protocol used by the library to talk to the spawn server.
+//
+// The spawn server is a vfork_helper started with "--server <fd>", where
+// fd is a SOCK_SEQPACKET socket. For every request the server creates a
+// child using CLONE_PARENT, so the new process is a child of the library
+// process which can wait for it as usual. The child then behaves like a
+// vfork_helper executed with the arguments passed in the request.
+//
+// A request is a single message composed by a spawn_request header
+// followed by num_args + num_envs NUL terminated strings. File descriptors
+// used in the arguments are passed with SCM_RIGHTS in the same order as
+// spawn_request.fds, which contains their numbers in the sender.
+// The server replies with a spawn_reply.
+
+// Maximum number of file descriptors in a request, limited by SCM_MAX_FD
+#define SPAWN_SERVER_MAX_FDS 250
+// Maximum size of a request
+#define SPAWN_SERVER_MAX_REQUEST (128 * 1024)
+
+typedef struct {
+    uint32_t num_args;
+    uint32_t num_envs;
+    uint32_t num_fds;
+    int32_t fds[SPAWN_SERVER_MAX_FDS];
+} spawn_request;
+
+typedef struct {
+    // numeric C error, 0 on success
+    int32_t err;
+    int32_t pid;
+} spawn_reply;
+
+// Run the server loop on a socket, returns on disconnection.
+int spawn_server(int sock);
+
+// Execute helper with given arguments, does not return.
+// Defined in vfork_helper.c.
+void run_helper(int argc, char **argv) __attribute__((noreturn));
+
+// Map file descriptor numbers in helper arguments, used by server
+// children. Defined in vfork_helper.c.
+void set_fd_map(const int32_t *from, const int *to, unsigned num);
@@ -18,9 +18,19 @@
 
 #include "syslog.h"
 
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 #include <syslog.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 static inline bool ocaml_isprint(const char c)
 {
@@ -55,47 +65,328 @@ static void syslog_line(const char *line, const char *key, int child_pid)
 	syslog(LOG_DAEMON|LOG_INFO, "%s[%d]: %s", key, child_pid, line);
 }
 
-// Quote and forward every line from "fd" to the syslog.
-// "fd" will be closed.
-bool forward_to_syslog(int fd, const char *key, int child_pid)
+// Maximum length of a quoted line, longer lines are truncated
+#define QUOTED_MAX 64000
+// Size of blocks read from pipes
+#define READ_BLOCK 65536
+
+// State of a stream of lines to forward
+typedef struct {
+	const char *key;
+	int child_pid;
+	// skipping the rest of a truncated line
+	bool overflowed;
+	// length of the quoted partial line in "quoted"
+	size_t len;
+	char quoted[QUOTED_MAX];
+} line_stream;
+
+static void stream_emit(line_stream *s)
 {
-#define syslog_line(line) syslog_line(line, key, child_pid)
-	FILE *f = fdopen(fd, "r");
-	char quoted_buf[64000];
-	char *dest = quoted_buf;
-	char *const dest_end = quoted_buf + sizeof(quoted_buf) - sizeof(" ...") - 1;
-	bool overflowed = false;
-	while (true) {
-		int ch = getc_unlocked(f);
+	s->quoted[s->len] = 0;
+	syslog_line(s->quoted, s->key, s->child_pid);
+}
 
-		if (!overflowed && dest != quoted_buf && (ch == '\n' || ch == EOF)) {
-			*dest = 0;
-			syslog_line(quoted_buf);
-		}
+// Returns pointer to first character which is not copied as is
+// (new line, backslash or not printable) or "end".
+static const char *find_special(const char *p, const char *end)
+{
+#ifdef __SSE2__
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i del = _mm_set1_epi8(0x7f);
+	const __m128i backslash = _mm_set1_epi8('\\');
 
-		if (ch == EOF) {
-			bool res = !!feof(f);
-			fclose(f);
-			return res;
-		}
+	for (; end - p >= 16; p += 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i *) p);
+		// signed compare, bytes >= 0x80 are negative so less than space
+		const __m128i special = _mm_or_si128(_mm_cmplt_epi8(v, space),
+			_mm_or_si128(_mm_cmpeq_epi8(v, del),
+				     _mm_cmpeq_epi8(v, backslash)));
+		const int mask = _mm_movemask_epi8(special);
+		if (mask)
+			return p + __builtin_ctz(mask);
+	}
+#endif
+	for (; p < end; ++p)
+		if (*p == '\\' || !ocaml_isprint(*p))
+			return p;
+	return end;
+}
+
+static void stream_overflow(line_stream *s, char *dest)
+{
+	strcpy(dest, " ...");
+	s->len = dest + strlen(" ...") - s->quoted;
+	stream_emit(s);
+	s->overflowed = true;
+}
+
+// Append a run of printable characters to the partial line.
+static void stream_append_run(line_stream *s, const char *p, size_t len)
+{
+	char *dest = s->quoted + s->len;
+	char *const dest_end = s->quoted + sizeof(s->quoted) - sizeof(" ...") - 1;
 
-		if (ch == '\n') {
-			overflowed = false;
-			dest = quoted_buf;
+	// every character must leave space for the terminator
+	size_t avail = dest_end - dest - 1;
+	if (len > avail) {
+		memcpy(dest, p, avail);
+		stream_overflow(s, dest + avail);
+		return;
+	}
+	memcpy(dest, p, len);
+	s->len += len;
+}
+
+// Append a quoted character to the partial line.
+static void stream_append_quoted(line_stream *s, char c)
+{
+	char *dest = s->quoted + s->len;
+	char *const dest_end = s->quoted + sizeof(s->quoted) - sizeof(" ...") - 1;
+
+	const size_t quoted_len = quoted_length(c);
+	if (dest + quoted_len >= dest_end) {
+		stream_overflow(s, dest);
+		return;
+	}
+	write_quoted(dest, c);
+	s->len += quoted_len;
+}
+
+// Forward the partial line, called at new lines and end of stream.
+static void stream_end_line(line_stream *s)
+{
+	if (!s->overflowed && s->len)
+		stream_emit(s);
+	s->overflowed = false;
+	s->len = 0;
+}
+
+// Forward a block of data. Runs of printable characters are found with
+// a vectorised scan and copied in bulk.
+static void stream_feed(line_stream *s, const char *p, size_t len)
+{
+	const char *const end = p + len;
+
+	while (p < end) {
+		if (s->overflowed) {
+			// skip the rest of the line
+			const char *nl = memchr(p, '\n', end - p);
+			if (!nl)
+				break;
+			stream_end_line(s);
+			p = nl + 1;
 			continue;
 		}
 
-		if (overflowed)
+		const char *special = find_special(p, end);
+		if (special != p) {
+			stream_append_run(s, p, special - p);
+			p = special;
 			continue;
+		}
+
+		if (*p == '\n')
+			stream_end_line(s);
+		else
+			stream_append_quoted(s, *p);
+		++p;
+	}
+}
+
+static line_stream *stream_new(const char *key, int child_pid)
+{
+	line_stream *s = malloc(sizeof(*s));
+	if (s) {
+		s->key = key;
+		s->child_pid = child_pid;
+		s->overflowed = false;
+		s->len = 0;
+	}
+	return s;
+}
+
+// Quote and forward every line from "fd" to the syslog.
+// "fd" will be closed.
+bool forward_to_syslog(int fd, const char *key, int child_pid)
+{
+	static char block[READ_BLOCK];
+	line_stream *s = stream_new(key, child_pid);
+	bool res = false;
 
-		const size_t quoted_len = quoted_length(ch);
-		if (dest + quoted_len >= dest_end) {
-			strcpy(dest, " ...");
-			syslog_line(quoted_buf);
-			overflowed = true;
+	if (!s) {
+		close(fd);
+		return false;
+	}
+
+	while (true) {
+		ssize_t n = read(fd, block, sizeof(block));
+		if (n < 0 && errno == EINTR)
 			continue;
+		if (n <= 0) {
+			res = n == 0;
+			break;
+		}
+		stream_feed(s, block, n);
+	}
+	stream_end_line(s);
+	free(s);
+	close(fd);
+	return res;
+}
+
+bool syslog_forward_send(int sock, int fd, const char *key, int child_pid)
+{
+	syslog_forward_request req = { child_pid };
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+
+	const size_t key_len = strlen(key);
+	if (key_len >= sizeof(req.key))
+		return false;
+	memcpy(req.key, key, key_len + 1);
+
+	struct iovec iov = { &req, offsetof(syslog_forward_request, key) + key_len + 1 };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf),
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	ssize_t res;
+	while ((res = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+		continue;
+	return res >= 0;
+}
+
+// Stream handled by the forwarder
+typedef struct {
+	int fd;
+	line_stream *lines;
+	char key[SYSLOG_KEY_MAX];
+} forwarded;
+
+// Receive a new stream to forward.
+// Returns false if the socket was closed.
+static bool forwarder_accept(int sock, int epfd, unsigned *num_streams)
+{
+	syslog_forward_request req;
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = { &req, sizeof(req) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf),
+	};
+
+	ssize_t len = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	if (len < 0)
+		return errno == EINTR || errno == EAGAIN;
+	if (len == 0)
+		return false;
+
+	int fd = -1;
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+	    && cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	if (fd < 0)
+		return true;
+
+	forwarded *f = malloc(sizeof(*f));
+	if (!f || len <= offsetof(syslog_forward_request, key)
+	    || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+		goto error;
+	size_t key_len = len - offsetof(syslog_forward_request, key);
+	memcpy(f->key, req.key, key_len);
+	f->key[key_len - 1] = 0;
+	f->fd = fd;
+	f->lines = stream_new(f->key, req.pid);
+	if (!f->lines)
+		goto error;
+
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = f };
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		free(f->lines);
+		goto error;
+	}
+	++*num_streams;
+	return true;
+
+error:
+	// the child will get EPIPE writing
+	free(f);
+	close(fd);
+	return true;
+}
+
+// Read available data from a stream.
+// Returns false if the stream ended.
+static bool forwarder_read(forwarded *f)
+{
+	static char block[READ_BLOCK];
+
+	ssize_t n = read(f->fd, block, sizeof(block));
+	if (n < 0)
+		return errno == EINTR || errno == EAGAIN;
+	if (n == 0)
+		return false;
+	stream_feed(f->lines, block, n);
+	return true;
+}
+
+int syslog_forwarder(int sock)
+{
+	struct epoll_event evs[64];
+	unsigned num_streams = 0;
+	bool accepting = true;
+
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+	if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev) < 0)
+		return 1;
+
+	openlog("forkexecd", 0, LOG_DAEMON);
+
+	// Continue while there are streams, the client could have been
+	// restarted while its children are still running.
+	while (accepting || num_streams) {
+		int n = epoll_wait(epfd, evs, 64, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return 1;
+		}
+		for (int i = 0; i < n; ++i) {
+			forwarded *f = evs[i].data.ptr;
+			if (!f) {
+				if (!forwarder_accept(sock, epfd, &num_streams)) {
+					epoll_ctl(epfd, EPOLL_CTL_DEL, sock, NULL);
+					close(sock);
+					accepting = false;
+				}
+				continue;
+			}
+			if (forwarder_read(f))
+				continue;
+			stream_end_line(f->lines);
+			close(f->fd);
+			free(f->lines);
+			free(f);
+			--num_streams;
 		}
-		write_quoted(dest, ch);
-		dest += quoted_len;
 	}
+	return 0;
 }
@@ -15,7 +15,30 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 // Quote and forward every line from "fd" to the syslog.
 // "fd" will be closed.
 bool forward_to_syslog(int fd, const char *key, int child_pid);
+
+// Shared forwarder.
+// Instead of forking a forwarder for every child, a child can pass the
+// reading end of its pipe to a single forwarder process using a
+// SOCK_SEQPACKET socket. The message is a syslog_forward_request, with
+// key truncated after the terminator, and the pipe attached with
+// SCM_RIGHTS.
+
+#define SYSLOG_KEY_MAX 256
+
+typedef struct {
+    int32_t pid;
+    char key[SYSLOG_KEY_MAX];
+} syslog_forward_request;
+
+// Pass "fd" to the shared forwarder listening on "sock".
+// "fd" is not closed. Returns false on failure.
+bool syslog_forward_send(int sock, int fd, const char *key, int child_pid);
+
+// Run the shared forwarder on "sock", returns when the socket is closed
+// and all streams are terminated.
+int syslog_forwarder(int sock);
@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) Cloud Software Group, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+// Benchmark forward_to_syslog against the previous implementation
+// reading a character at a time.
+// syslog is replaced (linking with --wrap=syslog) by a function
+// computing a checksum of the lines, so the output of the two
+// implementations is compared too.
+//
+// Usage: syslog_bench [MB]
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <sys/wait.h>
+
+#include "syslog.h"
+
+static uint64_t checksum, num_lines;
+
+void __wrap_syslog(int priority, const char *format, ...)
+{
+	va_list ap;
+	va_start(ap, format);
+	(void) va_arg(ap, const char *);
+	(void) va_arg(ap, int);
+	const unsigned char *line = va_arg(ap, const unsigned char *);
+	va_end(ap);
+
+	// cheap checksum, to not hide forwarding cost
+	size_t len = strlen((const char *) line);
+	uint64_t h = checksum * 31 + len;
+	for (size_t i = 0; i + 8 <= len; i += 8) {
+		uint64_t w;
+		memcpy(&w, line + i, 8);
+		h += w;
+	}
+	checksum = h;
+	++num_lines;
+}
+
+// Previous implementation
+static inline bool ocaml_isprint(const char c)
+{
+	return c >= ' ' && c < 0x7f;
+}
+
+static inline size_t quoted_length(const char c)
+{
+	return c == '\\' ? 2 :
+		ocaml_isprint(c) ? 1 :
+		4;
+}
+
+static const char hex[] = "0123456789ABCDEF";
+
+static inline void write_quoted(char *const p, const char c)
+{
+	if (c == '\\') {
+		p[0] = p[1] = c;
+	} else if (ocaml_isprint(c)) {
+		p[0] = c;
+	} else {
+		p[0] = '\\';
+		p[1] = 'x';
+		p[2] = hex[(c>>4)&0xf];
+		p[3] = hex[c&0xf];
+	}
+}
+
+static bool forward_to_syslog_old(int fd, const char *key, int child_pid)
+{
+#define syslog_line(line) syslog(LOG_DAEMON|LOG_INFO, "%s[%d]: %s", key, child_pid, line)
+	FILE *f = fdopen(fd, "r");
+	static char quoted_buf[64000];
+	char *dest = quoted_buf;
+	char *const dest_end = quoted_buf + sizeof(quoted_buf) - sizeof(" ...") - 1;
+	bool overflowed = false;
+	while (true) {
+		int ch = getc_unlocked(f);
+
+		if (!overflowed && dest != quoted_buf && (ch == '\n' || ch == EOF)) {
+			*dest = 0;
+			syslog_line(quoted_buf);
+		}
+
+		if (ch == EOF) {
+			bool res = !!feof(f);
+			fclose(f);
+			return res;
+		}
+
+		if (ch == '\n') {
+			overflowed = false;
+			dest = quoted_buf;
+			continue;
+		}
+
+		if (overflowed)
+			continue;
+
+		const size_t quoted_len = quoted_length(ch);
+		if (dest + quoted_len >= dest_end) {
+			strcpy(dest, " ...");
+			syslog_line(quoted_buf);
+			overflowed = true;
+			continue;
+		}
+		write_quoted(dest, ch);
+		dest += quoted_len;
+	}
+#undef syslog_line
+}
+
+// Generate output similar to a verbose script: mostly printable lines
+// with some tabs, backslashes and an occasional very long line.
+static char *generate(size_t size)
+{
+	static const char words[][12] = {
+		"tap-ctl", "vhd-util", "/dev/sm/", "backend", "lvchange", "SR",
+		"uuid=", "\t", "\\", "ERROR", "0x1f", "size",
+	};
+	char *buf = malloc(size);
+	size_t line_len = 0;
+
+	srand(1);
+	for (size_t i = 0; i < size; ) {
+		const char *w = words[rand() % 12];
+		size_t l = strlen(w);
+		if (l > size - i)
+			l = size - i;
+		memcpy(buf + i, w, l);
+		i += l;
+		line_len += l;
+		if (i < size && line_len > 60 + rand() % 60 && rand() % 1000) {
+			buf[i++] = '\n';
+			line_len = 0;
+		} else if (i < size) {
+			buf[i++] = ' ';
+		}
+	}
+	return buf;
+}
+
+static double run(bool (*forward)(int, const char *, int),
+		  const char *data, size_t size)
+{
+	struct timespec start, end;
+	int fds[2];
+
+	if (pipe(fds) < 0)
+		exit(1);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		for (size_t i = 0; i < size; ) {
+			ssize_t n = write(fds[1], data + i, size - i);
+			if (n <= 0)
+				_exit(1);
+			i += n;
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+
+	checksum = num_lines = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	forward(fds[0], "bench", 1234);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	waitpid(pid, NULL, 0);
+
+	return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+	size_t mb = argc > 1 ? strtoul(argv[1], NULL, 0) : 64;
+	size_t size = mb * 1024 * 1024;
+	char *data = generate(size);
+
+	double t_old = run(forward_to_syslog_old, data, size);
+	uint64_t sum_old = checksum, lines_old = num_lines;
+	double t_new = run(forward_to_syslog, data, size);
+
+	printf("%zu MB, %llu lines\n", mb, (unsigned long long) num_lines);
+	printf("old: %8.3f s %8.1f MB/s\n", t_old, mb / t_old);
+	printf("new: %8.3f s %8.1f MB/s\n", t_new, mb / t_new);
+	if (sum_old != checksum || lines_old != num_lines) {
+		printf("output differs!\n");
+		return 1;
+	}
+	return 0;
+}
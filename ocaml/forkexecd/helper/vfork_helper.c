@@ -22,6 +22,7 @@
 #include <math.h>
 #include <pthread.h>
 #include <limits.h>
+#include <time.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <syslog.h>
@@ -33,6 +34,8 @@
 #include "syslog.h"
 #include "logs.h"
 #include "vfork_helper.h"
+#include "spawn_server.h"
+#include "resource_class.h"
 
 #define log(...) do {} while(0)
 #include "redirect_algo.h"
@@ -54,8 +57,69 @@ static void error(int err, const char *msg, ...);
 static void init_syslog(const char *key, bool redirect_stderr_to_stdout);
 
 static int error_fd = -1;
+// socket of shared syslog forwarder, see syslog.h
+static int syslog_fd = -1;
+// already created in the right cgroup, see clear_cgroup
+static bool cgroup_cleared = false;
+
+// Phase timestamps, always taken as cheap, sent only if requested
+static spawn_timings timings = { SPAWN_TIMINGS_MAGIC, SPAWN_PHASE_COUNT };
+
+static inline void
+phase_done(spawn_phase phase)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    timings.ns[phase] = (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// File descriptor numbers mapping, see set_fd_map
+static const int32_t *fd_map_from;
+static const int *fd_map_to;
+static unsigned fd_map_len;
 
 int main(int argc, char **argv)
+{
+    // created by the library directly in the root cgroup
+    if (argc > 1 && strcmp(argv[1], "-G") == 0) {
+        cgroup_cleared = true;
+        argv[1] = argv[0];
+        --argc;
+        ++argv;
+    }
+
+    // persistent spawn server, see spawn_server.h
+    if (argc == 3 && strcmp(argv[1], "--server") == 0) {
+        argc -= 2;
+        argv += 2;
+        return spawn_server(get_fd(&argc, &argv));
+    }
+
+    // shared syslog forwarder, see syslog.h
+    if (argc == 3 && strcmp(argv[1], "--syslog") == 0) {
+        argc -= 2;
+        argv += 2;
+        int sock = keep_only_fd(get_fd(&argc, &argv));
+        if (sock < 0)
+            return 1;
+        // do not get killed with the client, its children can survive it
+        clear_cgroup();
+        return syslog_forwarder(sock);
+    }
+
+    run_helper(argc, argv);
+}
+
+void
+set_fd_map(const int32_t *from, const int *to, unsigned num)
+{
+    fd_map_from = from;
+    fd_map_to = to;
+    fd_map_len = num;
+}
+
+void
+run_helper(int argc, char **argv)
 {
     unsigned num_mappings = 3;
     bool redirect_stderr_to_stdout = false;
@@ -64,6 +128,10 @@ int main(int argc, char **argv)
     mapping mappings_buf[MAX_TOTAL_MAPPINGS];
     exec_info info[1] = { NULL, };
     const char *directory = "/";
+    const resource_class *rc = NULL;
+    bool send_timings = false;
+
+    phase_done(SPAWN_PHASE_START);
 
     mapped_logs logs = mapped_logs_open();
 #undef log
@@ -136,9 +204,22 @@ int main(int argc, char **argv)
         case 'S': // syslog stderr to stdout
             redirect_stderr_to_stdout = true;
             break;
+        case 't': // send phase timings
+            send_timings = true;
+            break;
         case 'd':
             directory = get_arg(&argc, &argv);
             break;
+        case 'c': { // resource class
+                const char *name = get_arg(&argc, &argv);
+                rc = resource_class_find(name);
+                if (!rc) {
+                    log_fail("invalid resource class");
+                    mapped_logs_close(logs);
+                    error(EINVAL, "Invalid resource class %s", name);
+                }
+            }
+            break;
         case 'e': { // error file descriptor
                 error_fd = get_fd(&argc, &argv);
                 if (num_mappings >= MAX_TOTAL_MAPPINGS) {
@@ -152,6 +233,19 @@ int main(int argc, char **argv)
                 m->wanted_fd = -1;
             }
             break;
+        case 'L': { // shared syslog forwarder socket
+                syslog_fd = get_fd(&argc, &argv);
+                if (num_mappings >= MAX_TOTAL_MAPPINGS) {
+                    log_fail("too many mappings");
+                    mapped_logs_close(logs);
+                    error(EINVAL, "Too many mappings");
+                }
+                mapping* const m = &info->mappings[num_mappings++];
+                m->uuid = NULL;
+                m->current_fd = syslog_fd;
+                m->wanted_fd = -1;
+            }
+            break;
         default:
             log_fail("invalid option %s", arg);
             mapped_logs_close(logs);
@@ -176,10 +270,14 @@ int main(int argc, char **argv)
 
     sigset_t sigset;
 
+    phase_done(SPAWN_PHASE_ARGS);
+
     // Compute the file operations we need to do for the file mappings
     int num_operations =
         redirect_mappings(info->mappings, num_mappings, info->operations);
 
+    phase_done(SPAWN_PHASE_REDIRECT);
+
     if (FORKEXECD_DEBUG_LOGS) {
         for (size_t n = 0; info->args[n]; ++n)
             log("arg %zd %s", n, info->args[n]);
@@ -203,10 +301,17 @@ int main(int argc, char **argv)
         error(err, "chdir");
     }
 
+    phase_done(SPAWN_PHASE_CHDIR);
+
     // Clear cgroup otherwise systemd will shutdown processes if
     // toolstack is restarted.
     clear_cgroup();
 
+    if (rc && !resource_class_apply(rc))
+        log("resource class not applied");
+
+    phase_done(SPAWN_PHASE_CGROUP);
+
     if (setsid() < 0) {
         int err = errno;
         log_fail("setsid %d", errno);
@@ -214,6 +319,8 @@ int main(int argc, char **argv)
         error(err, "setsid");
     }
 
+    phase_done(SPAWN_PHASE_SETSID);
+
     // Redirect file descriptors.
     int err = 0;
     const char *err_func = NULL;
@@ -236,6 +343,8 @@ int main(int argc, char **argv)
                 // replaced later.
                 if (op->fd_from == error_fd)
                     error_fd = op->fd_to;
+                if (op->fd_from == syslog_fd)
+                    syslog_fd = op->fd_to;
             }
             break;
         case FD_OP_MOVE:
@@ -244,6 +353,8 @@ int main(int argc, char **argv)
                 err = errno;
             if (op->fd_from == error_fd)
                 error_fd = op->fd_to;
+            if (op->fd_from == syslog_fd)
+                syslog_fd = op->fd_to;
             close(op->fd_from);
             break;
         case FD_OP_DEVNULL:
@@ -271,8 +382,14 @@ int main(int argc, char **argv)
         error(err, "%s", err_func);
     }
 
+    phase_done(SPAWN_PHASE_FD_OPS);
+
     if (key)
         init_syslog(key, redirect_stderr_to_stdout);
+    if (syslog_fd >= 0)
+        close(syslog_fd);
+
+    phase_done(SPAWN_PHASE_SYSLOG);
 
     // Limit number of files limits to standard limit to avoid
     // creating bugs with old programs.
@@ -287,8 +404,14 @@ int main(int argc, char **argv)
 
     log("execv...");
     mapped_logs_success(logs);
-    if (error_fd >= 0)
+    phase_done(SPAWN_PHASE_EXEC);
+    if (error_fd >= 0) {
+        // written atomically like errors, the library reads it
+        // before waiting for the pipe to be closed
+        if (send_timings && write(error_fd, &timings, sizeof(timings)) < 0)
+            log("failed to send timings");
         close(error_fd);
+    }
     execv(info->args[0], info->args);
     log_fail("execve failed %d", errno);
     // Here we could set err and err_func but we kept compatibility
@@ -335,6 +458,11 @@ reset_signal_handlers(void)
 static void
 clear_cgroup(void)
 {
+    // The library can create the process directly in the root cgroup
+    // using clone3, processes forked by the spawn server inherit it.
+    if (cgroup_cleared)
+        return;
+
     // list of files to try, terminated by NULL
     static const char *const cgroup_files[] = {
         "/sys/fs/cgroup/systemd/cgroup.procs",
@@ -399,6 +527,14 @@ get_fd(int *argc, char ***argv)
     unsigned long fd = strtoul(arg, NULL, 0);
     if (fd < 0 || fd > INT_MAX)
         error(EINVAL, "Expected valid file descriptor number");
+
+    // translate numbers from the spawn server client
+    if (fd_map_from) {
+        for (unsigned i = 0; i < fd_map_len; ++i)
+            if (fd_map_from[i] == (int32_t) fd)
+                return fd_map_to[i];
+        error(EBADF, "File descriptor %lu not passed", fd);
+    }
     return (int) fd;
 }
 
@@ -431,6 +567,12 @@ init_syslog(const char *key, bool redirect_stderr_to_stdout)
 
     const int child_pid = (int) getpid();
 
+    // try to use the shared forwarder, fork a new one otherwise
+    if (syslog_fd >= 0 && syslog_forward_send(syslog_fd, fds[0], key, child_pid)) {
+        close(fds[0]);
+        return;
+    }
+
     pid_t pid = fork();
     if (pid < 0)
         error(errno, "fork");
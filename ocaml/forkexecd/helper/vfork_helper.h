@@ -14,6 +14,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 // Common structure to pass errors from helper to library
 typedef struct {
     // numeric C error
@@ -21,3 +23,30 @@ typedef struct {
     // message
     char msg_buf[1000];
 } msg_t;
+
+// Phases of the helper, a timestamp is taken at the end of each one.
+typedef enum {
+    SPAWN_PHASE_START,
+    SPAWN_PHASE_ARGS,
+    SPAWN_PHASE_REDIRECT,
+    // includes signal handlers reset
+    SPAWN_PHASE_CHDIR,
+    // includes resource class
+    SPAWN_PHASE_CGROUP,
+    SPAWN_PHASE_SETSID,
+    SPAWN_PHASE_FD_OPS,
+    SPAWN_PHASE_SYSLOG,
+    SPAWN_PHASE_EXEC,
+    SPAWN_PHASE_COUNT
+} spawn_phase;
+
+// Not a valid error number, distinguishes from msg_t
+#define SPAWN_TIMINGS_MAGIC 0x54494d45u
+
+// Sent by the helper on the error pipe just before executing the command
+// if "-t" option is passed. Timestamps are CLOCK_MONOTONIC nanoseconds.
+typedef struct {
+    uint32_t magic;
+    uint32_t num_phases;
+    uint64_t ns[SPAWN_PHASE_COUNT];
+} spawn_timings;
@@ -18,9 +18,23 @@
 #include <math.h>
 #include <pthread.h>
 #include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
+#include <linux/magic.h>
+#include <linux/sched.h>
 
 #include <caml/mlvalues.h>
+#include <caml/alloc.h>
+#include <caml/callback.h>
 #include <caml/threads.h>
 #include <caml/fail.h>
 #include <caml/memory.h>
@@ -28,10 +42,93 @@
 #include <caml/signals.h>
 
 #include "../helper/vfork_helper.h"
+#include "../helper/spawn_server.h"
 
 #define FOREACH_LIST(name, list) \
     for(value name = (list); name != Val_emptylist; name = Field(name, 1))
 
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+#ifndef SYS_clone3
+#define SYS_clone3 435
+#endif
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+static inline int
+pidfd_open(pid_t pid, unsigned int flags)
+{
+    return syscall(SYS_pidfd_open, pid, flags);
+}
+
+static inline int
+pidfd_send_signal(int pidfd, int sig)
+{
+    return syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+}
+
+/*
+ * Pidfds returned by clone3 (see clone3_exec), kept so pid waiters
+ * do not have to open them again.
+ * Entries are overwritten in round robin, nobody has to remove them.
+ * A pidfd is returned only if it still refers to a child not reaped,
+ * so pid reuse and fork are detected.
+ */
+#define SPAWNED_PIDFDS 32
+
+static struct {
+    pthread_mutex_t mtx;
+    unsigned next;
+    struct {
+        pid_t pid;
+        int pidfd;
+    } entries[SPAWNED_PIDFDS];
+} spawned_pidfds = {
+    .mtx = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void
+spawned_pidfd_put(pid_t pid, int pidfd)
+{
+    pthread_mutex_lock(&spawned_pidfds.mtx);
+    unsigned n = spawned_pidfds.next++ % SPAWNED_PIDFDS;
+    if (spawned_pidfds.entries[n].pid > 0)
+        close(spawned_pidfds.entries[n].pidfd);
+    spawned_pidfds.entries[n].pid = pid;
+    spawned_pidfds.entries[n].pidfd = pidfd;
+    pthread_mutex_unlock(&spawned_pidfds.mtx);
+}
+
+// Get a pidfd for a child process, from the spawned ones or opening it.
+static int
+get_pidfd(pid_t pid)
+{
+    int pidfd = -1;
+
+    pthread_mutex_lock(&spawned_pidfds.mtx);
+    for (unsigned n = 0; n < SPAWNED_PIDFDS; ++n) {
+        if (spawned_pidfds.entries[n].pid == pid) {
+            pidfd = spawned_pidfds.entries[n].pidfd;
+            spawned_pidfds.entries[n].pid = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&spawned_pidfds.mtx);
+
+    if (pidfd >= 0) {
+        siginfo_t info;
+        if (waitid(P_PIDFD, pidfd, &info, WEXITED|WNOHANG|WNOWAIT) == 0)
+            return pidfd;
+        close(pidfd);
+    }
+    return pidfd_open(pid, 0);
+}
+
 // Create thread reducing stack usage to a minimum to reduce memory usage.
 // Returns error number (like pthread_create).
 static int create_thread_minstack(pthread_t *th, void *(*proc)(void *), void *arg);
@@ -107,32 +204,213 @@ typedef struct {
     const char *err_msg;
     pid_t pid;
     msg_t msg;
+    // phase timings sent by the helper, see spawn_timings
+    bool has_timings;
+    uint64_t start_ns, end_ns;
+    spawn_timings timings;
 } safe_exec_result;
 
+static inline uint64_t
+monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/*
+ * Spawn using clone3 with CLONE_INTO_CGROUP.
+ * The child is created directly in the root cgroup so the helper does
+ * not have to move itself out of the toolstack cgroup (see clear_cgroup
+ * in vfork_helper.c), "-G" option tells it.
+ * Only a cgroup v2 root is supported; on hybrid setups systemd uses a v1
+ * hierarchy and the helper has to move itself anyway.
+ * Like vfork the child shares the memory and runs on a separate stack,
+ * this requires some assembly so it's implemented only for x86_64.
+ */
+#ifndef CGROUP2_ROOT
+#define CGROUP2_ROOT "/sys/fs/cgroup"
+#endif
+
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
+#define FE_CLONE_INTO_CGROUP 0x200000000ULL
+
+typedef struct {
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t child_tid;
+    uint64_t parent_tid;
+    uint64_t exit_signal;
+    uint64_t stack;
+    uint64_t stack_size;
+    uint64_t tls;
+    uint64_t set_tid;
+    uint64_t set_tid_size;
+    uint64_t cgroup;
+} fe_clone_args;
+
+typedef struct {
+    char **args;
+    char **envs;
+    int close_child;
+    int inherit_child;
+} exec_child;
+
+// -1 not supported, -2 not checked yet
+static int root_cgroup = -2;
+
+// Returns file descriptor of the root cgroup or -1 if not usable.
 static int
-safe_exec_with_helper(safe_exec_result *res, char **args, char **envs)
+root_cgroup_fd(void)
 {
-    int err = EINVAL;
-    char fd_string[48];
-    int pipe_fds[2] = { -1, -1 };
+    int fd = __atomic_load_n(&root_cgroup, __ATOMIC_ACQUIRE);
+    if (fd != -2)
+        return fd;
 
-    res->err_msg = "safe_exec";
+    struct statfs st;
+    fd = open(CGROUP2_ROOT, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (fd >= 0 && (fstatfs(fd, &st) < 0 || st.f_type != CGROUP2_SUPER_MAGIC)) {
+        close(fd);
+        fd = -1;
+    }
 
-    if (!args[0] || !args[1] || !args[2])
-        return EINVAL;
+    int expected = -2;
+    if (!__atomic_compare_exchange_n(&root_cgroup, &expected, fd, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        // another thread was faster
+        if (fd >= 0)
+            close(fd);
+        fd = expected;
+    }
+    return fd;
+}
 
-    if (strcmp(args[1], "-e") == 0) {
-        if (pipe(pipe_fds) < 0) {
-            res->err_msg = "pipe";
-            return errno;
-        }
-        sprintf(fd_string, "%d", pipe_fds[1]);
-        args[2] = fd_string;
+static void __attribute__((noreturn))
+exec_child_proc(void *arg)
+{
+    const exec_child *child = arg;
+
+    if (child->close_child >= 0)
+        close(child->close_child);
+    if (child->inherit_child >= 0)
+        fcntl(child->inherit_child, F_SETFD, 0);
+    execve(child->args[0], child->args, child->envs);
+    // keep compatibility with forkexecd daemon.
+    _exit(errno == ENOENT ? 127 : 126);
+}
+
+#if defined(__x86_64__)
+// Call clone3 executing "fn" in the child.
+// Returns like clone3 syscall, negative error number on failure.
+static long
+clone3_call(fe_clone_args *cl_args, void (*fn)(void *), void *arg)
+{
+    long res;
+
+    // The child starts on the new stack, it cannot return from
+    // a function, call "fn" directly.
+    __asm__ __volatile__(
+        "syscall\n\t"
+        "test %%rax, %%rax\n\t"
+        "jnz 1f\n\t"
+        "xor %%ebp, %%ebp\n\t"
+        "mov %[arg], %%rdi\n\t"
+        "call *%[fn]\n\t"
+        "ud2\n"
+        "1:"
+        : "=a" (res)
+        : "0" ((long) SYS_clone3), "D" (cl_args), "S" (sizeof(*cl_args)),
+          [fn] "r" (fn), [arg] "r" (arg)
+        : "rcx", "r11", "memory");
+    return res;
+}
+#else
+static long
+clone3_call(fe_clone_args *cl_args, void (*fn)(void *), void *arg)
+{
+    return -ENOSYS;
+}
+#endif
+
+// Execute the helper using clone3.
+// Signals must be blocked.
+// Returns error number, 0 on success or -1 if clone3 cannot be used.
+static int
+clone3_exec(pid_t *pid, int *pidfd, char **args, char **envs,
+            int close_child, int inherit_child)
+{
+    static bool clone3_supported = true;
+    // enough for the few calls done by the child, aligned as required
+    // by the ABI, the parent is suspended while the child uses it
+    char stack[16384] __attribute__((aligned(16)));
+
+    if (!__atomic_load_n(&clone3_supported, __ATOMIC_RELAXED))
+        return -1;
+
+    int cgroup = root_cgroup_fd();
+    if (cgroup < 0)
+        return -1;
+
+    // insert "-G" option
+    size_t num_args = 0;
+    while (args[num_args])
+        ++num_args;
+    char **new_args = malloc(sizeof(char *) * (num_args + 2));
+    if (!new_args)
+        return ENOMEM;
+    new_args[0] = args[0];
+    new_args[1] = "-G";
+    memcpy(new_args + 2, args + 1, sizeof(char *) * num_args);
+
+    exec_child child = { new_args, envs, close_child, inherit_child };
+    int new_pidfd = -1;
+    fe_clone_args cl_args = {
+        .flags = CLONE_VM | CLONE_VFORK | CLONE_PIDFD | FE_CLONE_INTO_CGROUP,
+        .pidfd = (uintptr_t) &new_pidfd,
+        .exit_signal = SIGCHLD,
+        .stack = (uintptr_t) stack,
+        .stack_size = sizeof(stack),
+        .cgroup = cgroup,
+    };
+    long res = clone3_call(&cl_args, exec_child_proc, &child);
+    free(new_args);
+
+    if (res < 0) {
+        // Old kernel or cgroup not usable (not root or not allowed
+        // by the controllers), do not try again
+        if (res == -ENOSYS || res == -EINVAL || res == -E2BIG
+            || res == -EPERM || res == -EACCES || res == -EBUSY
+            || res == -EOPNOTSUPP)
+            __atomic_store_n(&clone3_supported, false, __ATOMIC_RELAXED);
+        return -1;
     }
 
+    *pid = res;
+    if (pidfd)
+        *pidfd = new_pidfd;
+    else
+        close(new_pidfd);
+    return 0;
+}
+
+// Execute a program using clone3 if possible (see clone3_exec), vfork
+// otherwise.
+// "close_child" and "inherit_child" are file descriptors to respectively
+// close and make inheritable in the child, or -1.
+// If "pidfd" is not NULL it receives a pidfd for the child or -1.
+// Returns error number or 0.
+static int
+vfork_exec(pid_t *pid, int *pidfd, char **args, char **envs,
+           int close_child, int inherit_child)
+{
     sigset_t sigset, old_sigset;
     int cancellation_state;
 
+    if (pidfd)
+        *pidfd = -1;
+
     // Disable cancellation to avoid some signals.
     // Glibc use some signals to handle thread cancellation.
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancellation_state);
@@ -143,31 +421,366 @@ safe_exec_with_helper(safe_exec_result *res, char **args, char **envs)
     sigfillset(&sigset);
     pthread_sigmask(SIG_BLOCK, &sigset, &old_sigset);
 
-    // fork
-    err = 0;
-    res->pid = vfork();
-    if (res->pid < 0) {
-        err = errno;
-    } else if (res->pid == 0) {
-        // child
-        if (pipe_fds[0] >= 0)
-            close(pipe_fds[0]);
-        execve(args[0], args, envs);
-        // keep compatibility with forkexecd daemon.
-        _exit(errno == ENOENT ? 127 : 126);
+    int err = clone3_exec(pid, pidfd, args, envs, close_child, inherit_child);
+    if (err < 0) {
+        // fork
+        err = 0;
+        *pid = vfork();
+        if (*pid < 0) {
+            err = errno;
+        } else if (*pid == 0) {
+            // child
+            exec_child child = { args, envs, close_child, inherit_child };
+            exec_child_proc(&child);
+        }
     }
 
     // Restore thread state
     pthread_sigmask(SIG_SETMASK, &old_sigset, NULL);
     pthread_setcancelstate(cancellation_state, NULL);
 
+    return err;
+}
+
+/*
+ * Long-lived processes started from the helper: the spawn server (see
+ * spawn_server.h) and the shared syslog forwarder (see syslog.h).
+ * They are started on first use and talk on a SOCK_SEQPACKET socket.
+ */
+typedef struct {
+    pthread_mutex_t mtx;
+    // helper option selecting the server
+    const char *option;
+    // helper path, NULL if server is disabled
+    char *helper;
+    int sock;
+    pid_t pid;
+} helper_server;
+
+// Spawn server, requests are serialised, the server handles them one
+// at a time.
+static helper_server spawn_srv = {
+    .mtx = PTHREAD_MUTEX_INITIALIZER,
+    .option = "--server",
+    .sock = -1,
+    .pid = -1,
+};
+
+// Syslog forwarder, the socket is passed to helpers.
+static helper_server syslog_srv = {
+    .mtx = PTHREAD_MUTEX_INITIALIZER,
+    .option = "--syslog",
+    .sock = -1,
+    .pid = -1,
+};
+
+static void
+helper_server_stop(helper_server *srv)
+{
+    close_fd(&srv->sock);
+    if (srv->pid > 0)
+        reap_pid(srv->pid);
+    srv->pid = -1;
+}
+
+// Start the server, must be called with the lock held.
+// Returns false on failure.
+static bool
+helper_server_start(helper_server *srv)
+{
+    int fds[2];
+    char fd_string[48];
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, fds) < 0)
+        return false;
+
+    sprintf(fd_string, "%d", fds[1]);
+    char *args[] = { srv->helper, (char *) srv->option, fd_string, NULL };
+    char *envs[] = { NULL };
+    int err = vfork_exec(&srv->pid, NULL, args, envs, -1, fds[1]);
+    close(fds[1]);
+    if (err != 0) {
+        close(fds[0]);
+        srv->pid = -1;
+        return false;
+    }
+    srv->sock = fds[0];
+    return true;
+}
+
+static void
+helper_servers_atfork_child(void)
+{
+    // the servers are not children of the new process
+    helper_server *const servers[] = { &spawn_srv, &syslog_srv };
+    for (int i = 0; i < 2; ++i) {
+        pthread_mutex_init(&servers[i]->mtx, NULL);
+        close_fd(&servers[i]->sock);
+        servers[i]->pid = -1;
+    }
+}
+
+static bool
+helper_servers_register_atfork(void)
+{
+    static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+    static bool registered = false;
+
+    pthread_mutex_lock(&mtx);
+    if (!registered)
+        registered = pthread_atfork(NULL, NULL, helper_servers_atfork_child) == 0;
+    pthread_mutex_unlock(&mtx);
+    return registered;
+}
+
+// Set helper path, must be called with the lock held.
+static void
+helper_server_set_path(helper_server *srv, char *path)
+{
+    // restart server if path changed
+    if (srv->helper && strcmp(srv->helper, path) != 0)
+        helper_server_stop(srv);
+    free(srv->helper);
+    __atomic_store_n(&srv->helper, path, __ATOMIC_RELEASE);
+}
+
+// Returns the number of arguments of a helper option.
+static int
+option_args(const char *opt)
+{
+    if (opt[0] != '-' || opt[1] == 0 || opt[2] != 0)
+        return 0;
+    switch (opt[1]) {
+    case 'I': case 'O': case 'E': case 'e': case 'L': case 's': case 'd': case 'c':
+        return 1;
+    case 'm':
+        return 2;
+    }
+    return 0;
+}
+
+// Returns the file descriptor passed to the helper with option "-<opt>",
+// or -1.
+static int
+option_fd(char **args, char opt)
+{
+    for (char **p = args + 1; *p && strcmp(*p, "--") != 0; ) {
+        int n = option_args(*p);
+        for (int i = 0; i < n; ++i)
+            if (!p[i + 1])
+                return -1;
+        if (n > 0 && (*p)[1] == opt)
+            return atoi(p[n]);
+        p += 1 + n;
+    }
+    return -1;
+}
+
+// Serialise a request for the spawn server.
+// Returns allocated buffer or NULL if the request cannot be handled.
+static char *
+spawn_request_build(char **args, char **envs, size_t *p_len)
+{
+    spawn_request req = { 0, };
+    size_t len = sizeof(req);
+    char **p;
+
+    // collect file descriptors passed in helper options
+    for (p = args + 1; *p && strcmp(*p, "--") != 0; ) {
+        int n = option_args(*p);
+        for (int i = 0; i < n; ++i)
+            if (!p[i + 1])
+                return NULL;
+        if (n > 0 && strchr("IOEemL", (*p)[1])) {
+            if (req.num_fds >= SPAWN_SERVER_MAX_FDS)
+                return NULL;
+            req.fds[req.num_fds++] = atoi(p[n]);
+        }
+        p += 1 + n;
+    }
+
+    for (p = args; *p; ++p, ++req.num_args)
+        len += strlen(*p) + 1;
+    for (p = envs; *p; ++p, ++req.num_envs)
+        len += strlen(*p) + 1;
+    if (len > SPAWN_SERVER_MAX_REQUEST)
+        return NULL;
+
+    char *buf = malloc(len);
+    if (!buf)
+        return NULL;
+    memcpy(buf, &req, sizeof(req));
+    char *dest = buf + sizeof(req);
+    for (p = args; *p; ++p)
+        append_string(&dest, *p);
+    for (p = envs; *p; ++p)
+        append_string(&dest, *p);
+    *p_len = len;
+    return buf;
+}
+
+// Execute helper using the spawn server.
+// Returns error number, 0 on success or -1 if the server cannot be used.
+static int
+spawn_server_exec(pid_t *pid, char **args, char **envs)
+{
+    int err = -1;
+    size_t len;
+    char *buf;
+
+    if (!__atomic_load_n(&spawn_srv.helper, __ATOMIC_ACQUIRE))
+        return -1;
+
+    buf = spawn_request_build(args, envs, &len);
+    if (!buf)
+        return -1;
+
+    const spawn_request *req = (const spawn_request *) buf;
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * SPAWN_SERVER_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { buf, len };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+    };
+    if (req->num_fds) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * req->num_fds);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * req->num_fds);
+        memcpy(CMSG_DATA(cmsg), req->fds, sizeof(int) * req->num_fds);
+    }
+
+    pthread_mutex_lock(&spawn_srv.mtx);
+    if (spawn_srv.sock < 0 && !helper_server_start(&spawn_srv))
+        goto out;
+
+    ssize_t res;
+    while ((res = sendmsg(spawn_srv.sock, &msg, MSG_NOSIGNAL)) < 0
+           && errno == EINTR)
+        continue;
+    if (res < 0) {
+        // server died, restart it next time and fall back to vfork
+        helper_server_stop(&spawn_srv);
+        goto out;
+    }
+
+    spawn_reply reply;
+    while ((res = recv(spawn_srv.sock, &reply, sizeof(reply), 0)) < 0
+           && errno == EINTR)
+        continue;
+    if (res != sizeof(reply)) {
+        // The request could have been executed, do not fall back.
+        helper_server_stop(&spawn_srv);
+        err = EPIPE;
+        goto out;
+    }
+    err = reply.err;
+    *pid = reply.pid;
+
+out:
+    pthread_mutex_unlock(&spawn_srv.mtx);
+    free(buf);
+    return err;
+}
+
+CAMLprim value
+caml_spawn_server_enable(value helper)
+{
+    CAMLparam1(helper);
+
+    char *path = strdup(String_val(helper));
+    if (!path || !helper_servers_register_atfork()) {
+        free(path);
+        caml_raise_out_of_memory();
+    }
+
+    pthread_mutex_lock(&spawn_srv.mtx);
+    helper_server_set_path(&spawn_srv, path);
+    pthread_mutex_unlock(&spawn_srv.mtx);
+
+    CAMLreturn(Val_unit);
+}
+
+CAMLprim value
+caml_syslog_forwarder_fd(value helper)
+{
+    CAMLparam1(helper);
+    int fd = -1;
+
+    char *path = strdup(String_val(helper));
+    if (!path || !helper_servers_register_atfork()) {
+        free(path);
+        caml_raise_out_of_memory();
+    }
+
+    pthread_mutex_lock(&syslog_srv.mtx);
+    if (syslog_srv.helper && strcmp(syslog_srv.helper, path) == 0)
+        free(path);
+    else
+        helper_server_set_path(&syslog_srv, path);
+
+    // restart forwarder if it died
+    if (syslog_srv.pid > 0 && waitpid(syslog_srv.pid, NULL, WNOHANG) != 0) {
+        syslog_srv.pid = -1;
+        helper_server_stop(&syslog_srv);
+    }
+
+    // The socket keeps close-on-exec, it is made inheritable only in
+    // the helpers it is passed to, see safe_exec_with_helper.
+    if (syslog_srv.sock >= 0 || helper_server_start(&syslog_srv))
+        fd = syslog_srv.sock;
+    pthread_mutex_unlock(&syslog_srv.mtx);
+
+    CAMLreturn(Val_int(fd));
+}
+
+static int
+safe_exec_with_helper(safe_exec_result *res, char **args, char **envs)
+{
+    int err = EINVAL;
+    char fd_string[48];
+    int pipe_fds[2] = { -1, -1 };
+    int pidfd = -1;
+
+    res->err_msg = "safe_exec";
+    res->has_timings = false;
+    res->start_ns = monotonic_ns();
+
+    if (!args[0] || !args[1] || !args[2])
+        return EINVAL;
+
+    if (strcmp(args[1], "-e") == 0) {
+        if (pipe(pipe_fds) < 0) {
+            res->err_msg = "pipe";
+            return errno;
+        }
+        sprintf(fd_string, "%d", pipe_fds[1]);
+        args[2] = fd_string;
+    }
+
+    err = spawn_server_exec(&res->pid, args, envs);
+    if (err > 0)
+        res->err_msg = "spawn_server";
+    if (err < 0) {
+        // the spawn server receives the syslog forwarder socket with the
+        // request, the helper must inherit it
+        err = vfork_exec(&res->pid, &pidfd, args, envs, pipe_fds[0],
+                         option_fd(args, 'L'));
+        if (err != 0)
+            res->err_msg = "vfork";
+    }
+
     // We don't need writing pipe anymore and we need to detect
     // if closed so we can't keep it open
     close_fd(&pipe_fds[1]);
 
     if (err != 0) {
         close_fd(&pipe_fds[0]);
-        res->err_msg = "vfork";
         return err;
     }
 
@@ -176,9 +789,20 @@ safe_exec_with_helper(safe_exec_result *res, char **args, char **envs)
         int readed;
         // Note that buffer is small and written atomically by
         // the helper, no reason for the kernel to split it.
-        while ((readed = read(pipe_fds[0], &res->msg, sizeof(res->msg))) < 0
-               && errno == EINTR)
-            continue;
+        for (;;) {
+            while ((readed = read(pipe_fds[0], &res->msg, sizeof(res->msg))) < 0
+                   && errno == EINTR)
+                continue;
+            // timings are sent just before executing the command
+            if (readed == sizeof(spawn_timings) && !res->has_timings
+                && res->msg.err == (int) SPAWN_TIMINGS_MAGIC) {
+                memcpy(&res->timings, &res->msg, sizeof(spawn_timings));
+                res->has_timings = true;
+                continue;
+            }
+            break;
+        }
+        res->end_ns = monotonic_ns();
         close_fd(&pipe_fds[0]);
         if (readed != 0 && readed < offsetof(msg_t, msg_buf) + 1) {
             // This should never happen !!!
@@ -186,25 +810,30 @@ safe_exec_with_helper(safe_exec_result *res, char **args, char **envs)
             // we cannot just return an error.
             // We could try to wait the process but it should fail, let
             // returns success and let caller read process status result.
-            return 0;
+            goto success;
         }
         res->msg.msg_buf[sizeof(res->msg.msg_buf) - 1] = 0;
         if (readed > 0) {
             // Wait the process otherwise we'll have a zombie
+            if (pidfd >= 0)
+                close(pidfd);
             reap_pid(res->pid);
 
             res->err_msg = res->msg.msg_buf;
             return res->msg.err;
         }
     }
+
+success:
+    // keep pidfd for the pid waiters
+    if (pidfd >= 0)
+        spawned_pidfd_put(res->pid, pidfd);
     return 0;
 }
 
-CAMLprim value
-caml_safe_exec_with_helper(value args, value environment)
+static void
+safe_exec_with_helper_caml(value args, value environment, safe_exec_result *res)
 {
-    CAMLparam2(args, environment);
-
     // Copy parameters to C
     char **c_args = copy_string_list(args);
     char **c_envs = copy_string_list(environment);
@@ -217,8 +846,7 @@ caml_safe_exec_with_helper(value args, value environment)
     // potentially slow section, release Ocaml engine
     caml_release_runtime_system();
 
-    safe_exec_result res;
-    int err = safe_exec_with_helper(&res, c_args, c_envs);
+    int err = safe_exec_with_helper(res, c_args, c_envs);
 
     free(c_envs);
     free(c_args);
@@ -227,25 +855,439 @@ caml_safe_exec_with_helper(value args, value environment)
 
     // error, notify with an exception
     if (err != 0)
-        unix_error(err, res.err_msg, Nothing);
+        unix_error(err, res->err_msg, Nothing);
+}
+
+CAMLprim value
+caml_safe_exec_with_helper(value args, value environment)
+{
+    CAMLparam2(args, environment);
+
+    safe_exec_result res;
+    safe_exec_with_helper_caml(args, environment, &res);
 
     CAMLreturn(Val_int(res.pid));
 }
 
+/*
+ * Like caml_safe_exec_with_helper, the helper should be passed "-t" option.
+ * Returns pid and the duration in nanoseconds of each phase (see
+ * spawn_phase), the first is the time to start the helper, the last
+ * the time to detect the execution. The array is empty if the helper
+ * did not send timings.
+ */
+CAMLprim value
+caml_safe_exec_with_helper_timed(value args, value environment)
+{
+    CAMLparam2(args, environment);
+    CAMLlocal2(durations, result);
+
+    safe_exec_result res;
+    safe_exec_with_helper_caml(args, environment, &res);
+
+    if (res.has_timings && res.timings.num_phases == SPAWN_PHASE_COUNT) {
+        durations = caml_alloc(SPAWN_PHASE_COUNT + 1, 0);
+        uint64_t prev = res.start_ns;
+        for (int i = 0; i < SPAWN_PHASE_COUNT; ++i) {
+            Store_field(durations, i, Val_long(res.timings.ns[i] - prev));
+            prev = res.timings.ns[i];
+        }
+        Store_field(durations, SPAWN_PHASE_COUNT, Val_long(res.end_ns - prev));
+    } else {
+        durations = caml_alloc(0, 0);
+    }
+
+    result = caml_alloc_tuple(2);
+    Store_field(result, 0, Val_int(res.pid));
+    Store_field(result, 1, durations);
+    CAMLreturn(result);
+}
+
+/*
+ * Execute many helpers in a single call.
+ * Arguments are copied at once and the runtime is released for the whole
+ * batch. Up to "max_concurrency" threads, including the calling one, take
+ * items in order, each waits for its helper to execute the command.
+ */
+#define BATCH_MAX_THREADS 64
+
+typedef struct {
+    char **args;
+    char **envs;
+    int err;
+    safe_exec_result res;
+} batch_item;
+
+typedef struct {
+    batch_item *items;
+    unsigned num_items;
+    unsigned next;
+} batch;
+
+static void *
+thread_proc_batch(void *arg)
+{
+    batch *b = arg;
+    unsigned n;
+
+    while ((n = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->num_items) {
+        batch_item *item = &b->items[n];
+        item->err = safe_exec_with_helper(&item->res, item->args, item->envs);
+    }
+    return NULL;
+}
+
+static void
+batch_free(batch *b)
+{
+    for (unsigned i = 0; i < b->num_items; ++i) {
+        free(b->items[i].args);
+        free(b->items[i].envs);
+    }
+    free(b->items);
+}
+
+static void
+batch_run(batch *b, unsigned num_threads)
+{
+    pthread_t threads[BATCH_MAX_THREADS];
+    unsigned started = 0;
+    sigset_t sigset, old_sigset;
+
+    // signals are handled by other threads
+    sigfillset(&sigset);
+    pthread_sigmask(SIG_BLOCK, &sigset, &old_sigset);
+    for (; started + 1 < num_threads; ++started)
+        if (pthread_create(&threads[started], NULL, thread_proc_batch, b) != 0)
+            break;
+    pthread_sigmask(SIG_SETMASK, &old_sigset, NULL);
+
+    thread_proc_batch(b);
+
+    for (unsigned i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+}
+
+CAMLprim value
+caml_safe_exec_with_helper_batch(value specs, value max_concurrency)
+{
+    CAMLparam2(specs, max_concurrency);
+    CAMLlocal3(results, result, error);
+
+    const unsigned num = Wosize_val(specs);
+    batch b = { calloc(num ? num : 1, sizeof(batch_item)), num, 0 };
+    if (!b.items)
+        caml_raise_out_of_memory();
+
+    // Copy parameters to C
+    bool oom = false;
+    for (unsigned i = 0; i < num; ++i) {
+        value spec = Field(specs, i);
+        b.items[i].args = copy_string_list(Field(spec, 0));
+        b.items[i].envs = copy_string_list(Field(spec, 1));
+        oom = oom || !b.items[i].args || !b.items[i].envs;
+    }
+    if (oom) {
+        batch_free(&b);
+        caml_raise_out_of_memory();
+    }
+
+    unsigned num_threads = Int_val(max_concurrency) < 1 ? 1 : Int_val(max_concurrency);
+    if (num_threads > BATCH_MAX_THREADS)
+        num_threads = BATCH_MAX_THREADS;
+    if (num_threads > num)
+        num_threads = num;
+
+    // potentially slow section, release Ocaml engine
+    caml_release_runtime_system();
+    batch_run(&b, num_threads);
+    caml_acquire_runtime_system();
+
+    // (int, Unix.error * string) result array
+    results = caml_alloc(num, 0);
+    for (unsigned i = 0; i < num; ++i) {
+        const batch_item *item = &b.items[i];
+        if (item->err != 0) {
+            error = caml_alloc_tuple(2);
+            Store_field(error, 0, unix_error_of_code(item->err));
+            Store_field(error, 1, caml_copy_string(item->res.err_msg));
+            result = caml_alloc_small(1, 1);
+            Field(result, 0) = error;
+        } else {
+            result = caml_alloc_small(1, 0);
+            Field(result, 0) = Val_int(item->res.pid);
+        }
+        Store_field(results, i, result);
+    }
+    batch_free(&b);
+
+    CAMLreturn(results);
+}
+
+/*
+ * Reaper of processes nobody is going to wait for.
+ * A single thread waits all of them using pidfds in an epoll set.
+ * New processes are pushed in a lock-free list and the thread is woken
+ * up using an eventfd.
+ */
+typedef struct reap_node {
+    struct reap_node *next;
+    pid_t pid;
+    int pidfd;
+} reap_node;
+
+#define REAPER_EVENT_KEY UINT64_MAX
+
+static struct {
+    pthread_mutex_t mtx;
+    bool started;
+    int epfd, evfd;
+    reap_node *pending;
+    // callback called with pid and status of reaped processes, if set
+    bool has_callback;
+    value callback;
+} reaper = {
+    .mtx = PTHREAD_MUTEX_INITIALIZER,
+    .epfd = -1,
+    .evfd = -1,
+    .callback = Val_unit,
+};
+
+static value
+alloc_process_status(int status)
+{
+    value res;
+
+    if (WIFEXITED(status)) {
+        res = caml_alloc_small(1, 0);
+        Field(res, 0) = Val_int(WEXITSTATUS(status));
+    } else if (WIFSTOPPED(status)) {
+        res = caml_alloc_small(1, 2);
+        Field(res, 0) = Val_int(caml_rev_convert_signal_number(WSTOPSIG(status)));
+    } else {
+        res = caml_alloc_small(1, 1);
+        Field(res, 0) = Val_int(caml_rev_convert_signal_number(WTERMSIG(status)));
+    }
+    return res;
+}
+
+static void
+reaper_report(bool registered, pid_t pid, int status)
+{
+    if (!registered || !__atomic_load_n(&reaper.has_callback, __ATOMIC_ACQUIRE))
+        return;
+
+    caml_acquire_runtime_system();
+    if (Is_block(reaper.callback)) {
+        value v_status = alloc_process_status(status);
+        // exceptions are ignored, there's no caller to report them to
+        caml_callback2_exn(Field(reaper.callback, 0), Val_int(pid), v_status);
+    }
+    caml_release_runtime_system();
+}
+
+// Add pending processes to the epoll set
+static void
+reaper_add_pending(void)
+{
+    reap_node *node = __atomic_exchange_n(&reaper.pending, NULL, __ATOMIC_ACQUIRE);
+
+    while (node) {
+        reap_node *next = node->next;
+        struct epoll_event ev = {
+            .events = EPOLLIN,
+            .data.u64 = ((uint64_t) node->pid << 32) | (uint32_t) node->pidfd,
+        };
+        if (epoll_ctl(reaper.epfd, EPOLL_CTL_ADD, node->pidfd, &ev) < 0) {
+            // should not happen, fallback to a blocking wait
+            pthread_t th;
+            close(node->pidfd);
+            if (create_thread_minstack(&th, thread_proc_reap, (void *) (intptr_t) node->pid) == 0)
+                pthread_detach(th);
+        }
+        free(node);
+        node = next;
+    }
+}
+
+static void *
+thread_proc_reaper(void *arg)
+{
+    struct epoll_event evs[64];
+    // needed to call OCaml callback
+    bool registered = caml_c_thread_register() != 0;
+
+    for (;;) {
+        int n = epoll_wait(reaper.epfd, evs, 64, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            uint64_t key = evs[i].data.u64, count;
+            if (key == REAPER_EVENT_KEY) {
+                if (read(reaper.evfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                    continue;
+                reaper_add_pending();
+                continue;
+            }
+
+            pid_t pid = (pid_t) (key >> 32);
+            int pidfd = (int) (uint32_t) key, status;
+            // remove explicitly, closing is not enough if the pidfd
+            // was inherited by a forked process
+            epoll_ctl(reaper.epfd, EPOLL_CTL_DEL, pidfd, NULL);
+            close(pidfd);
+            int res;
+            while ((res = waitpid(pid, &status, 0)) < 0 && errno == EINTR)
+                continue;
+            if (res == pid)
+                reaper_report(registered, pid, status);
+        }
+    }
+
+    if (registered)
+        caml_c_thread_unregister();
+    return NULL;
+}
+
+static void
+reaper_atfork_child(void)
+{
+    // the thread does not exist in the child, neither processes to wait
+    pthread_mutex_init(&reaper.mtx, NULL);
+    if (reaper.started) {
+        close(reaper.epfd);
+        close(reaper.evfd);
+    }
+    reaper.started = false;
+    reaper.epfd = reaper.evfd = -1;
+    reaper.pending = NULL;
+}
+
+// Start reaper thread if not already started, returns false on failure.
+static bool
+reaper_start(void)
+{
+    static bool atfork_registered = false;
+    bool res = true;
+    pthread_t th;
+    pthread_attr_t attr;
+
+    if (__atomic_load_n(&reaper.started, __ATOMIC_ACQUIRE))
+        return true;
+
+    pthread_mutex_lock(&reaper.mtx);
+    if (reaper.started)
+        goto out;
+
+    if (!atfork_registered) {
+        if (pthread_atfork(NULL, NULL, reaper_atfork_child) != 0) {
+            res = false;
+            goto out;
+        }
+        atfork_registered = true;
+    }
+
+    reaper.epfd = epoll_create1(EPOLL_CLOEXEC);
+    reaper.evfd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = REAPER_EVENT_KEY };
+    if (reaper.epfd < 0 || reaper.evfd < 0
+        || epoll_ctl(reaper.epfd, EPOLL_CTL_ADD, reaper.evfd, &ev) < 0)
+        goto error;
+
+    // not using create_thread_minstack, the thread can call OCaml code
+    if (pthread_attr_init(&attr) != 0)
+        goto error;
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&th, &attr, thread_proc_reaper, NULL);
+    pthread_attr_destroy(&attr);
+    if (err != 0)
+        goto error;
+
+    __atomic_store_n(&reaper.started, true, __ATOMIC_RELEASE);
+    goto out;
+
+error:
+    if (reaper.epfd >= 0)
+        close(reaper.epfd);
+    if (reaper.evfd >= 0)
+        close(reaper.evfd);
+    reaper.epfd = reaper.evfd = -1;
+    res = false;
+out:
+    pthread_mutex_unlock(&reaper.mtx);
+    return res;
+}
+
+// Pass the process to the reaper thread, returns false on failure.
+static bool
+reaper_add(pid_t pid)
+{
+    static bool pidfd_supported = true;
+
+    if (!__atomic_load_n(&pidfd_supported, __ATOMIC_RELAXED) || !reaper_start())
+        return false;
+
+    int pidfd = get_pidfd(pid);
+    if (pidfd < 0) {
+        if (errno == ENOSYS)
+            __atomic_store_n(&pidfd_supported, false, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    reap_node *node = malloc(sizeof(*node));
+    if (!node) {
+        close(pidfd);
+        return false;
+    }
+    node->pid = pid;
+    node->pidfd = pidfd;
+    node->next = __atomic_load_n(&reaper.pending, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&reaper.pending, &node->next, node,
+                                        true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        continue;
+
+    uint64_t one = 1;
+    if (write(reaper.evfd, &one, sizeof(one)) < 0) {
+        // can fail only if counter overflows, the reaper is awake anyway
+    }
+    return true;
+}
+
 CAMLprim value
 caml_pidwaiter_dontwait(value pid_val)
 {
     CAMLparam1(pid_val);
     pid_t pid = Int_val(pid_val);
 
-    // reap the pid to avoid zombies
+    // reap the pid to avoid zombies, use a thread per process on
+    // old kernels without pidfd support
     pthread_t th;
-    if (create_thread_minstack(&th, thread_proc_reap, (void *) (intptr_t) pid) == 0)
+    if (!reaper_add(pid)
+        && create_thread_minstack(&th, thread_proc_reap, (void *) (intptr_t) pid) == 0)
         pthread_detach(th);
 
     CAMLreturn(Val_unit);
 }
 
+CAMLprim value
+caml_pidwaiter_set_dontwait_callback(value callback)
+{
+    CAMLparam1(callback);
+    static bool root_registered = false;
+
+    if (!root_registered) {
+        caml_register_generational_global_root(&reaper.callback);
+        root_registered = true;
+    }
+    caml_modify_generational_global_root(&reaper.callback, callback);
+    __atomic_store_n(&reaper.has_callback, Is_block(callback), __ATOMIC_RELEASE);
+
+    CAMLreturn(Val_unit);
+}
+
 typedef struct {
     pid_t pid;
     bool timed_out;
@@ -303,7 +1345,7 @@ create_thread_minstack(pthread_t *th, void *(*proc)(void *), void *arg)
 }
 
 /*
- * Wait a process with a given timeout.
+ * Wait a process with a given timeout using an additional thread.
  * At the end of timeout (if trigger) kill the process.
  * To avoid race we need to wait a specific process, but this is blocking
  * and we use a timeout to implement the wait. Timer functions are per
@@ -311,22 +1353,11 @@ create_thread_minstack(pthread_t *th, void *(*proc)(void *), void *arg)
  * Returns <0 if error, 0 if not timed out, >0 if timedout.
  */
 static int
-wait_process_timeout(pid_t pid, double timeout)
+wait_process_timeout_thread(pid_t pid, const struct timespec *deadline)
 {
     int err;
 
-    // compute deadline
-    timeout_kill tm = { pid, false, false };
-    if (clock_gettime(CLOCK_MONOTONIC, &tm.deadline) < 0)
-        return -errno;
-
-    double f = floor(timeout);
-    tm.deadline.tv_sec += f;
-    tm.deadline.tv_nsec += (timeout - f) * 1000000000.;
-    if (tm.deadline.tv_nsec >= 1000000000) {
-        tm.deadline.tv_nsec -= 1000000000;
-        tm.deadline.tv_sec += 1;
-    }
+    timeout_kill tm = { pid, false, false, *deadline };
 
     pthread_condattr_t attr;
     err = pthread_condattr_init(&attr);
@@ -390,6 +1421,107 @@ wait_process_timeout(pid_t pid, double timeout)
     return err ? err : (tm.timed_out ? 1 : 0);
 }
 
+// Milliseconds from now to deadline, rounded up, 0 if expired.
+static int
+ms_to_deadline(const struct timespec *deadline)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    int64_t ns = (int64_t) (deadline->tv_sec - now.tv_sec) * 1000000000
+        + (deadline->tv_nsec - now.tv_nsec);
+    if (ns <= 0)
+        return 0;
+    ns = (ns + 999999) / 1000000;
+    return ns > INT_MAX ? INT_MAX : (int) ns;
+}
+
+// Wait a process termination on a pidfd, -1 timeout waits forever.
+// Returns <0 if error, 0 if terminated, >0 if timed out.
+static int
+poll_pidfd(int pidfd, const struct timespec *deadline)
+{
+    struct pollfd pfd = { pidfd, POLLIN, 0 };
+
+    for (;;) {
+        int res = poll(&pfd, 1, deadline ? ms_to_deadline(deadline) : -1);
+        if (res > 0)
+            return 0;
+        if (res == 0)
+            return 1;
+        if (errno != EINTR)
+            return -errno;
+    }
+}
+
+/*
+ * Wait a process with a given timeout using a pidfd.
+ * The pidfd refers to the process, not to the pid number, so a kill
+ * cannot hit a reused pid. Process is not reaped, like the fallback.
+ * Returns -ENOSYS if pidfd are not supported, otherwise like
+ * wait_process_timeout.
+ */
+static int
+wait_process_timeout_pidfd(pid_t pid, const struct timespec *deadline)
+{
+    static bool pidfd_supported = true;
+    int err;
+
+    if (!__atomic_load_n(&pidfd_supported, __ATOMIC_RELAXED))
+        return -ENOSYS;
+
+    int pidfd = get_pidfd(pid);
+    if (pidfd < 0) {
+        err = errno;
+        if (err == ENOSYS)
+            __atomic_store_n(&pidfd_supported, false, __ATOMIC_RELAXED);
+        return -err;
+    }
+
+    int res = poll_pidfd(pidfd, deadline);
+    if (res > 0) {
+        // timed out, kill and wait for the process to terminate
+        if (pidfd_send_signal(pidfd, SIGKILL) < 0 && errno != ESRCH)
+            res = -errno;
+        else if ((err = poll_pidfd(pidfd, NULL)) < 0)
+            res = err;
+    }
+    close(pidfd);
+    return res;
+}
+
+/*
+ * Wait a process with a given timeout.
+ * At the end of timeout (if trigger) kill the process.
+ * Uses a pidfd if supported by the kernel, otherwise falls back to
+ * wait_process_timeout_thread.
+ * Returns <0 if error, 0 if not timed out, >0 if timedout.
+ */
+static int
+wait_process_timeout(pid_t pid, double timeout)
+{
+    struct timespec deadline;
+
+    // compute deadline
+    if (clock_gettime(CLOCK_MONOTONIC, &deadline) < 0)
+        return -errno;
+
+    double f = floor(timeout);
+    deadline.tv_sec += f;
+    deadline.tv_nsec += (timeout - f) * 1000000000.;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_nsec -= 1000000000;
+        deadline.tv_sec += 1;
+    }
+
+    int res = wait_process_timeout_pidfd(pid, &deadline);
+    // old kernel or process not found (the fallback will report
+    // the error in the same way it did before)
+    if (res == -ENOSYS || res == -ESRCH)
+        res = wait_process_timeout_thread(pid, &deadline);
+    return res;
+}
+
 CAMLprim value
 caml_pidwaiter_waitpid(value timeout_value, value pid_value)
 {
@@ -416,3 +1548,48 @@ caml_pidwaiter_waitpid(value timeout_value, value pid_value)
 
     CAMLreturn(timed_out ? Val_true: Val_false);
 }
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+
+CAMLprim value
+caml_forkhelpers_memfd_create(value name)
+{
+    CAMLparam1(name);
+
+#ifdef SYS_memfd_create
+    int fd = syscall(SYS_memfd_create, String_val(name),
+                     MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+    int fd = -1;
+    errno = ENOSYS;
+#endif
+    if (fd < 0)
+        unix_error(errno, "memfd_create", name);
+
+    CAMLreturn(Val_int(fd));
+}
+
+/* Size the memfd to size bytes and forbid growing it, so that writes past
+ * it fail with EPERM instead of using more memory */
+CAMLprim value
+caml_forkhelpers_memfd_limit(value fd, value size)
+{
+    CAMLparam2(fd, size);
+
+    if (ftruncate(Int_val(fd), Long_val(size)) != 0)
+        unix_error(errno, "ftruncate", Nothing);
+    if (fcntl(Int_val(fd), F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0)
+        unix_error(errno, "fcntl", Nothing);
+
+    CAMLreturn(Val_unit);
+}
@@ -41,20 +41,70 @@ let with_tracing ~tracing ~name f = Tracing.with_tracing ~parent:tracing ~name f
 let finally = Xapi_stdext_pervasives.Pervasiveext.finally
 
 (* Use forkexecd daemon instead of vfork implementation if file is present *)
-let use_daemon = Sys.file_exists "/etc/xensource/forkexec-uses-daemon"
+let use_daemon =
+  Sys.file_exists "/etc/xensource/forkexec-uses-daemon"
+  || Option.is_some test_path && Option.is_some (Sys.getenv_opt "FE_TEST_DAEMON")
+
+(* Use a persistent spawn server for the vfork implementation if file is
+   present, see helper/spawn_server.h *)
+let use_spawn_server =
+  Sys.file_exists "/etc/xensource/forkexec-uses-spawn-server"
+  || Option.is_some test_path
+     && Option.is_some (Sys.getenv_opt "FE_TEST_SPAWN_SERVER")
+
+(* Forward output of all children to syslog from a single process if file is
+   present, see helper/syslog.h *)
+let use_syslog_forwarder =
+  Sys.file_exists "/etc/xensource/forkexec-uses-syslog-forwarder"
+  || Option.is_some test_path
+     && Option.is_some (Sys.getenv_opt "FE_TEST_SYSLOG_FORWARDER")
+
+let vfork_helper = "/usr/libexec/xapi/vfork_helper"
 
 module FEStubs = struct
   external safe_exec_with_helper : string list -> string list -> int
     = "caml_safe_exec_with_helper"
 
+  (* like safe_exec_with_helper, returns also the duration in ns of the
+     phases of the helper, see spawn_phases *)
+  external safe_exec_with_helper_timed :
+    string list -> string list -> int * int array
+    = "caml_safe_exec_with_helper_timed"
+
+  (* spawn many helpers using up to the given number of threads *)
+  external safe_exec_with_helper_batch :
+       (string list * string list) array
+    -> int
+    -> (int, Unix.error * string) Stdlib.result array
+    = "caml_safe_exec_with_helper_batch"
+
   (* timeout <= 0 wait infinite *)
   external pidwaiter_waitpid : ?timeout:float -> int -> bool
     = "caml_pidwaiter_waitpid"
 
   (* do not wait for a process, release it, it won't generate a zombie process *)
   external pidwaiter_dontwait : int -> unit = "caml_pidwaiter_dontwait"
+
+  (* start using the spawn server for safe_exec_with_helper *)
+  external spawn_server_enable : string -> unit = "caml_spawn_server_enable"
+
+  (* socket of the shared syslog forwarder, started if needed, or -1 *)
+  external syslog_forwarder_fd : string -> int = "caml_syslog_forwarder_fd"
+
+  external memfd_create : string -> Unix.file_descr
+    = "caml_forkhelpers_memfd_create"
+
+  (* set the size of a memfd and seal it against growing *)
+  external memfd_limit : Unix.file_descr -> int -> unit
+    = "caml_forkhelpers_memfd_limit"
+
+  external pidwaiter_set_dontwait_callback :
+    (int -> Unix.process_status -> unit) option -> unit
+    = "caml_pidwaiter_set_dontwait_callback"
 end
 
+let () = if use_spawn_server then FEStubs.spawn_server_enable vfork_helper
+
 type waiter = Pidwaiter | Sock of Unix.file_descr
 
 type pidty = waiter * int
@@ -170,6 +220,26 @@ let dontwaitpid (waiter, pid) =
   | Sock sock ->
       dontwaitpid_daemon sock pid
 
+let set_dontwait_callback = FEStubs.pidwaiter_set_dontwait_callback
+
+let () =
+  set_dontwait_callback
+    (Some
+       (fun pid status ->
+         match status with
+         | Unix.WEXITED 0 ->
+             ()
+         | Unix.WEXITED n ->
+             D.debug "dontwaitpid: process %d exited with code %d" pid n
+         | Unix.WSIGNALED n ->
+             D.debug "dontwaitpid: process %d killed by signal %a" pid
+               Debug.Pp.signal n
+         | Unix.WSTOPPED n ->
+             D.debug "dontwaitpid: process %d stopped by signal %a" pid
+               Debug.Pp.signal n
+       )
+    )
+
 let waitpid_fail_if_bad_exit ty =
   let _, status = waitpid ty in
   match status with
@@ -221,6 +291,88 @@ let with_logfile_fd ?(delete = true) prefix f =
     Unix.close log_fd ;
     Failure (read_logfile (), e)
 
+(* Cleared on the first failure, memfd_create requires Linux 3.17 *)
+let memfd_supported = Atomic.make true
+
+(* A capped memfd is sized to [max_size] rounded up to this, writes are done
+   in pages and one crossing the end of the file would fail altogether,
+   losing the output up to [max_size] *)
+let capture_granularity = 65536
+
+(* Read at most [max_size] bytes from the beginning of [fd] *)
+let read_capture ~max_size fd =
+  let size =
+    if max_size = max_int then
+      Int64.to_int Unix.LargeFile.((fstat fd).st_size)
+    else
+      (* a capped capture is sized to its limit, what was written ends at
+         the offset shared with the command *)
+      Int64.to_int (Unix.LargeFile.lseek fd 0L Unix.SEEK_CUR)
+  in
+  let len = min size max_size in
+  ignore (Unix.lseek fd 0 Unix.SEEK_SET) ;
+  let buf = Bytes.create len in
+  let rec read ofs =
+    if ofs >= len then
+      ofs
+    else
+      match Unix.read fd buf ofs (len - ofs) with
+      | 0 ->
+          ofs
+      | n ->
+          read (ofs + n)
+  in
+  let len = read 0 in
+  (Bytes.sub_string buf 0 len, size > max_size)
+
+(* Anonymous file to capture output: a memfd or, on old kernels, a
+   temporary file unlinked straight away. A memfd cannot grow past
+   [max_size] rounded up to [capture_granularity], bounding the memory the
+   command can use with its output; a temporary file is not bounded. *)
+let capture_fd ?(max_size = max_int) prefix =
+  let fd =
+    if Atomic.get memfd_supported then (
+      try Some (FEStubs.memfd_create prefix)
+      with Unix.Unix_error ((Unix.ENOSYS | Unix.EINVAL), _, _) ->
+        Atomic.set memfd_supported false ;
+        None
+    ) else
+      None
+  in
+  match fd with
+  | Some fd when max_size < max_int - capture_granularity -> (
+      let size =
+        (max_size + capture_granularity)
+        / capture_granularity
+        * capture_granularity
+      in
+      try
+        FEStubs.memfd_limit fd size ;
+        fd
+      with e -> Unix.close fd ; raise e
+    )
+  | Some fd ->
+      fd
+  | None ->
+      let logfile = Filename.temp_file ?temp_dir prefix ".log" in
+      finally
+        (fun () -> Unix.openfile logfile [Unix.O_RDWR; Unix.O_CLOEXEC] 0o0)
+        (fun () -> Unix.unlink logfile)
+
+let with_memfd ?(max_size = max_int) prefix f =
+  let fd = capture_fd ~max_size prefix in
+  finally
+    (fun () ->
+      match f fd with
+      | result ->
+          let contents, truncated = read_capture ~max_size fd in
+          (Success (contents, result), truncated)
+      | exception e ->
+          let contents, truncated = read_capture ~max_size fd in
+          (Failure (contents, e), truncated)
+    )
+    (fun () -> Unix.close fd)
+
 exception Spawn_internal_error of string * string * Unix.process_status
 
 type syslog_stdout =
@@ -228,6 +380,18 @@ type syslog_stdout =
   | Syslog_DefaultKey
   | Syslog_WithKey of string
 
+type resource_class = Default | Interactive | Background | Bulk
+
+let string_of_resource_class = function
+  | Default ->
+      None
+  | Interactive ->
+      Some "interactive"
+  | Background ->
+      Some "background"
+  | Bulk ->
+      Some "bulk"
+
 let safe_close_and_exec_daemon ?tracing env stdin stdout stderr
     (fds : (string * Unix.file_descr) list) ?(syslog_stdout = NoSyslogging)
     ?(redirect_stderr_to_stdout = false) args =
@@ -359,9 +523,11 @@ let safe_close_and_exec_daemon ?tracing env stdin stdout stderr
     )
     close_fds
 
-let safe_close_and_exec_vfork ?tracing env stdin stdout stderr
+(* Arguments and environment for vfork_helper *)
+let vfork_helper_args ?tracing env stdin stdout stderr
     (fds : (string * Unix.file_descr) list) ?(syslog_stdout = NoSyslogging)
-    ?(redirect_stderr_to_stdout = false) cmd args =
+    ?(redirect_stderr_to_stdout = false) ?(resource_class = Default)
+    ?(timings = false) cmd args =
   let string_of_fd (fd : Unix.file_descr) = string_of_int (Obj.magic fd) in
   let args = "--" :: args in
   let args =
@@ -370,6 +536,13 @@ let safe_close_and_exec_vfork ?tracing env stdin stdout stderr
     else
       args
   in
+  let args =
+    match string_of_resource_class resource_class with
+    | Some name ->
+        "-c" :: name :: args
+    | None ->
+        args
+  in
   let args =
     match syslog_stdout with
     | NoSyslogging ->
@@ -379,6 +552,16 @@ let safe_close_and_exec_vfork ?tracing env stdin stdout stderr
     | Syslog_WithKey key ->
         "-s" :: key :: args
   in
+  let args =
+    match syslog_stdout with
+    | NoSyslogging ->
+        args
+    | Syslog_DefaultKey | Syslog_WithKey _ when use_syslog_forwarder ->
+        let fd = FEStubs.syslog_forwarder_fd vfork_helper in
+        if fd >= 0 then "-L" :: string_of_int fd :: args else args
+    | Syslog_DefaultKey | Syslog_WithKey _ ->
+        args
+  in
   let args =
     List.fold_right
       (fun (uuid, fd) args ->
@@ -398,33 +581,147 @@ let safe_close_and_exec_vfork ?tracing env stdin stdout stderr
   let args = add_std args "-E" stderr in
   let args = add_std args "-O" stdout in
   let args = add_std args "-I" stdin in
-  let args = "/usr/libexec/xapi/vfork_helper" :: "-e" :: "DUMMY" :: args in
+  let args = if timings then "-t" :: args else args in
+  let args = vfork_helper :: "-e" :: "DUMMY" :: args in
   (* Convert environment and add tracing variables. *)
   let env =
     List.append (Tracing.EnvHelpers.of_span tracing) (Array.to_list env)
   in
-  let pid = FEStubs.safe_exec_with_helper args env in
-  (Pidwaiter, pid)
+  (args, env)
+
+(* Names of the durations returned by safe_exec_with_helper_timed, see
+   spawn_phase in helper/vfork_helper.h *)
+let spawn_phases =
+  [|
+     "start"
+   ; "args"
+   ; "redirect_mappings"
+   ; "chdir"
+   ; "clear_cgroup"
+   ; "setsid"
+   ; "fd_ops"
+   ; "init_syslog"
+   ; "exec"
+   ; "exec_detected"
+  |]
+
+let trace_spawn_phases ~tracing durations =
+  if Array.length durations = Array.length spawn_phases then
+    let attributes =
+      Array.to_list
+        (Array.mapi
+           (fun i ns ->
+             ( Printf.sprintf "xs.spawn.phase.%s.us" spawn_phases.(i)
+             , string_of_int (ns / 1000)
+             )
+           )
+           durations
+        )
+    in
+    Tracing.with_tracing ~attributes ~parent:tracing
+      ~name:"Forkhelpers.spawn_phases" ignore
+
+let safe_close_and_exec_vfork ?tracing env stdin stdout stderr fds
+    ?syslog_stdout ?redirect_stderr_to_stdout ?resource_class cmd args =
+  (* phase timings are requested only if they can be reported *)
+  let timings = Option.is_some tracing in
+  let args, env =
+    vfork_helper_args ?tracing env stdin stdout stderr fds ?syslog_stdout
+      ?redirect_stderr_to_stdout ?resource_class ~timings cmd args
+  in
+  if timings then (
+    let pid, durations = FEStubs.safe_exec_with_helper_timed args env in
+    trace_spawn_phases ~tracing durations ;
+    (Pidwaiter, pid)
+  ) else
+    (Pidwaiter, FEStubs.safe_exec_with_helper args env)
 
 (** Safe function which forks a command, closing all fds except a whitelist and
     having performed some fd operations in the child *)
 let safe_close_and_exec ?tracing ?env stdin stdout stderr
     (fds : (string * Unix.file_descr) list) ?(syslog_stdout = NoSyslogging)
-    ?(redirect_stderr_to_stdout = false) (cmd : string) (args : string list) =
+    ?(redirect_stderr_to_stdout = false) ?resource_class (cmd : string)
+    (args : string list) =
   with_tracing ~tracing ~name:__FUNCTION__ @@ fun tracing ->
   let args = cmd :: args in
   let env = Option.value ~default:default_path_env_pair env in
 
   if not use_daemon then (* Build a list of arguments as helper wants. *)
     safe_close_and_exec_vfork ?tracing env stdin stdout stderr fds
-      ~syslog_stdout ~redirect_stderr_to_stdout cmd args
+      ~syslog_stdout ~redirect_stderr_to_stdout ?resource_class cmd args
   else
+    (* the daemon protocol has no resource classes *)
     safe_close_and_exec_daemon ?tracing env stdin stdout stderr fds
       ~syslog_stdout ~redirect_stderr_to_stdout args
 
+type command = {
+    cmd: string
+  ; args: string list
+  ; stdin: Unix.file_descr option
+  ; stdout: Unix.file_descr option
+  ; stderr: Unix.file_descr option
+}
+
+let safe_close_and_exec_batch ?tracing ?env ?(max_concurrency = 8)
+    ?resource_class commands =
+  with_tracing ~tracing ~name:__FUNCTION__ @@ fun tracing ->
+  let env = Option.value ~default:default_path_env_pair env in
+  if not use_daemon then
+    let specs =
+      List.map
+        (fun c ->
+          vfork_helper_args ?tracing env c.stdin c.stdout c.stderr []
+            ?resource_class c.cmd (c.cmd :: c.args)
+        )
+        commands
+    in
+    FEStubs.safe_exec_with_helper_batch (Array.of_list specs) max_concurrency
+    |> Array.to_list
+    |> List.map (function
+         | Ok pid ->
+             Ok (Pidwaiter, pid)
+         | Error (err, msg) ->
+             Error (Unix.Unix_error (err, msg, ""))
+         )
+  else
+    List.map
+      (fun c ->
+        try
+          Ok
+            (safe_close_and_exec_daemon ?tracing env c.stdin c.stdout c.stderr
+               [] (c.cmd :: c.args)
+            )
+        with e -> Error e
+      )
+      commands
+
+(* Wait for a process, killing it and raising Subprocess_timeout if it runs
+   for more than [timeout] seconds *)
+let waitpid_timeout ?tracing timeout (waiter, pid) =
+  match waiter with
+  | Pidwaiter ->
+      with_tracing ~tracing ~name:"Forkhelpers.waitpid" @@ fun _ ->
+      let timeout = Option.value ~default:0. timeout in
+      let timedout = FEStubs.pidwaiter_waitpid ~timeout pid in
+      let res = Unix.waitpid [] pid in
+
+      if timedout then raise Subprocess_timeout ;
+      res
+  | Sock sock -> (
+      Option.iter
+        (fun timeout -> Unix.setsockopt_float sock Unix.SO_RCVTIMEO timeout)
+        timeout ;
+      with_tracing ~tracing ~name:"Forkhelpers.waitpid" @@ fun _ ->
+      try waitpid_daemon sock pid
+      with Unix.(Unix_error ((EAGAIN | EWOULDBLOCK), _, _)) ->
+        Unix.kill pid Sys.sigkill ;
+        ignore (waitpid_daemon sock pid) ;
+        raise Subprocess_timeout
+    )
+
 let execute_command_get_output_inner ?tracing ?env ?stdin
-    ?(syslog_stdout = NoSyslogging) ?(redirect_stderr_to_stdout = false) timeout
-    cmd args =
+    ?(syslog_stdout = NoSyslogging) ?(redirect_stderr_to_stdout = false)
+    ?(max_output = max_int) ?resource_class timeout cmd args =
   let to_close = ref [] in
   let close fd =
     if List.mem fd !to_close then (
@@ -444,17 +741,19 @@ let execute_command_get_output_inner ?tracing ?env ?stdin
   finally
     (fun () ->
       match
-        with_tracing ~tracing ~name:"Forkhelpers.with_logfile_out_fd"
+        with_tracing ~tracing ~name:"Forkhelpers.with_memfd_out_fd"
         @@ fun tracing ->
-        with_logfile_fd "execute_command_get_out" (fun out_fd ->
-            with_tracing ~tracing ~name:"Forkhelpers.with_logfile_err_fd"
+        with_memfd ~max_size:max_output "execute_command_get_out"
+          (fun out_fd ->
+            with_tracing ~tracing ~name:"Forkhelpers.with_memfd_err_fd"
             @@ fun tracing ->
-            with_logfile_fd "execute_command_get_err" (fun err_fd ->
+            with_memfd ~max_size:max_output "execute_command_get_err"
+              (fun err_fd ->
                 let waiter, pid =
                   safe_close_and_exec ?tracing ?env
                     (Option.map (fun (_, fd, _) -> fd) stdinandpipes)
                     (Some out_fd) (Some err_fd) [] ~syslog_stdout
-                    ~redirect_stderr_to_stdout cmd args
+                    ~redirect_stderr_to_stdout ?resource_class cmd args
                 in
                 Option.iter
                   (fun (str, _, wr) ->
@@ -462,62 +761,132 @@ let execute_command_get_output_inner ?tracing ?env ?stdin
                     close wr
                   )
                   stdinandpipes ;
-                match waiter with
-                | Pidwaiter ->
-                    with_tracing ~tracing ~name:"Forkhelpers.waitpid"
-                    @@ fun _ ->
-                    let timeout =
-                      match timeout with
-                      | Some span ->
-                          Clock.Timer.span_to_s span
-                      | None ->
-                          0.
-                    in
-                    let timedout = FEStubs.pidwaiter_waitpid ~timeout pid in
-                    let res = Unix.waitpid [] pid in
-
-                    if timedout then raise Subprocess_timeout ;
-                    res
-                | Sock sock -> (
-                    ( match timeout with
-                    | Some span ->
-                        let timeout = Clock.Timer.span_to_s span in
-                        Unix.setsockopt_float sock Unix.SO_RCVTIMEO timeout
-                    | None ->
-                        ()
-                    ) ;
-                    with_tracing ~tracing ~name:"Forkhelpers.waitpid"
-                    @@ fun _ ->
-                    try waitpid_daemon sock pid
-                    with Unix.(Unix_error ((EAGAIN | EWOULDBLOCK), _, _)) ->
-                      Unix.kill pid Sys.sigkill ;
-                      ignore (waitpid_daemon sock pid) ;
-                      raise Subprocess_timeout
-                  )
+                waitpid_timeout ?tracing
+                  (Option.map Clock.Timer.span_to_s timeout)
+                  (waiter, pid)
             )
         )
       with
-      | Success (out, Success (err, (_pid, status))) -> (
+      | Success (out, (Success (err, (_pid, status)), err_truncated)), out_truncated
+        -> (
         match status with
         | Unix.WEXITED 0 ->
-            (out, err)
+            ((out, out_truncated), (err, err_truncated))
         | e ->
             raise (Spawn_internal_error (err, out, e))
       )
-      | Success (_, Failure (_, exn)) | Failure (_, exn) ->
+      | Success (_, (Failure (_, exn), _)), _ | Failure (_, exn), _ ->
           raise exn
     )
     (fun () -> List.iter Unix.close !to_close)
 
 let execute_command_get_output ?tracing ?env ?(syslog_stdout = NoSyslogging)
-    ?(redirect_stderr_to_stdout = false) ?timeout cmd args =
+    ?(redirect_stderr_to_stdout = false) ?resource_class ?timeout cmd args =
+  with_tracing ~tracing ~name:__FUNCTION__ @@ fun tracing ->
+  let (out, _), (err, _) =
+    execute_command_get_output_inner ?tracing ?env ?stdin:None ~syslog_stdout
+      ~redirect_stderr_to_stdout ?resource_class timeout cmd args
+  in
+  (out, err)
+
+let execute_command_get_output_capped ?tracing ?env
+    ?(syslog_stdout = NoSyslogging) ?(redirect_stderr_to_stdout = false)
+    ?resource_class ?timeout ~max_output cmd args =
   with_tracing ~tracing ~name:__FUNCTION__ @@ fun tracing ->
   execute_command_get_output_inner ?tracing ?env ?stdin:None ~syslog_stdout
-    ~redirect_stderr_to_stdout timeout cmd args
+    ~redirect_stderr_to_stdout ~max_output ?resource_class timeout cmd args
+
+let execute_commands_get_output ?tracing ?env ?(max_concurrency = 8)
+    ?resource_class ?(max_output = max_int) ?timeout commands =
+  with_tracing ~tracing ~name:__FUNCTION__ @@ fun tracing ->
+  (* commands of a chunk are waited in order, the timeout of each of them
+     counts from when they were all spawned *)
+  let remaining timer =
+    match Clock.Timer.remaining timer with
+    | Clock.Timer.Remaining span ->
+        Clock.Timer.span_to_s span
+    | Clock.Timer.Expired _ ->
+        (* kill it straight away, 0 would wait without timeout *)
+        0.001
+  in
+  let run chunk =
+    let to_close = ref [] in
+    let capture prefix =
+      let fd = capture_fd ~max_size:max_output prefix in
+      to_close := fd :: !to_close ;
+      fd
+    in
+    finally
+      (fun () ->
+        let captures =
+          List.map
+            (fun (cmd, args) ->
+              let out_fd = capture "execute_command_get_out" in
+              let err_fd = capture "execute_command_get_err" in
+              let command =
+                {cmd; args; stdin= None; stdout= Some out_fd; stderr= Some err_fd}
+              in
+              (out_fd, err_fd, command)
+            )
+            chunk
+        in
+        let spawned =
+          safe_close_and_exec_batch ?tracing ?env ~max_concurrency
+            ?resource_class
+            (List.map (fun (_, _, command) -> command) captures)
+        in
+        let timer =
+          Option.map (fun duration -> Clock.Timer.start ~duration) timeout
+        in
+        (* all commands are running, wait them in order *)
+        List.map2
+          (fun (out_fd, err_fd, _) spawned ->
+            match spawned with
+            | Error e ->
+                Error e
+            | Ok spawned -> (
+              match
+                waitpid_timeout ?tracing (Option.map remaining timer) spawned
+              with
+              | exception e ->
+                  Error e
+              | _, status -> (
+                  let out = read_capture ~max_size:max_output out_fd in
+                  let err = read_capture ~max_size:max_output err_fd in
+                  match status with
+                  | Unix.WEXITED 0 ->
+                      Ok (out, err)
+                  | e ->
+                      Error (Spawn_internal_error (fst err, fst out, e))
+                )
+            )
+          )
+          captures spawned
+      )
+      (fun () -> List.iter Unix.close !to_close)
+  in
+  (* bound also the number of running commands and open captures *)
+  let rec chunks acc = function
+    | [] ->
+        List.rev acc
+    | l ->
+        let rec take n acc = function
+          | x :: l when n > 0 ->
+              take (n - 1) (x :: acc) l
+          | l ->
+              (List.rev acc, l)
+        in
+        let chunk, rest = take (max 1 max_concurrency) [] l in
+        chunks (chunk :: acc) rest
+  in
+  List.concat_map run (chunks [] commands)
 
 let execute_command_get_output_send_stdin ?tracing ?env
     ?(syslog_stdout = NoSyslogging) ?(redirect_stderr_to_stdout = false)
-    ?timeout cmd args stdin =
+    ?resource_class ?timeout cmd args stdin =
   with_tracing ~tracing ~name:__FUNCTION__ @@ fun tracing ->
-  execute_command_get_output_inner ?tracing ?env ~stdin ~syslog_stdout
-    ~redirect_stderr_to_stdout timeout cmd args
+  let (out, _), (err, _) =
+    execute_command_get_output_inner ?tracing ?env ~stdin ~syslog_stdout
+      ~redirect_stderr_to_stdout ?resource_class timeout cmd args
+  in
+  (out, err)
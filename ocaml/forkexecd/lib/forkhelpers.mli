@@ -39,6 +39,19 @@ type syslog_stdout =
   | Syslog_DefaultKey
   | Syslog_WithKey of string
 
+(** Resource class of an executed command. Each class is a systemd slice,
+    forkexecd-<class>.slice, with its own CPU and I/O weights and memory
+    limit, shared by the commands of the class. Nice and I/O priority are
+    used if the slice is not available. Ignored if the forkexecd daemon is
+    used. *)
+type resource_class =
+  | Default  (** Same priorities as the caller *)
+  | Interactive  (** Latency critical commands, like tap-ctl *)
+  | Background  (** Periodic or maintenance commands *)
+  | Bulk
+      (** Long running data movers and compressors, like sparse_dd or
+          vhd-util coalesce *)
+
 val default_path : string list
 
 val default_path_env_pair : string array
@@ -48,6 +61,7 @@ val execute_command_get_output :
   -> ?env:string array
   -> ?syslog_stdout:syslog_stdout
   -> ?redirect_stderr_to_stdout:bool
+  -> ?resource_class:resource_class
   -> ?timeout:Mtime.Span.t
   -> string
   -> string list
@@ -56,11 +70,48 @@ val execute_command_get_output :
     	on success (exit 0). On failure this raises 
     [Spawn_internal_error(stderr, stdout, Unix.process_status)] *)
 
+val execute_command_get_output_capped :
+     ?tracing:Tracing.Span.t
+  -> ?env:string array
+  -> ?syslog_stdout:syslog_stdout
+  -> ?redirect_stderr_to_stdout:bool
+  -> ?resource_class:resource_class
+  -> ?timeout:Mtime.Span.t
+  -> max_output:int
+  -> string
+  -> string list
+  -> (string * bool) * (string * bool)
+(** [execute_command_get_output_capped ~max_output cmd args] is like
+    {!execute_command_get_output} but stdout and stderr are truncated to
+    [max_output] bytes; each is returned with a flag telling if it was
+    truncated. The memory used by the output is bounded too: writes past
+    [max_output], rounded up to 64 KiB, fail with [EPERM], which usually
+    makes the command fail. *)
+
+val execute_commands_get_output :
+     ?tracing:Tracing.Span.t
+  -> ?env:string array
+  -> ?max_concurrency:int
+  -> ?resource_class:resource_class
+  -> ?max_output:int
+  -> ?timeout:Mtime.Span.t
+  -> (string * string list) list
+  -> ((string * bool) * (string * bool), exn) Stdlib.result list
+(** [execute_commands_get_output commands] runs each [(cmd, args)] like
+    {!execute_command_get_output}, returning (stdout, stderr) or the exception
+    for each of them, in order. Up to [max_concurrency] commands (default 8)
+    are spawned in a single call and run at the same time. Outputs are
+    truncated to [max_output] bytes as with
+    {!execute_command_get_output_capped}, each with a flag telling if it was.
+    A command still running [timeout] after it was spawned is killed and its
+    result is [Error Subprocess_timeout]. *)
+
 val execute_command_get_output_send_stdin :
      ?tracing:Tracing.Span.t
   -> ?env:string array
   -> ?syslog_stdout:syslog_stdout
   -> ?redirect_stderr_to_stdout:bool
+  -> ?resource_class:resource_class
   -> ?timeout:Mtime.Span.t
   -> string
   -> string list
@@ -102,6 +153,7 @@ val safe_close_and_exec :
   -> (string * Unix.file_descr) list
   -> ?syslog_stdout:syslog_stdout
   -> ?redirect_stderr_to_stdout:bool
+  -> ?resource_class:resource_class
   -> string
   -> string list
   -> pidty
@@ -110,6 +162,26 @@ val safe_close_and_exec :
     	specified) and with any key from [id_to_fd_list] in [args] replaced by the integer
     	value of the file descriptor in the final process. *)
 
+type command = {
+    cmd: string
+  ; args: string list
+  ; stdin: Unix.file_descr option
+  ; stdout: Unix.file_descr option
+  ; stderr: Unix.file_descr option
+}
+
+val safe_close_and_exec_batch :
+     ?tracing:Tracing.Span.t
+  -> ?env:string array
+  -> ?max_concurrency:int
+  -> ?resource_class:resource_class
+  -> command list
+  -> (pidty, exn) Stdlib.result list
+(** [safe_close_and_exec_batch commands] starts all [commands] like
+    {!safe_close_and_exec} in a single call, using up to [max_concurrency]
+    threads (default 8). Returns, in order, the process or the exception
+    raised starting it. *)
+
 val waitpid : pidty -> int * Unix.process_status
 (** [waitpid p] returns the (pid, Unix.process_status) *)
 
@@ -123,6 +195,13 @@ val dontwaitpid : pidty -> unit
 (** [dontwaitpid p]: signals the caller's desire to never call waitpid. Note that the final
     	process will not persist as a zombie. *)
 
+val set_dontwait_callback : (int -> Unix.process_status -> unit) option -> unit
+(** [set_dontwait_callback f] sets the function called with pid and status of
+    processes passed to {!dontwaitpid} once they terminate. The function is
+    called from the reaper thread, exceptions are ignored. By default
+    abnormal terminations are logged. Only processes started without the
+    forkexecd daemon on kernels supporting pidfd are reported. *)
+
 val waitpid_fail_if_bad_exit : pidty -> unit
 (** [waitpid_fail_if_bad_exit p] calls waitpid on [p] and throws [Subprocess_failed x] if the 
     	process exits with non-zero code x and [Subprocess_killed x] if the process is killed by a 
@@ -139,5 +218,13 @@ val with_logfile_fd :
     [f]. The logfile is guaranteed to be closed afterwards, and unlinked if either the delete flag is set or the call fails. If the
     function [f] throws an error then the log file contents are read in *)
 
+val with_memfd :
+  ?max_size:int -> string -> (Unix.file_descr -> 'a) -> 'a result * bool
+(** Like {!with_logfile_fd} but the output is kept in memory using a memfd,
+    falling back to a temporary file on old kernels. Contents longer than
+    [max_size] bytes are truncated, the returned flag tells if that
+    happened. With [max_size] the memfd cannot grow past it, rounded up to
+    64 KiB, and its contents end at the offset of the file. *)
+
 val temp_dir_server : string
 (** Temporary directory used for communication *)
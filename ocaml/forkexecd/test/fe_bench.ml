@@ -0,0 +1,150 @@
+(* Spawn latency benchmark for Forkhelpers.
+
+   Measures, for /bin/true, the time from calling [safe_close_and_exec] until
+   it returns (spawn-to-exec: the command has been executed) and until the
+   process has been reaped (spawn-to-exit). Each condition is varied on its own
+   starting from a baseline of no fd mappings, no syslog, no extra RSS, a few
+   open fds and a single caller.
+
+   The path measured is the one Forkhelpers selects: the vfork helper by
+   default, the spawn server with FE_TEST_SPAWN_SERVER=1 and the forkexecd
+   daemon with FE_TEST_DAEMON=1 (see fe_bench.sh). *)
+
+let cmd = "/bin/true"
+
+type condition = {
+    mappings: bool
+  ; syslog: bool
+  ; rss_mb: int
+  ; open_fds: int
+  ; concurrency: int
+}
+
+let baseline =
+  {mappings= false; syslog= false; rss_mb= 0; open_fds= 10; concurrency= 1}
+
+let path_name =
+  if Option.is_some (Sys.getenv_opt "FE_TEST_DAEMON") then
+    "daemon"
+  else if Option.is_some (Sys.getenv_opt "FE_TEST_SPAWN_SERVER") then
+    "spawn-server"
+  else
+    "vfork"
+
+(* Keep [mb] megabytes of touched memory alive while running [f] *)
+let with_rss mb f =
+  let size = mb * 1024 * 1024 in
+  let mem = Bigarray.(Array1.create char c_layout size) in
+  Bigarray.Array1.fill mem '\001' ;
+  Fun.protect f ~finally:(fun () -> ignore (Sys.opaque_identity mem))
+
+(* Keep [n] file descriptors open, in addition to the standard ones, while
+   running [f] *)
+let with_open_fds n f =
+  let fds = ref [] in
+  Fun.protect
+    (fun () ->
+      for _ = 1 to n do
+        fds := Unix.openfile "/dev/null" [Unix.O_RDONLY] 0 :: !fds
+      done ;
+      f ()
+    )
+    ~finally:(fun () -> List.iter Unix.close !fds)
+
+let spawn c =
+  let syslog_stdout =
+    if c.syslog then Forkhelpers.Syslog_DefaultKey else Forkhelpers.NoSyslogging
+  in
+  let start = Mtime_clock.counter () in
+  let pid =
+    if c.mappings then
+      let fd = Unix.openfile "/dev/null" [Unix.O_RDONLY] 0 in
+      Fun.protect
+        (fun () ->
+          Forkhelpers.safe_close_and_exec None None None
+            [("fd-mapping", fd)]
+            ~syslog_stdout cmd ["fd-mapping"]
+        )
+        ~finally:(fun () -> Unix.close fd)
+    else
+      Forkhelpers.safe_close_and_exec None None None [] ~syslog_stdout cmd []
+  in
+  let exec = Mtime_clock.count start in
+  Forkhelpers.waitpid_fail_if_bad_exit pid ;
+  (exec, Mtime_clock.count start)
+
+(* Run [iterations] spawns split between [c.concurrency] threads *)
+let measure ~iterations c =
+  let per_thread = max 1 (iterations / c.concurrency) in
+  let results = Array.make c.concurrency [] in
+  let worker i =
+    for _ = 1 to per_thread do
+      results.(i) <- spawn c :: results.(i)
+    done
+  in
+  let threads = List.init c.concurrency (Thread.create worker) in
+  List.iter Thread.join threads ;
+  Array.to_list results |> List.concat
+
+let percentile sorted p =
+  let n = Array.length sorted in
+  sorted.(min (n - 1) (p * n / 100))
+
+let summary samples =
+  let sorted = Array.of_list (List.map Mtime.Span.to_uint64_ns samples) in
+  Array.sort Int64.compare sorted ;
+  let us x = Int64.(to_float x /. 1000.) in
+  Printf.sprintf "%9.1f %9.1f %9.1f %9.1f"
+    (us (percentile sorted 50))
+    (us (percentile sorted 90))
+    (us (percentile sorted 99))
+    (us sorted.(Array.length sorted - 1))
+
+let run ~iterations name value c =
+  let label = Printf.sprintf "%-12s %-12s %-11s" path_name name value in
+  match
+    with_rss c.rss_mb (fun () ->
+        with_open_fds c.open_fds (fun () -> measure ~iterations c)
+    )
+  with
+  | samples ->
+      let exec, exit = List.split samples in
+      Printf.printf "%s %-5s %6d %s\n%s %-5s %6d %s\n%!" label "exec"
+        (List.length samples) (summary exec) label "exit"
+        (List.length samples) (summary exit)
+  | exception e ->
+      Printf.printf "%s skipped: %s\n%!" label (Printexc.to_string e)
+
+let ints s = String.split_on_char ',' s |> List.map int_of_string
+
+let () =
+  let iterations = ref 1000 in
+  let rss = ref [100; 1024; 4096] in
+  let fds = ref [10; 1000; 10000] in
+  let concurrency = ref [1; 2; 4; 8; 16; 32; 64] in
+  let set r = Arg.String (fun s -> r := ints s) in
+  Arg.parse
+    [
+      ("-n", Arg.Set_int iterations, "spawns per condition (default 1000)")
+    ; ("-rss", set rss, "parent RSS in MB, comma separated")
+    ; ("-fds", set fds, "open fds in the parent, comma separated")
+    ; ("-concurrency", set concurrency, "concurrent callers, comma separated")
+    ]
+    (fun _ -> raise (Arg.Bad "unexpected argument"))
+    "fe_bench.exe [options]: spawn latency of /bin/true in microseconds" ;
+  let iterations = !iterations in
+  Printf.printf "%-12s %-12s %-11s %-5s %6s %9s %9s %9s %9s\n" "path"
+    "condition" "value" "phase" "n" "p50" "p90" "p99" "max" ;
+  let run = run ~iterations in
+  run "baseline" "-" baseline ;
+  run "mappings" "1" {baseline with mappings= true} ;
+  run "syslog" "default" {baseline with syslog= true} ;
+  List.iter
+    (fun mb -> run "rss" (Printf.sprintf "%dMB" mb) {baseline with rss_mb= mb})
+    !rss ;
+  List.iter
+    (fun n -> run "open_fds" (string_of_int n) {baseline with open_fds= n})
+    !fds ;
+  List.iter
+    (fun n -> run "concurrency" (string_of_int n) {baseline with concurrency= n})
+    !concurrency
@@ -0,0 +1,38 @@
+#!/bin/sh
+
+# Spawn latency of the vfork helper, the spawn server and the forkexecd daemon.
+# Extra arguments are passed to fe_bench.exe, see "fe_bench.exe -help".
+
+# Use user-writable directories
+export TMPDIR=${TMPDIR:-/tmp}
+export XDG_RUNTIME_DIR=${XDG_RUNTIME_DIR:-$TMPDIR}
+export FE_TEST=1
+
+# Allow the largest number of open fds measured
+ulimit -n 16384 2>/dev/null || ulimit -n "$(ulimit -Hn)"
+
+SOCKET=${XDG_RUNTIME_DIR}/xapi/forker/main
+rm -f "$SOCKET"
+
+LD_PRELOAD="$PWD/syslog.so" \
+TEST_VFORK_HELPER="$PWD/../vfork_helper" \
+../src/fe_main.exe &
+MAIN=$!
+cleanup () {
+    kill $MAIN
+}
+trap cleanup EXIT INT
+for _ in $(seq 1 10); do
+    test -S ${SOCKET} || sleep 1
+done
+LD_PRELOAD="$PWD/syslog.so" \
+TEST_VFORK_HELPER="$PWD/../vfork_helper" \
+./fe_bench.exe "$@"
+LD_PRELOAD="$PWD/syslog.so" \
+TEST_VFORK_HELPER="$PWD/../vfork_helper" \
+FE_TEST_SPAWN_SERVER=1 \
+./fe_bench.exe "$@"
+LD_PRELOAD="$PWD/syslog.so" \
+TEST_VFORK_HELPER="$PWD/../vfork_helper" \
+FE_TEST_DAEMON=1 \
+./fe_bench.exe "$@"
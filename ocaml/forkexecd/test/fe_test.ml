@@ -207,6 +207,100 @@ let test_output () =
   expect expected_err err ;
   print_endline "Completed output tests"
 
+let test_output_capped () =
+  let expected_out = String.make 10000 'o' in
+  let expected_err = "error string" in
+  let args = ["echo"; expected_out; expected_err] in
+  (* stderr, with its newline, fits exactly *)
+  let max_output = String.length expected_err + 1 in
+  let (out, out_truncated), (err, err_truncated) =
+    Forkhelpers.execute_command_get_output_capped ~max_output exe args
+  in
+  if out <> String.sub expected_out 0 max_output || not out_truncated then
+    fail "output of %d bytes (truncated %b) expected %d bytes truncated"
+      (String.length out) out_truncated max_output ;
+  if err_truncated then
+    fail "error output truncated" ;
+  expect expected_err err ;
+  print_endline "Completed capped output tests"
+
+(* Writes past the cap, rounded up to 64 KiB, fail so the command does *)
+let test_output_bounded () =
+  let max_output = 10 in
+  let commands =
+    [
+      (exe, ["echo"; "0123456789abc"; "err"])
+    ; (exe, ["echo"; String.make 100_000 'o'; "err"])
+    ]
+  in
+  ( match Forkhelpers.execute_commands_get_output ~max_output commands with
+  | [
+   Ok (("0123456789", true), ("err\n", false))
+  ; Error (Forkhelpers.Spawn_internal_error (_, "oooooooooo", Unix.WEXITED n))
+  ]
+    when n <> 0 ->
+      ()
+  | _ ->
+      fail "unexpected results for commands with capped output"
+  ) ;
+  print_endline "Completed bounded output tests"
+
+let test_batch () =
+  let commands =
+    List.init 20 (fun i ->
+        if i = 7 then
+          ("/bin/false", [])
+        else
+          (exe, ["echo"; Printf.sprintf "out %d" i; Printf.sprintf "err %d" i])
+    )
+  in
+  let results =
+    Forkhelpers.execute_commands_get_output ~max_concurrency:6 commands
+  in
+  List.iteri
+    (fun i res ->
+      match res with
+      | Ok ((out, false), (err, false)) when i <> 7 ->
+          expect (Printf.sprintf "out %d" i) out ;
+          expect (Printf.sprintf "err %d" i) err
+      | Error (Forkhelpers.Spawn_internal_error (_, _, Unix.WEXITED 1))
+        when i = 7 ->
+          ()
+      | _ ->
+          fail "unexpected result for command %d" i
+    )
+    results ;
+  print_endline "Completed batch tests"
+
+let test_batch_timeout () =
+  let start = Mtime_clock.counter () in
+  let commands =
+    [(exe, ["sleep"]); (exe, ["echo"; "out"; "err"]); (exe, ["sleep"])]
+  in
+  let timeout = Mtime.Span.(700 * ms) in
+  let results = Forkhelpers.execute_commands_get_output ~timeout commands in
+  ( match results with
+  | [
+   Error Forkhelpers.Subprocess_timeout
+  ; Ok ((out, _), (err, _))
+  ; Error Forkhelpers.Subprocess_timeout
+  ] ->
+      expect "out" out ; expect "err" err
+  | _ ->
+      fail "unexpected results for commands with timeout"
+  ) ;
+  (* the sleeps run at the same time, they are killed together *)
+  let elapsed = Mtime_clock.count start in
+  ( match in_range ~e:Mtime.Span.(200 * ms) ~around:timeout elapsed with
+  | In_range ->
+      ()
+  | Shorter ->
+      fail "Commands killed too soon"
+  | Longer ->
+      fail "Commands killed too late"
+  ) ;
+  print_endline "Completed batch timeout tests"
+
 let test_input () =
   let input = "input string" in
   let args = ["replay"] in
@@ -338,7 +432,11 @@ let master fds =
   test_exitcode () ;
   Printf.printf "\nPerforming input/output tests\n%!" ;
   test_output () ;
+  test_output_capped () ;
+  test_output_bounded () ;
   test_input () ;
+  test_batch () ;
+  test_batch_timeout () ;
   Printf.printf "\nPerforming internal failure test\n%!" ;
   test_internal_failure_error () ;
   Printf.printf "\nPerforming syslog tests\n%!" ;
@@ -22,3 +22,11 @@ done
 echo "" | LD_PRELOAD="$PWD/syslog.so" \
 TEST_VFORK_HELPER="$PWD/../vfork_helper" \
 ./fe_test.exe 16
+echo "" | LD_PRELOAD="$PWD/syslog.so" \
+TEST_VFORK_HELPER="$PWD/../vfork_helper" \
+FE_TEST_SPAWN_SERVER=1 \
+./fe_test.exe 16
+echo "" | LD_PRELOAD="$PWD/syslog.so" \
+TEST_VFORK_HELPER="$PWD/../vfork_helper" \
+FE_TEST_SYSLOG_FORWARDER=1 \
+./fe_test.exe 16
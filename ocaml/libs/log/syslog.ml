@@ -41,8 +41,86 @@ external log : facility -> level -> string -> unit = "stub_syslog"
 
 external close : unit -> unit = "stub_closelog"
 
+module Async = struct
+  type overflow = Drop_oldest | Block | Drop
+
+  type stats = {
+      queued: int
+    ; enqueued: int
+    ; written: int
+    ; dropped: int
+    ; refused: int
+  }
+
+  external start : int -> overflow -> unit = "stub_syslog_async_start"
+
+  external stop : unit -> unit = "stub_syslog_async_stop"
+
+  (* Write queued messages and pending filter summaries on exit *)
+  let stop_at_exit = lazy (at_exit stop)
+
+  let start ?(capacity = 1024) ?(overflow = Drop_oldest) () =
+    Lazy.force stop_at_exit ; start capacity overflow
+
+  external set_overflow : overflow -> unit = "stub_syslog_async_set_overflow"
+
+  external stats : unit -> int * int * int * int * int
+    = "stub_syslog_async_stats"
+
+  let stats () =
+    let queued, enqueued, written, dropped, refused = stats () in
+    {queued; enqueued; written; dropped; refused}
+
+  exception Unknown_overflow of string
+
+  let overflow_of_string s =
+    match String.lowercase_ascii s with
+    | "drop-oldest" ->
+        Drop_oldest
+    | "block" ->
+        Block
+    | "drop" ->
+        Drop
+    | _ ->
+        raise (Unknown_overflow s)
+
+  let string_of_overflow = function
+    | Drop_oldest ->
+        "drop-oldest"
+    | Block ->
+        "block"
+    | Drop ->
+        "drop"
+end
+
 exception Unknown_facility of string
 
+let all_facilities =
+  [
+    Auth
+  ; Authpriv
+  ; Cron
+  ; Daemon
+  ; Ftp
+  ; Kern
+  ; Local0
+  ; Local1
+  ; Local2
+  ; Local3
+  ; Local4
+  ; Local5
+  ; Local6
+  ; Local7
+  ; Lpr
+  ; Mail
+  ; News
+  ; Syslog
+  ; User
+  ; Uucp
+  ]
+
+let all_levels = [Emerg; Alert; Crit; Err; Warning; Notice; Info; Debug]
+
 let facility_of_string s =
   match s with
   | "auth" ->
@@ -129,6 +207,89 @@ let string_of_level = function
   | Debug ->
       "debug"
 
+module Filter = struct
+  type stats = {deduplicated: int; rate_limited: int}
+
+  external set_dedup : int -> unit = "stub_syslog_filter_set_dedup"
+
+  let ms_of_s s = int_of_float (s *. 1000.)
+
+  let set_dedup ~interval =
+    Lazy.force Async.stop_at_exit ;
+    set_dedup (ms_of_s interval)
+
+  let disable_dedup () = set_dedup ~interval:0.
+
+  external set_rate_limit : facility -> level -> int -> int -> unit
+    = "stub_syslog_filter_set_rate_limit"
+
+  let set_rate_limit ?facility ?level ~burst ~interval () =
+    Lazy.force Async.stop_at_exit ;
+    let all_or x all = Option.fold ~none:all ~some:(fun x -> [x]) x in
+    List.iter
+      (fun f ->
+        List.iter
+          (fun l -> set_rate_limit f l burst (ms_of_s interval))
+          (all_or level all_levels)
+      )
+      (all_or facility all_facilities)
+
+  exception Invalid_rate_limit of string
+
+  let set_rate_limits_of_string s =
+    let parse_rule rule =
+      let invalid () = raise (Invalid_rate_limit rule) in
+      match String.split_on_char '=' rule with
+      | [selector; limit] -> (
+          let facility, level =
+            match String.split_on_char '.' selector with
+            | [f] ->
+                (f, "*")
+            | [f; l] ->
+                (f, l)
+            | _ ->
+                invalid ()
+          in
+          let some_unless_star conv = function
+            | "*" ->
+                None
+            | x -> (
+              try Some (conv x) with _ -> invalid ()
+            )
+          in
+          let facility = some_unless_star facility_of_string facility in
+          let level = some_unless_star level_of_string level in
+          match String.split_on_char '/' limit with
+          | [burst; interval] -> (
+            match (int_of_string_opt burst, float_of_string_opt interval) with
+            | Some burst, Some interval when burst >= 0 && interval > 0. ->
+                (facility, level, burst, interval)
+            | _ ->
+                invalid ()
+          )
+          | _ ->
+              invalid ()
+        )
+      | _ ->
+          invalid ()
+    in
+    (* parse everything before changing anything *)
+    String.split_on_char ' ' s
+    |> List.filter (fun x -> x <> "")
+    |> List.map parse_rule
+    |> List.iter (fun (facility, level, burst, interval) ->
+           set_rate_limit ?facility ?level ~burst ~interval ()
+       )
+
+  external flush : unit -> unit = "stub_syslog_filter_flush"
+
+  external stats : unit -> int * int = "stub_syslog_filter_stats"
+
+  let stats () =
+    let deduplicated, rate_limited = stats () in
+    {deduplicated; rate_limited}
+end
+
 let is_masked ~threshold level =
   (* This comparison relies on the order in which the constructors in level are
      declared *)
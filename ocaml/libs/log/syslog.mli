@@ -40,6 +40,51 @@ external log : facility -> level -> string -> unit = "stub_syslog"
 
 external close : unit -> unit = "stub_closelog"
 
+(** Asynchronous writer.
+    Once started, messages passed to {!log} are copied into a bounded
+    queue and sent to /dev/log in batches by a dedicated native thread,
+    the caller does not wait for the write. Messages too long to be queued
+    are still written synchronously. *)
+module Async : sig
+  (** What to do when the queue is full *)
+  type overflow =
+    | Drop_oldest  (** Discard the oldest queued message *)
+    | Block  (** Wait for the writer to make space *)
+    | Drop  (** Discard the new message *)
+
+  type stats = {
+      queued: int  (** Messages currently in the queue *)
+    ; enqueued: int  (** Messages queued since start *)
+    ; written: int  (** Messages sent to syslog *)
+    ; dropped: int  (** Messages discarded due to overflow *)
+    ; refused: int  (** Messages syslog refused *)
+  }
+
+  val start : ?capacity:int -> ?overflow:overflow -> unit -> unit
+  (** [start ?capacity ?overflow ()] starts the writer thread with a queue of
+      at least [capacity] messages (1024 by default). If the writer is
+      already running only the overflow policy is changed.
+      The writer does not survive a fork, the child process falls back to
+      synchronous writes. *)
+
+  val stop : unit -> unit
+  (** Stops the writer thread after writing the pending {!Filter} summaries
+      and flushing the queue. {!close} stops the writer too. It is called at
+      exit once the writer has been started or a filter enabled. *)
+
+  val set_overflow : overflow -> unit
+
+  val stats : unit -> stats
+
+  exception Unknown_overflow of string
+
+  val overflow_of_string : string -> overflow
+  (** Accepts "drop-oldest", "block" and "drop".
+      @raise Unknown_overflow if the policy is unrecognized. *)
+
+  val string_of_overflow : overflow -> string
+end
+
 val facility_of_string : string -> facility
 (** [facility_of_string facility] Return the Syslog facility corresponding to
     [facility]. Raises [Unknown_facility facility] if facility is unrecognized. *)
@@ -52,6 +97,53 @@ val string_of_level : level -> string
 (** [string_of_level level] Return the string corresponding to the Syslog level
     [level] *)
 
+(** Deduplication and rate limiting of messages passed to {!log}.
+    Both are disabled by default.
+    Messages are compared ignoring the leading "[...]" header added by
+    {!Debug}, which contains thread and task information. *)
+module Filter : sig
+  type stats = {
+      deduplicated: int  (** Repeated messages suppressed *)
+    ; rate_limited: int  (** Messages suppressed by rate limiting *)
+  }
+
+  val set_dedup : interval:float -> unit
+  (** Suppress messages identical to the previous one of the same facility.
+      A "last message repeated N times" summary is written before the next
+      different message, or every [interval] seconds while the repetition
+      continues. *)
+
+  val disable_dedup : unit -> unit
+
+  val set_rate_limit :
+       ?facility:facility
+    -> ?level:level
+    -> burst:int
+    -> interval:float
+    -> unit
+    -> unit
+  (** [set_rate_limit ?facility ?level ~burst ~interval ()] allows at most
+      [burst] identical messages every [interval] seconds for the given
+      [facility] and [level], all of them if omitted. The number of messages
+      suppressed is reported when the next interval starts. A [burst] of 0
+      disables rate limiting. *)
+
+  exception Invalid_rate_limit of string
+
+  val set_rate_limits_of_string : string -> unit
+  (** Set rate limits from a space separated list of
+      [FACILITY[.LEVEL]=BURST/INTERVAL] rules, where [FACILITY] and [LEVEL]
+      can be "*", for instance "*=1000/1 local5.debug=100/1".
+      Rules are applied in order.
+      @raise Invalid_rate_limit if a rule is not valid, nothing is changed in
+      this case. *)
+
+  val flush : unit -> unit
+  (** Write the summaries of all currently suppressed messages. *)
+
+  val stats : unit -> stats
+end
+
 val is_masked : threshold:level -> level -> bool
 (** [is_masked ~threshold level] Return true if [level] is below [threshold] and
     should therefore not be logged. *)
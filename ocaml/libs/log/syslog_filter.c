@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2025 Cloud Software Group
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "syslog_filter.h"
+
+// Number of rate limiting buckets, keys are hashed directly into them
+#define RATE_BUCKETS 512
+// Length of message sample reported in rate limiting summaries
+#define SAMPLE_MAX 128
+// Maximum header length skipped computing keys
+#define HEADER_MAX 512
+
+typedef struct dedup_state {
+	bool valid;
+	int level;
+	uint64_t hash;
+	size_t len;
+	uint64_t repeated;
+	uint64_t since_ms;
+} dedup_state;
+
+typedef struct rate_limit {
+	unsigned burst;
+	uint64_t interval_ms;
+} rate_limit;
+
+typedef struct rate_bucket {
+	bool used;
+	int facility, level;
+	uint64_t key;
+	uint64_t window_ms;
+	unsigned count;
+	uint64_t suppressed;
+	char sample[SAMPLE_MAX];
+} rate_bucket;
+
+static struct {
+	pthread_mutex_t mtx;
+	// set if any filter is enabled, checked without lock
+	bool enabled;
+	uint64_t dedup_interval_ms;
+	rate_limit limits[SYSLOG_FILTER_FACILITIES][SYSLOG_FILTER_LEVELS];
+	dedup_state dedup[SYSLOG_FILTER_FACILITIES];
+	rate_bucket buckets[RATE_BUCKETS];
+	// first time a rate limiting summary could be due
+	uint64_t next_summary_ms;
+	syslog_filter_stats stats;
+} f = {
+	.mtx = PTHREAD_MUTEX_INITIALIZER,
+	.next_summary_ms = UINT64_MAX,
+};
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000u + ts.tv_nsec / 1000000u;
+}
+
+// FNV-1a
+static uint64_t hash_bytes(uint64_t h, const char *p, size_t len)
+{
+	while (len--) {
+		h ^= (unsigned char) *p++;
+		h *= UINT64_C(0x100000001b3);
+	}
+	return h;
+}
+
+static uint64_t hash_message(int facility, int level, const char *msg,
+			     size_t len)
+{
+	uint64_t h = UINT64_C(0xcbf29ce484222325);
+
+	h = hash_bytes(h, (const char *) &facility, sizeof(facility));
+	h = hash_bytes(h, (const char *) &level, sizeof(level));
+	return hash_bytes(h, msg, len);
+}
+
+// Skip "[...] " header added by Debug
+static const char *skip_header(const char *msg, size_t *len)
+{
+	size_t max = *len < HEADER_MAX ? *len : HEADER_MAX;
+	const char *p;
+
+	if (!max || msg[0] != '[')
+		return msg;
+	for (p = msg; p + 1 < msg + max; ++p) {
+		if (p[0] == ']' && p[1] == ' ') {
+			p += 2;
+			*len -= p - msg;
+			return p;
+		}
+	}
+	return msg;
+}
+
+static void update_enabled(void)
+{
+	bool enabled = f.dedup_interval_ms != 0;
+
+	for (int i = 0; i < SYSLOG_FILTER_FACILITIES; ++i)
+		for (int j = 0; j < SYSLOG_FILTER_LEVELS; ++j)
+			enabled = enabled || f.limits[i][j].burst != 0;
+	__atomic_store_n(&f.enabled, enabled, __ATOMIC_RELAXED);
+}
+
+static syslog_summary *add_summary(syslog_filter_result *res, int facility,
+				   int level)
+{
+	syslog_summary *s;
+
+	if (res->num_summaries >= SYSLOG_MAX_SUMMARIES)
+		return NULL;
+	s = &res->summaries[res->num_summaries++];
+	s->facility = facility;
+	s->level = level;
+	return s;
+}
+
+static bool dedup_summary(syslog_filter_result *res, int facility,
+			  dedup_state *d, uint64_t now)
+{
+	syslog_summary *s = add_summary(res, facility, d->level);
+
+	if (!s)
+		return false;
+	snprintf(s->text, sizeof(s->text), "last message repeated %llu times",
+		 (unsigned long long) d->repeated);
+	d->repeated = 0;
+	d->since_ms = now;
+	return true;
+}
+
+static bool rate_summary(syslog_filter_result *res, rate_bucket *b)
+{
+	syslog_summary *s = add_summary(res, b->facility, b->level);
+
+	if (!s)
+		return false;
+	snprintf(s->text, sizeof(s->text),
+		 "%llu similar messages suppressed by rate limiting, last: %s",
+		 (unsigned long long) b->suppressed, b->sample);
+	b->suppressed = 0;
+	return true;
+}
+
+// Report suppressed messages of expired windows.
+// If "all" is set report all of them.
+static void rate_summaries(syslog_filter_result *res, uint64_t now, bool all)
+{
+	uint64_t next = UINT64_MAX;
+
+	for (unsigned i = 0; i < RATE_BUCKETS; ++i) {
+		rate_bucket *b = &f.buckets[i];
+		if (!b->used || !b->suppressed)
+			continue;
+
+		uint64_t end = b->window_ms
+			+ f.limits[b->facility][b->level].interval_ms;
+		if (all || now >= end) {
+			if (!rate_summary(res, b)) {
+				// no space, try again next message
+				next = now;
+				break;
+			}
+			b->window_ms = now;
+			b->count = 0;
+		} else if (end < next) {
+			next = end;
+		}
+	}
+	f.next_summary_ms = next;
+}
+
+// Returns whether the message is a repetition
+static bool dedup(int facility, int level, const char *body, size_t len,
+		  uint64_t now, syslog_filter_result *res)
+{
+	dedup_state *d = &f.dedup[facility];
+	uint64_t h = hash_message(facility, level, body, len);
+
+	if (d->valid && d->hash == h && d->len == len && d->level == level) {
+		++d->repeated;
+		++f.stats.deduplicated;
+		if (now - d->since_ms >= f.dedup_interval_ms)
+			dedup_summary(res, facility, d, now);
+		return true;
+	}
+
+	if (d->valid && d->repeated)
+		dedup_summary(res, facility, d, now);
+	d->valid = true;
+	d->level = level;
+	d->hash = h;
+	d->len = len;
+	d->repeated = 0;
+	d->since_ms = now;
+	return false;
+}
+
+// Returns whether the message exceeds the rate
+static bool rate_limited(int facility, int level, const char *body,
+			 size_t len, uint64_t now, syslog_filter_result *res)
+{
+	const rate_limit *limit = &f.limits[facility][level];
+	uint64_t key = hash_message(facility, level, body, len);
+	rate_bucket *b = &f.buckets[key % RATE_BUCKETS];
+
+	if (!b->used || b->key != key) {
+		if (b->used && b->suppressed)
+			rate_summary(res, b);
+		b->used = true;
+		b->facility = facility;
+		b->level = level;
+		b->key = key;
+		b->window_ms = now;
+		b->count = 0;
+		b->suppressed = 0;
+	}
+
+	if (now - b->window_ms >= limit->interval_ms) {
+		if (b->suppressed)
+			rate_summary(res, b);
+		b->window_ms = now;
+		b->count = 0;
+	}
+
+	if (b->count < limit->burst) {
+		++b->count;
+		return false;
+	}
+
+	if (!b->suppressed++) {
+		uint64_t end = b->window_ms + limit->interval_ms;
+		if (end < f.next_summary_ms)
+			f.next_summary_ms = end;
+	}
+	snprintf(b->sample, sizeof(b->sample), "%.*s",
+		 (int) (len < SAMPLE_MAX ? len : SAMPLE_MAX - 1), body);
+	++f.stats.rate_limited;
+	return true;
+}
+
+void syslog_filter_set_dedup(uint64_t interval_ms)
+{
+	pthread_mutex_lock(&f.mtx);
+	f.dedup_interval_ms = interval_ms;
+	update_enabled();
+	pthread_mutex_unlock(&f.mtx);
+}
+
+void syslog_filter_set_rate_limit(int facility, int level, unsigned burst,
+				  uint64_t interval_ms)
+{
+	pthread_mutex_lock(&f.mtx);
+	f.limits[facility][level].burst = burst;
+	f.limits[facility][level].interval_ms = interval_ms;
+	update_enabled();
+	pthread_mutex_unlock(&f.mtx);
+}
+
+void syslog_filter(int facility, int level, const char *msg, size_t len,
+		   syslog_filter_result *res)
+{
+	const char *body;
+	uint64_t now;
+
+	res->emit = true;
+	res->num_summaries = 0;
+	if (!__atomic_load_n(&f.enabled, __ATOMIC_RELAXED))
+		return;
+
+	len = strnlen(msg, len);
+	body = skip_header(msg, &len);
+	now = now_ms();
+
+	pthread_mutex_lock(&f.mtx);
+	if (now >= f.next_summary_ms)
+		rate_summaries(res, now, false);
+	if (f.dedup_interval_ms && dedup(facility, level, body, len, now, res))
+		res->emit = false;
+	else if (f.limits[facility][level].burst
+		 && rate_limited(facility, level, body, len, now, res))
+		res->emit = false;
+	pthread_mutex_unlock(&f.mtx);
+}
+
+void syslog_filter_flush(syslog_filter_result *res)
+{
+	uint64_t now = now_ms();
+
+	res->emit = false;
+	res->num_summaries = 0;
+
+	pthread_mutex_lock(&f.mtx);
+	for (int i = 0; i < SYSLOG_FILTER_FACILITIES; ++i) {
+		dedup_state *d = &f.dedup[i];
+		if (d->valid && d->repeated && !dedup_summary(res, i, d, now))
+			break;
+	}
+	rate_summaries(res, now, true);
+	pthread_mutex_unlock(&f.mtx);
+}
+
+void syslog_filter_get_stats(syslog_filter_stats *stats)
+{
+	pthread_mutex_lock(&f.mtx);
+	*stats = f.stats;
+	pthread_mutex_unlock(&f.mtx);
+}
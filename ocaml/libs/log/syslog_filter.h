@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2025 Cloud Software Group
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Deduplication and rate limiting of log messages.
+//
+// Deduplication suppresses a message identical to the previous one sent
+// to the same facility; a "last message repeated N times" summary is
+// emitted before the next different message or periodically.
+//
+// Rate limiting allows a burst of messages with the same key in an
+// interval, further messages are suppressed and summarised once the
+// interval expires. The key is composed by facility, level and message
+// text, skipping the "[...]" header added by Debug which contains
+// thread and task information.
+
+#define SYSLOG_FILTER_FACILITIES 20
+#define SYSLOG_FILTER_LEVELS 8
+#define SYSLOG_SUMMARY_MAX 256
+// Maximum number of summaries returned by a single syslog_filter call
+#define SYSLOG_MAX_SUMMARIES 4
+
+typedef struct syslog_summary {
+	int facility, level;
+	char text[SYSLOG_SUMMARY_MAX];
+} syslog_summary;
+
+typedef struct syslog_filter_result {
+	// whether the message should be written
+	bool emit;
+	// summaries to write before the message
+	unsigned num_summaries;
+	syslog_summary summaries[SYSLOG_MAX_SUMMARIES];
+} syslog_filter_result;
+
+typedef struct syslog_filter_stats {
+	uint64_t deduplicated;
+	uint64_t rate_limited;
+} syslog_filter_stats;
+
+// Enable deduplication, "interval_ms" is the maximum time a repetition
+// is not reported. 0 disables deduplication.
+void syslog_filter_set_dedup(uint64_t interval_ms);
+
+// Set rate limit for a facility and level. A "burst" of 0 disables
+// rate limiting.
+void syslog_filter_set_rate_limit(int facility, int level, unsigned burst,
+				  uint64_t interval_ms);
+
+// Filter a message. Facility and level are indexes in the OCaml types.
+void syslog_filter(int facility, int level, const char *msg, size_t len,
+		   syslog_filter_result *res);
+
+// Report all pending summaries, up to SYSLOG_MAX_SUMMARIES.
+void syslog_filter_flush(syslog_filter_result *res);
+
+void syslog_filter_get_stats(syslog_filter_stats *stats);
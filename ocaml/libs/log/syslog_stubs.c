@@ -13,12 +13,17 @@
  */
 
 #include <syslog.h>
+#include <stdlib.h>
 #include <string.h>
 #include <caml/mlvalues.h>
 #include <caml/memory.h>
 #include <caml/alloc.h>
 #include <caml/custom.h>
 #include <caml/threads.h>
+#include <caml/unixsupport.h>
+
+#include "syslog_writer.h"
+#include "syslog_filter.h"
 
 static int syslog_level_table[] = {
 	LOG_EMERG, LOG_ALERT, LOG_CRIT, LOG_ERR, LOG_WARNING,
@@ -50,24 +55,169 @@ value stub_openlog(value ident, value option, value facility)
 }
 */
 
-value stub_syslog(value facility, value level, value msg)
+static inline int syslog_priority(int facility, int level)
 {
-	CAMLparam3(facility, level, msg);
-	char *c_msg = strdup(String_val(msg));
-	int c_facility = syslog_facility_table[Int_val(facility)]
-	               | syslog_level_table[Int_val(level)];
+	return syslog_facility_table[facility] | syslog_level_table[level];
+}
 
+// Write a message to syslog, either queueing it or synchronously.
+// If "v_msg" is not NULL it's a registered root to the OCaml string
+// containing the message, which can be moved by the GC while the
+// runtime lock is released, otherwise "c_msg" is used.
+static void write_log(int priority, const value *v_msg, const char *c_msg,
+		      size_t len)
+{
+	for (;;) {
+		if (v_msg)
+			c_msg = String_val(*v_msg);
+		switch (syslog_writer_enqueue(priority, c_msg, len)) {
+		case SYSLOG_ENQUEUED:
+		case SYSLOG_DROPPED:
+			return;
+		case SYSLOG_FULL:
+			caml_release_runtime_system();
+			syslog_writer_wait_space();
+			caml_acquire_runtime_system();
+			continue;
+		case SYSLOG_NOT_QUEUED:
+			break;
+		}
+		break;
+	}
+
+	char *msg = strndup(c_msg, len);
 	caml_release_runtime_system();
-	syslog(c_facility, "%s", c_msg);
-	free(c_msg);
+	if (msg)
+		syslog(priority, "%s", msg);
+	free(msg);
 	caml_acquire_runtime_system();
+}
+
+static void write_summaries(const syslog_filter_result *res)
+{
+	for (unsigned i = 0; i < res->num_summaries; ++i) {
+		const syslog_summary *s = &res->summaries[i];
+		write_log(syslog_priority(s->facility, s->level), NULL,
+			  s->text, strlen(s->text));
+	}
+}
+
+value stub_syslog(value facility, value level, value msg)
+{
+	CAMLparam3(facility, level, msg);
+	syslog_filter_result res;
+
+	syslog_filter(Int_val(facility), Int_val(level), String_val(msg),
+		      caml_string_length(msg), &res);
+	write_summaries(&res);
+	if (res.emit)
+		write_log(syslog_priority(Int_val(facility), Int_val(level)),
+			  &msg, NULL, caml_string_length(msg));
 
 	CAMLreturn(Val_unit);
 }
 
+// Write all pending deduplication and rate limiting summaries
+static void flush_summaries(void)
+{
+	syslog_filter_result res;
+
+	do {
+		syslog_filter_flush(&res);
+		write_summaries(&res);
+	} while (res.num_summaries == SYSLOG_MAX_SUMMARIES);
+}
+
 value stub_closelog(value unit)
 {
 	CAMLparam1(unit);
+	flush_summaries();
+	syslog_writer_stop();
 	closelog();
 	CAMLreturn(Val_unit);
 }
+
+static syslog_overflow syslog_overflow_table[] = {
+	SYSLOG_OVERFLOW_DROP_OLDEST, SYSLOG_OVERFLOW_BLOCK, SYSLOG_OVERFLOW_DROP
+};
+
+value stub_syslog_async_start(value capacity, value overflow)
+{
+	CAMLparam2(capacity, overflow);
+	int err;
+
+	if (Long_val(capacity) <= 0)
+		caml_invalid_argument("Syslog.Async.start");
+	err = syslog_writer_start(Long_val(capacity),
+				  syslog_overflow_table[Int_val(overflow)]);
+	if (err)
+		unix_error(err, "syslog_writer_start", Nothing);
+	CAMLreturn(Val_unit);
+}
+
+value stub_syslog_async_stop(value unit)
+{
+	CAMLparam1(unit);
+	flush_summaries();
+	syslog_writer_stop();
+	CAMLreturn(Val_unit);
+}
+
+value stub_syslog_async_set_overflow(value overflow)
+{
+	CAMLparam1(overflow);
+	syslog_writer_set_overflow(syslog_overflow_table[Int_val(overflow)]);
+	CAMLreturn(Val_unit);
+}
+
+value stub_syslog_filter_set_dedup(value interval_ms)
+{
+	CAMLparam1(interval_ms);
+	syslog_filter_set_dedup(Long_val(interval_ms));
+	CAMLreturn(Val_unit);
+}
+
+value stub_syslog_filter_set_rate_limit(value facility, value level,
+					value burst, value interval_ms)
+{
+	CAMLparam4(facility, level, burst, interval_ms);
+	syslog_filter_set_rate_limit(Int_val(facility), Int_val(level),
+				     Long_val(burst), Long_val(interval_ms));
+	CAMLreturn(Val_unit);
+}
+
+value stub_syslog_filter_flush(value unit)
+{
+	CAMLparam1(unit);
+	flush_summaries();
+	CAMLreturn(Val_unit);
+}
+
+value stub_syslog_filter_stats(value unit)
+{
+	CAMLparam1(unit);
+	CAMLlocal1(res);
+	syslog_filter_stats stats;
+
+	syslog_filter_get_stats(&stats);
+	res = caml_alloc_tuple(2);
+	Store_field(res, 0, Val_long(stats.deduplicated));
+	Store_field(res, 1, Val_long(stats.rate_limited));
+	CAMLreturn(res);
+}
+
+value stub_syslog_async_stats(value unit)
+{
+	CAMLparam1(unit);
+	CAMLlocal1(res);
+	syslog_writer_stats stats;
+
+	syslog_writer_get_stats(&stats);
+	res = caml_alloc_tuple(5);
+	Store_field(res, 0, Val_long(stats.queued));
+	Store_field(res, 1, Val_long(stats.enqueued));
+	Store_field(res, 2, Val_long(stats.written));
+	Store_field(res, 3, Val_long(stats.dropped));
+	Store_field(res, 4, Val_long(stats.refused));
+	CAMLreturn(res);
+}
@@ -0,0 +1,445 @@
+/*
+ * Copyright (C) 2025 Cloud Software Group
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <paths.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "syslog_writer.h"
+
+// Maximum message length queued, longer messages are written synchronously
+#define MSG_MAX 4064
+// Maximum number of messages sent with a single sendmmsg
+#define BATCH 64
+// Space for "<pri>Mmm dd hh:mm:ss ident: "
+#define HEADER_MAX 128
+
+// Slot of the queue.
+// This is a bounded multi producer queue based on sequence numbers, see
+// https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+// Producers can dequeue too to discard old messages.
+typedef struct slot {
+	size_t seq;
+	int priority;
+	uint32_t len;
+	time_t time;
+	char data[MSG_MAX];
+} slot;
+
+typedef struct batch_msg {
+	char header[HEADER_MAX];
+	char data[MSG_MAX];
+} batch_msg;
+
+static struct {
+	// queue, allocated while the writer runs
+	slot *slots;
+	size_t mask;
+	size_t enqueue_pos;
+	size_t dequeue_pos;
+
+	bool running;
+	bool stopping;
+	int overflow;
+
+	pthread_t thread;
+	pthread_mutex_t mtx;
+	// writer waits here for messages
+	pthread_cond_t cond;
+	// producers wait here for space
+	pthread_cond_t space_cond;
+	bool sleeping;
+	unsigned waiters;
+
+	int fd;
+
+	syslog_writer_stats stats;
+} w = {
+	.mtx = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.space_cond = PTHREAD_COND_INITIALIZER,
+	.fd = -1,
+};
+
+#define LOAD(p) __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define STORE(p, v) __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+#define INC(p) __atomic_fetch_add(p, 1, __ATOMIC_RELAXED)
+
+static bool queue_push(int priority, const char *msg, size_t len)
+{
+	size_t pos = LOAD(&w.enqueue_pos);
+	slot *s;
+
+	for (;;) {
+		s = &w.slots[pos & w.mask];
+		intptr_t dif = (intptr_t) LOAD(&s->seq) - (intptr_t) pos;
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&w.enqueue_pos, &pos,
+							pos + 1, true,
+							__ATOMIC_SEQ_CST,
+							__ATOMIC_SEQ_CST))
+				break;
+		} else if (dif < 0) {
+			return false;
+		} else {
+			pos = LOAD(&w.enqueue_pos);
+		}
+	}
+
+	s->priority = priority;
+	s->time = time(NULL);
+	s->len = len;
+	memcpy(s->data, msg, len);
+	STORE(&s->seq, pos + 1);
+	return true;
+}
+
+// Dequeue a message copying it to "out" if not NULL.
+static bool queue_pop(slot *out)
+{
+	size_t pos = LOAD(&w.dequeue_pos);
+	slot *s;
+
+	for (;;) {
+		s = &w.slots[pos & w.mask];
+		intptr_t dif = (intptr_t) LOAD(&s->seq) - (intptr_t) (pos + 1);
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&w.dequeue_pos, &pos,
+							pos + 1, true,
+							__ATOMIC_SEQ_CST,
+							__ATOMIC_SEQ_CST))
+				break;
+		} else if (dif < 0) {
+			return false;
+		} else {
+			pos = LOAD(&w.dequeue_pos);
+		}
+	}
+
+	if (out) {
+		out->priority = s->priority;
+		out->time = s->time;
+		out->len = s->len;
+		memcpy(out->data, s->data, s->len);
+	}
+	STORE(&s->seq, pos + w.mask + 1);
+	return true;
+}
+
+static bool queue_empty(void)
+{
+	size_t pos = LOAD(&w.dequeue_pos);
+
+	return LOAD(&w.slots[pos & w.mask].seq) != pos + 1;
+}
+
+static bool queue_full(void)
+{
+	size_t pos = LOAD(&w.enqueue_pos);
+
+	return LOAD(&w.slots[pos & w.mask].seq) != pos;
+}
+
+static void writer_connect(void)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	if (w.fd >= 0)
+		close(w.fd);
+	w.fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (w.fd < 0)
+		return;
+	strncpy(addr.sun_path, _PATH_LOG, sizeof(addr.sun_path) - 1);
+	if (connect(w.fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		close(w.fd);
+		w.fd = -1;
+	}
+}
+
+// Format header like syslog(3)
+static size_t format_header(char *buf, const slot *msg)
+{
+	struct tm tm;
+	char date[32];
+
+	localtime_r(&msg->time, &tm);
+	strftime(date, sizeof(date), "%h %e %T", &tm);
+	int len = snprintf(buf, HEADER_MAX, "<%d>%s %s: ", msg->priority, date,
+			   program_invocation_short_name);
+	if (len < 0)
+		return 0;
+	return len >= HEADER_MAX ? HEADER_MAX - 1 : (size_t) len;
+}
+
+static void writer_send(struct mmsghdr *msgs, unsigned num)
+{
+	unsigned sent = 0;
+	bool reconnected = false;
+
+	if (w.fd < 0) {
+		writer_connect();
+		reconnected = true;
+	}
+
+	while (sent < num) {
+		int res = w.fd < 0 ? -1 :
+			sendmmsg(w.fd, msgs + sent, num - sent, MSG_NOSIGNAL);
+		if (res > 0) {
+			sent += res;
+			__atomic_fetch_add(&w.stats.written, res, __ATOMIC_RELAXED);
+			continue;
+		}
+		if (res < 0 && errno == EINTR)
+			continue;
+		if (!reconnected) {
+			writer_connect();
+			reconnected = true;
+			continue;
+		}
+		// skip the failing message
+		INC(&w.stats.refused);
+		++sent;
+	}
+}
+
+static void *writer_thread(void *arg)
+{
+	batch_msg *batch = arg;
+	struct mmsghdr msgs[BATCH];
+	struct iovec iovs[BATCH][2];
+	slot msg;
+
+	for (;;) {
+		unsigned num = 0;
+
+		while (num < BATCH && queue_pop(&msg)) {
+			batch_msg *b = &batch[num];
+			size_t header_len = format_header(b->header, &msg);
+
+			memcpy(b->data, msg.data, msg.len);
+			iovs[num][0].iov_base = b->header;
+			iovs[num][0].iov_len = header_len;
+			iovs[num][1].iov_base = b->data;
+			iovs[num][1].iov_len = msg.len;
+			memset(&msgs[num], 0, sizeof(msgs[num]));
+			msgs[num].msg_hdr.msg_iov = iovs[num];
+			msgs[num].msg_hdr.msg_iovlen = 2;
+			++num;
+		}
+
+		if (num) {
+			writer_send(msgs, num);
+			if (LOAD(&w.waiters)) {
+				pthread_mutex_lock(&w.mtx);
+				pthread_cond_broadcast(&w.space_cond);
+				pthread_mutex_unlock(&w.mtx);
+			}
+			continue;
+		}
+
+		// queue empty, wait for messages
+		pthread_mutex_lock(&w.mtx);
+		STORE(&w.sleeping, true);
+		if (queue_empty()) {
+			if (LOAD(&w.stopping)) {
+				pthread_mutex_unlock(&w.mtx);
+				break;
+			}
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += 1;
+			pthread_cond_timedwait(&w.cond, &w.mtx, &deadline);
+		}
+		STORE(&w.sleeping, false);
+		pthread_mutex_unlock(&w.mtx);
+	}
+
+	if (w.fd >= 0)
+		close(w.fd);
+	w.fd = -1;
+	return NULL;
+}
+
+// The writer thread does not survive a fork, the child will use
+// synchronous writes.
+static void atfork_child(void)
+{
+	w.running = false;
+	w.fd = -1;
+	pthread_mutex_init(&w.mtx, NULL);
+	pthread_cond_init(&w.cond, NULL);
+	pthread_cond_init(&w.space_cond, NULL);
+}
+
+static void register_atfork(void)
+{
+	pthread_atfork(NULL, NULL, atfork_child);
+}
+
+int syslog_writer_start(size_t capacity, syslog_overflow overflow)
+{
+	static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+	static batch_msg *batch;
+	size_t size = 2;
+	sigset_t all, old;
+	int err;
+
+	if (LOAD(&w.running)) {
+		syslog_writer_set_overflow(overflow);
+		return 0;
+	}
+
+	while (size < capacity && size < ((size_t) 1 << 30))
+		size *= 2;
+
+	w.slots = malloc(size * sizeof(*w.slots));
+	if (!batch)
+		batch = malloc(BATCH * sizeof(*batch));
+	if (!w.slots || !batch) {
+		free(w.slots);
+		w.slots = NULL;
+		return ENOMEM;
+	}
+	for (size_t i = 0; i < size; ++i)
+		w.slots[i].seq = i;
+	w.mask = size - 1;
+	w.enqueue_pos = w.dequeue_pos = 0;
+	w.overflow = overflow;
+	w.stopping = false;
+
+	pthread_once(&atfork_once, register_atfork);
+
+	// the writer thread must not handle signals
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	err = pthread_create(&w.thread, NULL, writer_thread, batch);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err) {
+		free(w.slots);
+		w.slots = NULL;
+		return err;
+	}
+	STORE(&w.running, true);
+	return 0;
+}
+
+void syslog_writer_stop(void)
+{
+	if (!LOAD(&w.running))
+		return;
+
+	STORE(&w.running, false);
+	pthread_mutex_lock(&w.mtx);
+	STORE(&w.stopping, true);
+	pthread_cond_signal(&w.cond);
+	pthread_cond_broadcast(&w.space_cond);
+	pthread_mutex_unlock(&w.mtx);
+	pthread_join(w.thread, NULL);
+
+	free(w.slots);
+	w.slots = NULL;
+}
+
+bool syslog_writer_running(void)
+{
+	return LOAD(&w.running);
+}
+
+void syslog_writer_set_overflow(syslog_overflow overflow)
+{
+	STORE(&w.overflow, overflow);
+}
+
+syslog_enqueue_result syslog_writer_enqueue(int priority, const char *msg,
+					    size_t len)
+{
+	if (!LOAD(&w.running))
+		return SYSLOG_NOT_QUEUED;
+
+	len = strnlen(msg, len);
+	if (len > MSG_MAX)
+		return SYSLOG_NOT_QUEUED;
+
+	// bounded number of attempts, other threads could be taking
+	// the space we freed
+	for (int attempt = 0; attempt < 16; ++attempt) {
+		if (queue_push(priority, msg, len)) {
+			INC(&w.stats.enqueued);
+			if (LOAD(&w.sleeping)) {
+				pthread_mutex_lock(&w.mtx);
+				pthread_cond_signal(&w.cond);
+				pthread_mutex_unlock(&w.mtx);
+			}
+			return SYSLOG_ENQUEUED;
+		}
+
+		switch (LOAD(&w.overflow)) {
+		case SYSLOG_OVERFLOW_DROP_OLDEST:
+			if (queue_pop(NULL))
+				INC(&w.stats.dropped);
+			break;
+		case SYSLOG_OVERFLOW_BLOCK:
+			return SYSLOG_FULL;
+		default:
+			INC(&w.stats.dropped);
+			return SYSLOG_DROPPED;
+		}
+	}
+	INC(&w.stats.dropped);
+	return SYSLOG_DROPPED;
+}
+
+void syslog_writer_wait_space(void)
+{
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += 100 * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_nsec -= 1000000000;
+		deadline.tv_sec += 1;
+	}
+
+	// The writer checks for waiters after dequeueing so either we see
+	// the space or the writer sees us waiting.
+	// "running" is checked with the mutex held as slots are released
+	// after the writer is stopped.
+	pthread_mutex_lock(&w.mtx);
+	__atomic_fetch_add(&w.waiters, 1, __ATOMIC_SEQ_CST);
+	if (LOAD(&w.running) && queue_full())
+		pthread_cond_timedwait(&w.space_cond, &w.mtx, &deadline);
+	__atomic_fetch_sub(&w.waiters, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&w.mtx);
+}
+
+void syslog_writer_get_stats(syslog_writer_stats *stats)
+{
+	stats->queued = 0;
+	if (LOAD(&w.running))
+		stats->queued = LOAD(&w.enqueue_pos) - LOAD(&w.dequeue_pos);
+	stats->enqueued = LOAD(&w.stats.enqueued);
+	stats->written = LOAD(&w.stats.written);
+	stats->dropped = LOAD(&w.stats.dropped);
+	stats->refused = LOAD(&w.stats.refused);
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2025 Cloud Software Group
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Asynchronous syslog writer.
+// Messages are copied in a bounded lock-free queue and sent to /dev/log
+// in batches by a dedicated thread.
+
+typedef enum {
+	// discard the oldest queued message to make space
+	SYSLOG_OVERFLOW_DROP_OLDEST,
+	// wait for the writer thread to make space
+	SYSLOG_OVERFLOW_BLOCK,
+	// discard the new message, just counting it
+	SYSLOG_OVERFLOW_DROP,
+} syslog_overflow;
+
+typedef struct syslog_writer_stats {
+	// messages currently in the queue
+	uint64_t queued;
+	uint64_t enqueued;
+	uint64_t written;
+	uint64_t dropped;
+	uint64_t refused;
+} syslog_writer_stats;
+
+// Result of syslog_writer_enqueue
+typedef enum {
+	SYSLOG_ENQUEUED,
+	// message discarded due to overflow policy
+	SYSLOG_DROPPED,
+	// queue full and policy is block, retry calling syslog_writer_wait_space
+	SYSLOG_FULL,
+	// writer not running or message too big, caller should write it
+	SYSLOG_NOT_QUEUED,
+} syslog_enqueue_result;
+
+// Start writer thread with a queue of given capacity.
+// Returns error number or 0 if success.
+int syslog_writer_start(size_t capacity, syslog_overflow overflow);
+
+// Stop writer thread after flushing the queue.
+// Must not be called concurrently with syslog_writer_enqueue, OCaml
+// callers are serialised by the runtime lock.
+void syslog_writer_stop(void);
+
+bool syslog_writer_running(void);
+
+void syslog_writer_set_overflow(syslog_overflow overflow);
+
+syslog_enqueue_result syslog_writer_enqueue(int priority, const char *msg,
+					    size_t len);
+
+// Wait for some space in the queue, to be called without holding
+// any lock.
+void syslog_writer_wait_space(void);
+
+void syslog_writer_get_stats(syslog_writer_stats *stats);
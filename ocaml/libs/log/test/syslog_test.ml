@@ -0,0 +1,120 @@
+(*
+ * Copyright (C) Cloud Software Group
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *)
+
+(* Filter state is global, each test uses its own facility and resets what it
+   changed. Messages are sent to syslog, only the counters are checked. *)
+
+module Filter = Syslog.Filter
+
+(* Number of messages deduplicated and rate limited while running [f] *)
+let suppressed f =
+  let before = Filter.stats () in
+  f () ;
+  let after = Filter.stats () in
+  ( after.Filter.deduplicated - before.Filter.deduplicated
+  , after.Filter.rate_limited - before.Filter.rate_limited
+  )
+
+let log_n n facility level msg =
+  for _ = 1 to n do
+    Syslog.log facility level msg
+  done
+
+let check_suppressed name expected f =
+  Alcotest.(check (pair int int)) name expected (suppressed f)
+
+let test_dedup () =
+  Filter.set_dedup ~interval:60. ;
+  Fun.protect ~finally:Filter.disable_dedup @@ fun () ->
+  check_suppressed "repetitions are suppressed" (4, 0) (fun () ->
+      log_n 5 Syslog.Local7 Syslog.Info "[header 1] same"
+  ) ;
+  check_suppressed "the header is ignored" (1, 0) (fun () ->
+      Syslog.log Syslog.Local7 Syslog.Info "[header 2] same"
+  ) ;
+  check_suppressed "different messages are written" (0, 0) (fun () ->
+      Syslog.log Syslog.Local7 Syslog.Info "other" ;
+      Syslog.log Syslog.Local7 Syslog.Warning "other" ;
+      Syslog.log Syslog.Local7 Syslog.Info "same"
+  ) ;
+  Filter.flush () ;
+  check_suppressed "disabled" (0, 0) (fun () ->
+      Filter.disable_dedup () ;
+      log_n 3 Syslog.Local7 Syslog.Info "same"
+  )
+
+let test_rate_limit () =
+  Filter.set_rate_limits_of_string "local6.info=2/60" ;
+  Fun.protect ~finally:(fun () -> Filter.set_rate_limits_of_string "local6=0/1")
+  @@ fun () ->
+  check_suppressed "above burst" (0, 3) (fun () ->
+      log_n 5 Syslog.Local6 Syslog.Info "limited"
+  ) ;
+  check_suppressed "other messages" (0, 0) (fun () ->
+      log_n 2 Syslog.Local6 Syslog.Info "another"
+  ) ;
+  check_suppressed "other levels" (0, 0) (fun () ->
+      log_n 5 Syslog.Local6 Syslog.Debug "limited"
+  ) ;
+  Filter.set_rate_limits_of_string "local6=0/1" ;
+  check_suppressed "disabled" (0, 0) (fun () ->
+      log_n 5 Syslog.Local6 Syslog.Info "limited"
+  )
+
+let test_rules () =
+  Filter.set_rate_limits_of_string " local5=1/60  local5.debug=3/60 " ;
+  Fun.protect ~finally:(fun () -> Filter.set_rate_limits_of_string "local5=0/1")
+  @@ fun () ->
+  check_suppressed "rules apply in order" (0, 2) (fun () ->
+      log_n 3 Syslog.Local5 Syslog.Err "rules"
+  ) ;
+  check_suppressed "last rule wins" (0, 1) (fun () ->
+      log_n 4 Syslog.Local5 Syslog.Debug "rules"
+  ) ;
+  check_suppressed "wildcard level" (0, 1) (fun () ->
+      Filter.set_rate_limits_of_string "local5.*=1/60" ;
+      log_n 2 Syslog.Local5 Syslog.Notice "wildcard"
+  )
+
+let test_invalid () =
+  let invalid rules rule =
+    Alcotest.check_raises rules (Filter.Invalid_rate_limit rule) (fun () ->
+        Filter.set_rate_limits_of_string rules
+    )
+  in
+  invalid "local4" "local4" ;
+  invalid "local4=1" "local4=1" ;
+  invalid "local4=1/60=2" "local4=1/60=2" ;
+  invalid "unknown=1/60" "unknown=1/60" ;
+  invalid "local4.unknown=1/60" "local4.unknown=1/60" ;
+  invalid "local4.info.x=1/60" "local4.info.x=1/60" ;
+  invalid "local4=x/60" "local4=x/60" ;
+  invalid "local4=-1/60" "local4=-1/60" ;
+  invalid "local4=1/0" "local4=1/0" ;
+  invalid "local4=1/x" "local4=1/x" ;
+  (* nothing is changed if any rule is invalid *)
+  invalid "local4=1/60 local4=x" "local4=x" ;
+  check_suppressed "unchanged" (0, 0) (fun () ->
+      log_n 3 Syslog.Local4 Syslog.Info "invalid"
+  )
+
+let tests =
+  [
+    ("dedup", `Quick, test_dedup)
+  ; ("rate limit", `Quick, test_rate_limit)
+  ; ("rules", `Quick, test_rules)
+  ; ("invalid rules", `Quick, test_invalid)
+  ]
+
+let () = Alcotest.run "Syslog" [("filter", tests)]
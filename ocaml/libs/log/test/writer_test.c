@@ -0,0 +1,400 @@
+/*
+ * Copyright (C) 2025 Cloud Software Group
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+// Test of the asynchronous syslog writer.
+// connect and sendmmsg are wrapped: /dev/log is redirected to a local
+// datagram socket read by a thread, and sends can be held back so that
+// messages pile up in the queue while the writer is busy.
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <paths.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "../syslog_writer.h"
+
+#define START(name) \
+	static typeof(name) *old_func = NULL; \
+	if (!old_func) \
+		old_func = (typeof(name) *) dlsym(RTLD_NEXT, #name);
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		exit(1); \
+	} \
+} while (0)
+
+#define MAX_MSGS 256
+#define MAX_BATCHES 64
+
+static char sock_path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+static int sock = -1;
+
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+// messages received, without the syslog header
+static char received[MAX_MSGS][64];
+static unsigned num_received;
+
+// messages passed to each sendmmsg
+static unsigned batches[MAX_BATCHES];
+static unsigned num_batches;
+
+// while set sendmmsg waits, "sending" tells that the writer is waiting
+static bool hold;
+static bool sending;
+
+int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen)
+{
+	START(connect);
+
+	const struct sockaddr_un *un = (const struct sockaddr_un *) addr;
+	if (!addr || addr->sa_family != AF_UNIX
+	    || strcmp(un->sun_path, _PATH_LOG) != 0)
+		return old_func(sockfd, addr, addrlen);
+
+	struct sockaddr_un new_addr = { .sun_family = AF_UNIX };
+	strcpy(new_addr.sun_path, sock_path);
+	return old_func(sockfd, (struct sockaddr *) &new_addr,
+			sizeof(new_addr));
+}
+
+int sendmmsg(int sockfd, struct mmsghdr *msgs, unsigned int vlen, int flags)
+{
+	START(sendmmsg);
+
+	pthread_mutex_lock(&mtx);
+	if (num_batches < MAX_BATCHES)
+		batches[num_batches++] = vlen;
+	sending = true;
+	pthread_cond_broadcast(&cond);
+	while (hold)
+		pthread_cond_wait(&cond, &mtx);
+	sending = false;
+	pthread_mutex_unlock(&mtx);
+
+	return old_func(sockfd, msgs, vlen, flags);
+}
+
+static void *reader(void *arg)
+{
+	int fd = (int) (intptr_t) arg;
+	char buf[8192];
+	ssize_t len;
+
+	while ((len = recv(fd, buf, sizeof(buf) - 1, 0)) >= 0) {
+		buf[len] = 0;
+		const char *msg = strstr(buf, ": ");
+		msg = msg ? msg + 2 : buf;
+
+		pthread_mutex_lock(&mtx);
+		if (num_received < MAX_MSGS)
+			snprintf(received[num_received++], sizeof(received[0]),
+				 "%.63s", msg);
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&mtx);
+	}
+	return NULL;
+}
+
+static void listen_log(void)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	pthread_t thread;
+
+	unlink(sock_path);
+	sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	CHECK(sock >= 0);
+	strcpy(addr.sun_path, sock_path);
+	CHECK(bind(sock, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+	CHECK(pthread_create(&thread, NULL, reader, (void *) (intptr_t) sock) == 0);
+	CHECK(pthread_detach(thread) == 0);
+}
+
+// Stop receiving, sends are refused from now on
+static void close_log(void)
+{
+	shutdown(sock, SHUT_RDWR);
+	close(sock);
+	unlink(sock_path);
+	sock = -1;
+}
+
+static void reset(void)
+{
+	pthread_mutex_lock(&mtx);
+	num_received = 0;
+	num_batches = 0;
+	pthread_mutex_unlock(&mtx);
+}
+
+static void wait_for(unsigned *counter, unsigned n)
+{
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += 10;
+	pthread_mutex_lock(&mtx);
+	while (*counter < n)
+		CHECK(pthread_cond_timedwait(&cond, &mtx, &deadline) == 0);
+	pthread_mutex_unlock(&mtx);
+}
+
+static void wait_stats(uint64_t written, uint64_t refused)
+{
+	syslog_writer_stats stats;
+
+	for (int i = 0; i < 10000; ++i) {
+		syslog_writer_get_stats(&stats);
+		if (stats.written == written && stats.refused == refused)
+			return;
+		usleep(1000);
+	}
+	fprintf(stderr, "written %llu and refused %llu, expected %llu and %llu\n",
+		(unsigned long long) stats.written,
+		(unsigned long long) stats.refused,
+		(unsigned long long) written, (unsigned long long) refused);
+	exit(1);
+}
+
+// Hold the writer in sendmmsg with the message "busy", so that the next
+// messages stay queued until release
+static void hold_writer(void)
+{
+	pthread_mutex_lock(&mtx);
+	hold = true;
+	pthread_mutex_unlock(&mtx);
+	CHECK(syslog_writer_enqueue(LOG_INFO, "busy", 4) == SYSLOG_ENQUEUED);
+	pthread_mutex_lock(&mtx);
+	while (!sending)
+		pthread_cond_wait(&cond, &mtx);
+	pthread_mutex_unlock(&mtx);
+}
+
+static void release_writer(void)
+{
+	pthread_mutex_lock(&mtx);
+	hold = false;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&mtx);
+}
+
+static syslog_enqueue_result enqueue(int n)
+{
+	char msg[32];
+
+	snprintf(msg, sizeof(msg), "msg %d", n);
+	return syslog_writer_enqueue(LOG_INFO, msg, sizeof(msg));
+}
+
+// Check that the messages received are "busy" followed by the given ones
+static void check_received(const int *expected, unsigned n)
+{
+	char msg[32];
+
+	wait_for(&num_received, n + 1);
+	pthread_mutex_lock(&mtx);
+	CHECK(num_received == n + 1);
+	CHECK(strcmp(received[0], "busy") == 0);
+	for (unsigned i = 0; i < n; ++i) {
+		snprintf(msg, sizeof(msg), "msg %d", expected[i]);
+		CHECK(strcmp(received[i + 1], msg) == 0);
+	}
+	pthread_mutex_unlock(&mtx);
+}
+
+static void test_order_and_batches(void)
+{
+	syslog_writer_stats before, after;
+
+	reset();
+	CHECK(syslog_writer_start(256, SYSLOG_OVERFLOW_DROP) == 0);
+	syslog_writer_get_stats(&before);
+	hold_writer();
+	for (int i = 0; i < 100; ++i)
+		CHECK(enqueue(i) == SYSLOG_ENQUEUED);
+	syslog_writer_get_stats(&after);
+	CHECK(after.queued == 100);
+	release_writer();
+
+	int expected[100];
+	for (int i = 0; i < 100; ++i)
+		expected[i] = i;
+	check_received(expected, 100);
+
+	// "busy" alone, then the queued messages in full batches
+	CHECK(num_batches == 3);
+	CHECK(batches[0] == 1 && batches[1] == 64 && batches[2] == 36);
+
+	wait_stats(before.written + 101, before.refused);
+	syslog_writer_get_stats(&after);
+	CHECK(after.queued == 0);
+	CHECK(after.enqueued == before.enqueued + 101);
+	CHECK(after.dropped == before.dropped);
+	syslog_writer_stop();
+}
+
+// Hold the writer, then enqueue 6 messages in a queue of 4
+static void test_overflow(syslog_overflow overflow)
+{
+	syslog_writer_stats before, after;
+	syslog_enqueue_result res;
+
+	reset();
+	CHECK(syslog_writer_start(4, overflow) == 0);
+	syslog_writer_get_stats(&before);
+	hold_writer();
+	for (int i = 1; i <= 4; ++i)
+		CHECK(enqueue(i) == SYSLOG_ENQUEUED);
+	for (int i = 5; i <= 6; ++i) {
+		res = enqueue(i);
+		switch (overflow) {
+		case SYSLOG_OVERFLOW_DROP_OLDEST:
+			CHECK(res == SYSLOG_ENQUEUED);
+			break;
+		case SYSLOG_OVERFLOW_DROP:
+			CHECK(res == SYSLOG_DROPPED);
+			break;
+		case SYSLOG_OVERFLOW_BLOCK:
+			CHECK(res == SYSLOG_FULL);
+			// times out as the writer is held
+			syslog_writer_wait_space();
+			CHECK(enqueue(i) == SYSLOG_FULL);
+			break;
+		}
+	}
+	syslog_writer_get_stats(&after);
+	CHECK(after.queued == 4);
+	release_writer();
+
+	if (overflow == SYSLOG_OVERFLOW_BLOCK) {
+		for (int i = 5; i <= 6; ++i)
+			while (enqueue(i) == SYSLOG_FULL)
+				syslog_writer_wait_space();
+	}
+
+	switch (overflow) {
+	case SYSLOG_OVERFLOW_DROP_OLDEST:
+		check_received((int[]) { 3, 4, 5, 6 }, 4);
+		break;
+	case SYSLOG_OVERFLOW_DROP:
+		check_received((int[]) { 1, 2, 3, 4 }, 4);
+		break;
+	case SYSLOG_OVERFLOW_BLOCK:
+		check_received((int[]) { 1, 2, 3, 4, 5, 6 }, 6);
+		break;
+	}
+
+	uint64_t sent = overflow == SYSLOG_OVERFLOW_BLOCK ? 7 : 5;
+	wait_stats(before.written + sent, before.refused);
+	syslog_writer_get_stats(&after);
+	CHECK(after.dropped == before.dropped + 7 - sent);
+	CHECK(after.enqueued
+	      == before.enqueued
+	      + (overflow == SYSLOG_OVERFLOW_DROP ? 5 : 7));
+	syslog_writer_stop();
+}
+
+static void test_stop_restart(void)
+{
+	syslog_writer_stats before, after;
+
+	reset();
+	CHECK(syslog_writer_start(16, SYSLOG_OVERFLOW_BLOCK) == 0);
+	syslog_writer_get_stats(&before);
+	hold_writer();
+	for (int i = 0; i < 10; ++i)
+		CHECK(enqueue(i) == SYSLOG_ENQUEUED);
+	release_writer();
+	// stopping flushes the queue
+	syslog_writer_stop();
+	syslog_writer_get_stats(&after);
+	CHECK(after.written == before.written + 11);
+	CHECK(after.queued == 0);
+	check_received((int[]) { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 }, 10);
+	CHECK(!syslog_writer_running());
+	CHECK(enqueue(0) == SYSLOG_NOT_QUEUED);
+	syslog_writer_stop();
+
+	reset();
+	CHECK(syslog_writer_start(16, SYSLOG_OVERFLOW_BLOCK) == 0);
+	CHECK(syslog_writer_running());
+	CHECK(syslog_writer_enqueue(LOG_INFO, "busy", 4) == SYSLOG_ENQUEUED);
+	CHECK(enqueue(0) == SYSLOG_ENQUEUED);
+	check_received((int[]) { 0 }, 1);
+	syslog_writer_stop();
+}
+
+// The child of a fork has no writer thread and must write by itself
+static void test_fork(void)
+{
+	int status;
+	pid_t pid;
+
+	CHECK(syslog_writer_start(16, SYSLOG_OVERFLOW_BLOCK) == 0);
+	pid = fork();
+	CHECK(pid >= 0);
+	if (pid == 0)
+		_exit(!syslog_writer_running()
+		      && enqueue(0) == SYSLOG_NOT_QUEUED ? 0 : 1);
+	CHECK(waitpid(pid, &status, 0) == pid);
+	CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	CHECK(syslog_writer_running());
+	syslog_writer_stop();
+}
+
+static void test_refused(void)
+{
+	syslog_writer_stats before;
+
+	close_log();
+	CHECK(syslog_writer_start(16, SYSLOG_OVERFLOW_BLOCK) == 0);
+	syslog_writer_get_stats(&before);
+	for (int i = 0; i < 3; ++i)
+		CHECK(enqueue(i) == SYSLOG_ENQUEUED);
+	wait_stats(before.written, before.refused + 3);
+	syslog_writer_stop();
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/writer_test.XXXXXX";
+
+	CHECK(mkdtemp(dir));
+	snprintf(sock_path, sizeof(sock_path), "%s/log", dir);
+	listen_log();
+
+	test_order_and_batches();
+	test_overflow(SYSLOG_OVERFLOW_DROP_OLDEST);
+	test_overflow(SYSLOG_OVERFLOW_DROP);
+	test_overflow(SYSLOG_OVERFLOW_BLOCK);
+	test_stop_restart();
+	test_fork();
+	test_refused();
+
+	rmdir(dir);
+	printf("OK\n");
+	return 0;
+}
@@ -326,12 +326,12 @@ module Destination = struct
       (fun s_i -> List.iter (export_to_endpoint parent s_i) endpoints)
       span_info_chunks
 
-  let delay = Delay.make ()
+  let delay = Delay.make ~name:"tracing_export" ()
 
   (* Note this signal will flush the spans and terminate the exporter thread *)
   let signal () = Delay.signal delay
 
-  let wait_exit = Delay.make ()
+  let wait_exit = Delay.make ~name:"tracing_export.wait_exit" ()
 
   let create_exporter () =
     enable_span_garbage_collector () ;
@@ -13,20 +13,132 @@
  */
 
 #include <caml/memory.h>
+#include <caml/alloc.h>
 #include <caml/threads.h>
 #include <caml/custom.h>
 #include <caml/unixsupport.h>
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 #include <errno.h>
 #include <pthread.h>
+#include <time.h>
+
+// Statistics collected for named delays.
+// Counters are updated with atomic operations as they are written
+// both with and without the delay mutex held.
+typedef struct delay_stats {
+	uint64_t signals;
+	// signals which had to release the runtime lock
+	uint64_t slow_signals;
+	uint64_t signaled_waits;
+	uint64_t timed_out_waits;
+	// from signal to wait returning
+	uint64_t wakeup_total_ns;
+	uint64_t wakeup_max_ns;
+	// time spent reacquiring the runtime lock, both in wait and signal
+	uint64_t reacquire_total_ns;
+	uint64_t reacquire_max_ns;
+} delay_stats;
 
 typedef struct delay {
 	pthread_mutex_t mtx;
 	pthread_cond_t cond;
 	bool signaled;
+	// instrumentation, only for named delays
+	char *name;
+	uint64_t signal_time;
+	delay_stats stats;
+	struct delay *prev, *next;
 } delay;
 
+// List of named delays, used to dump statistics
+static pthread_mutex_t registry_mtx = PTHREAD_MUTEX_INITIALIZER;
+static delay *registry = NULL;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static inline void stat_add(uint64_t *counter, uint64_t n)
+{
+	__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+static void stat_max(uint64_t *max, uint64_t n)
+{
+	uint64_t cur = __atomic_load_n(max, __ATOMIC_RELAXED);
+
+	while (n > cur
+	       && !__atomic_compare_exchange_n(max, &cur, n, true,
+					       __ATOMIC_RELAXED,
+					       __ATOMIC_RELAXED))
+		continue;
+}
+
+static void stat_time(uint64_t *total, uint64_t *max, uint64_t ns)
+{
+	stat_add(total, ns);
+	stat_max(max, ns);
+}
+
+// Acquire runtime lock accounting the time spent
+static void delay_acquire_runtime(delay *d)
+{
+	uint64_t start;
+
+	if (!d->name) {
+		caml_acquire_runtime_system();
+		return;
+	}
+
+	start = now_ns();
+	caml_acquire_runtime_system();
+	stat_time(&d->stats.reacquire_total_ns, &d->stats.reacquire_max_ns,
+		  now_ns() - start);
+}
+
+// Must be called with delay mutex held
+static void delay_set_signaled(delay *d)
+{
+	if (d->name) {
+		stat_add(&d->stats.signals, 1);
+		// keep first signal time, signals are collapsed
+		if (!d->signaled)
+			d->signal_time = now_ns();
+	}
+	d->signaled = true;
+	pthread_cond_signal(&d->cond);
+}
+
+static void delay_register(delay *d)
+{
+	pthread_mutex_lock(&registry_mtx);
+	d->prev = NULL;
+	d->next = registry;
+	if (registry)
+		registry->prev = d;
+	registry = d;
+	pthread_mutex_unlock(&registry_mtx);
+}
+
+static void delay_unregister(delay *d)
+{
+	pthread_mutex_lock(&registry_mtx);
+	if (d->prev)
+		d->prev->next = d->next;
+	else
+		registry = d->next;
+	if (d->next)
+		d->next->prev = d->prev;
+	pthread_mutex_unlock(&registry_mtx);
+}
+
 // Initialize delay
 // Returns error number or 0 if success
 static int delay_init(delay *d)
@@ -35,6 +147,10 @@ static int delay_init(delay *d)
 	pthread_condattr_t cond_attr;
 
 	d->signaled = false;
+	d->name = NULL;
+	d->signal_time = 0;
+	memset(&d->stats, 0, sizeof(d->stats));
+	d->prev = d->next = NULL;
 
 	err = pthread_condattr_init(&cond_attr);
 	if (err)
@@ -60,6 +176,10 @@ err0:
 
 static void delay_destroy(delay *d)
 {
+	if (d->name) {
+		delay_unregister(d);
+		caml_stat_free(d->name);
+	}
 	pthread_cond_destroy(&d->cond);
 	pthread_mutex_destroy(&d->mtx);
 }
@@ -68,19 +188,19 @@ static void delay_signal(delay *d)
 {
 	// there are quite some chances lock is not held
 	if (pthread_mutex_trylock(&d->mtx) == 0) {
-		d->signaled = true;
-		pthread_cond_signal(&d->cond);
+		delay_set_signaled(d);
 		pthread_mutex_unlock(&d->mtx);
 		return;
 	}
 
 	// slow way, release engine
+	if (d->name)
+		stat_add(&d->stats.slow_signals, 1);
 	caml_release_runtime_system();
 	pthread_mutex_lock(&d->mtx);
-	d->signaled = true;
-	pthread_cond_signal(&d->cond);
+	delay_set_signaled(d);
 	pthread_mutex_unlock(&d->mtx);
-	caml_acquire_runtime_system();
+	delay_acquire_runtime(d);
 }
 
 // Wait for deadline or signal.
@@ -89,19 +209,32 @@ static void delay_signal(delay *d)
 int delay_wait(delay *d, const struct timespec *deadline)
 {
 	int err;
+	uint64_t signal_time = 0;
 
 	caml_release_runtime_system();
 	pthread_mutex_lock(&d->mtx);
 	do {
 		if (d->signaled) {
 			d->signaled = false;
+			signal_time = d->signal_time;
 			err = 0;
 			break;
 		}
 		err = pthread_cond_timedwait(&d->cond, &d->mtx, deadline);
 	} while (err == 0);
 	pthread_mutex_unlock(&d->mtx);
-	caml_acquire_runtime_system();
+	delay_acquire_runtime(d);
+
+	if (d->name) {
+		if (err == 0) {
+			stat_add(&d->stats.signaled_waits, 1);
+			stat_time(&d->stats.wakeup_total_ns,
+				  &d->stats.wakeup_max_ns,
+				  now_ns() - signal_time);
+		} else if (err == ETIMEDOUT) {
+			stat_add(&d->stats.timed_out_waits, 1);
+		}
+	}
 	return err;
 }
 
@@ -125,9 +258,9 @@ static struct custom_operations delay_ops = {
 	custom_fixed_length_default
 };
 
-CAMLprim value caml_xapi_delay_create(value v_unit)
+CAMLprim value caml_xapi_delay_create(value v_name)
 {
-	CAMLparam1(v_unit);
+	CAMLparam1(v_name);
 	CAMLlocal1(res);
 	delay *d;
 	int err;
@@ -140,6 +273,10 @@ CAMLprim value caml_xapi_delay_create(value v_unit)
 	}
 	res = caml_alloc_custom(&delay_ops, sizeof(delay *), 0, 1);
 	delay_val(res) = d;
+	if (Is_block(v_name)) {
+		d->name = caml_stat_strdup(String_val(Field(v_name, 0)));
+		delay_register(d);
+	}
 	CAMLreturn(res);
 }
 
@@ -167,3 +304,69 @@ CAMLprim value caml_xapi_delay_wait(value v_delay, value v_deadline)
 
 	CAMLreturn(err ? Val_true : Val_false);
 }
+
+#define NUM_STATS (sizeof(delay_stats) / sizeof(uint64_t))
+
+typedef struct named_stats {
+	char *name;
+	delay_stats stats;
+} named_stats;
+
+static void copy_stats(delay_stats *dst, delay_stats *src)
+{
+	uint64_t *d = (uint64_t *) dst, *s = (uint64_t *) src;
+
+	for (size_t i = 0; i < NUM_STATS; ++i)
+		d[i] = __atomic_load_n(&s[i], __ATOMIC_RELAXED);
+}
+
+// Returns a list of (name, stats) for all named delays.
+// Data are copied before allocating any OCaml value as the GC could
+// finalise delays which requires the registry lock.
+CAMLprim value caml_xapi_delay_dump_stats(value v_unit)
+{
+	CAMLparam1(v_unit);
+	CAMLlocal4(res, item, stats, cell);
+	named_stats *all = NULL;
+	size_t num = 0, allocated = 0;
+
+	pthread_mutex_lock(&registry_mtx);
+	for (delay *d = registry; d; d = d->next) {
+		if (num == allocated) {
+			size_t n = allocated ? allocated * 2 : 16;
+			named_stats *p = caml_stat_resize_noexc(all, n * sizeof(*all));
+			if (!p)
+				break;
+			all = p;
+			allocated = n;
+		}
+		all[num].name = caml_stat_strdup_noexc(d->name);
+		if (!all[num].name)
+			break;
+		copy_stats(&all[num].stats, &d->stats);
+		++num;
+	}
+	pthread_mutex_unlock(&registry_mtx);
+
+	res = Val_emptylist;
+	for (size_t i = 0; i < num; ++i) {
+		uint64_t *s = (uint64_t *) &all[i].stats;
+
+		stats = caml_alloc_tuple(NUM_STATS);
+		for (size_t j = 0; j < NUM_STATS; ++j)
+			Store_field(stats, j, caml_copy_int64(s[j]));
+		item = caml_alloc_tuple(2);
+		Store_field(item, 0, caml_copy_string(all[i].name));
+		Store_field(item, 1, stats);
+		cell = caml_alloc_small(2, 0);
+		Field(cell, 0) = item;
+		Field(cell, 1) = res;
+		res = cell;
+	}
+
+	for (size_t i = 0; i < num; ++i)
+		caml_stat_free(all[i].name);
+	caml_stat_free(all);
+
+	CAMLreturn(res);
+}
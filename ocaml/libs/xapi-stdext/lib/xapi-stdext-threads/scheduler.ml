@@ -16,6 +16,7 @@ module D = Debug.Make (struct let name = __MODULE__ end)
 
 open D
 module Delay = Xapi_stdext_threads.Threadext.Delay
+module Timer_wheel = Xapi_stdext_threads.Timer_wheel
 
 let with_lock = Xapi_stdext_threads.Threadext.Mutex.execute
 
@@ -25,23 +26,48 @@ type t = {func: unit -> unit; ty: func_ty; name: string}
 
 let delay = Delay.make ()
 
-let queue_default = {func= (fun () -> ()); ty= OneShot; name= ""}
+(* Default coalescing slack, periodic jobs are not sensitive to it *)
+let default_slack = Mtime.Span.(10 * ms)
 
-let (pending_event : t option ref) = ref None
+let wheel = Timer_wheel.create ~slack:default_slack ()
 
-let (queue : t Ipq.t) = Ipq.create 50 queue_default
+(* Timers indexed by handle and by name. Multiple timers could have the
+   same name, they are kept last added first so that adding is cheap, and
+   [remove_from_queue] removes the last one of the list, the first added *)
+let (timers : (Timer_wheel.handle, t) Hashtbl.t) = Hashtbl.create 50
+
+let (names : (string, Timer_wheel.handle list) Hashtbl.t) = Hashtbl.create 50
+
+(* Timer currently executing *)
+let (pending_event : (Timer_wheel.handle * t) option ref) = ref None
 
 let lock = Mutex.create ()
 
+let deadline_of_span span =
+  Mtime.add_span (Mtime_clock.now ()) span
+  |> Option.value ~default:Mtime.max_stamp
+
+let handles_of_name name =
+  Hashtbl.find_opt names name |> Option.value ~default:[]
+
+let forget handle ev =
+  Hashtbl.remove timers handle ;
+  ( match List.filter (fun h -> h <> handle) (handles_of_name ev.name) with
+  | [] ->
+      Hashtbl.remove names ev.name
+  | handles ->
+      Hashtbl.replace names ev.name handles
+  ) ;
+  Timer_wheel.cancel wheel handle
+
 let add_to_queue_span name ty start_span newfunc =
-  let ( ++ ) = Mtime.Span.add in
-  let item =
-    {
-      Ipq.ev= {func= newfunc; ty; name}
-    ; Ipq.time= Mtime_clock.elapsed () ++ start_span
-    }
-  in
-  with_lock lock (fun () -> Ipq.add queue item) ;
+  let ev = {func= newfunc; ty; name} in
+  let deadline = deadline_of_span start_span in
+  with_lock lock (fun () ->
+      let handle = Timer_wheel.add wheel deadline in
+      Hashtbl.replace timers handle ev ;
+      Hashtbl.replace names name (handle :: handles_of_name name)
+  ) ;
   Delay.signal delay
 
 let add_to_queue name ty start newfunc =
@@ -53,25 +79,38 @@ let add_to_queue name ty start newfunc =
 let remove_from_queue name =
   with_lock lock @@ fun () ->
   match !pending_event with
-  | Some ev when ev.name = name ->
-      pending_event := None
-  | Some _ | None ->
-      let index = Ipq.find_p queue (fun {name= n; _} -> name = n) in
-      if index > -1 then Ipq.remove queue index
+  | Some (handle, ev) when ev.name = name ->
+      forget handle ev ; pending_event := None
+  | Some _ | None -> (
+    match List.rev (handles_of_name name) with
+    | handle :: _ ->
+        forget handle (Hashtbl.find timers handle)
+    | [] ->
+        ()
+  )
+
+let set_slack slack =
+  with_lock lock (fun () -> Timer_wheel.set_slack wheel slack)
+
+let latency_stats () =
+  with_lock lock @@ fun () ->
+  Hashtbl.fold
+    (fun handle ev acc ->
+      (ev.name, Timer_wheel.timer_stats wheel handle) :: acc
+    )
+    timers []
 
 let add_periodic_pending () =
   with_lock lock @@ fun () ->
   match !pending_event with
-  | Some ({ty= Periodic timer; _} as ev) ->
-      let ( ++ ) = Mtime.Span.add in
+  | Some (handle, {ty= Periodic timer; _}) ->
       let delta =
         Clock.Timer.s_to_span timer |> Option.value ~default:Mtime.Span.max_span
       in
-      let item = {Ipq.ev; Ipq.time= Mtime_clock.elapsed () ++ delta} in
-      Ipq.add queue item ;
-      pending_event := None
-  | Some {ty= OneShot; _} ->
+      Timer_wheel.rearm wheel handle (deadline_of_span delta) ;
       pending_event := None
+  | Some (handle, ({ty= OneShot; _} as ev)) ->
+      forget handle ev ; pending_event := None
   | None ->
       ()
 
@@ -79,23 +118,27 @@ let loop () =
   debug "%s started" __MODULE__ ;
   try
     while true do
-      let now = Mtime_clock.elapsed () in
+      let now = Mtime_clock.now () in
       let deadline, item =
         with_lock lock @@ fun () ->
-        (* empty: wait till we get something *)
-        if Ipq.is_empty queue then
-          (Mtime.Span.add now Mtime.Span.(10 * s), None)
-        else
-          let next = Ipq.maximum queue in
-          if Mtime.Span.is_longer next.Ipq.time ~than:now then
-            (* not expired: wait till time or interrupted *)
-            (next.Ipq.time, None)
-          else (
-            (* remove expired item *)
-            Ipq.pop_maximum queue |> ignore ;
-            (* save periodic to be scheduled again *)
-            if next.Ipq.ev.ty <> OneShot then pending_event := Some next.Ipq.ev ;
-            (now, Some next.Ipq.ev)
+        match Timer_wheel.pop_expired wheel now with
+        | Some handle ->
+            let ev = Hashtbl.find timers handle in
+            (* keep the timer, periodic ones will be scheduled again *)
+            pending_event := Some (handle, ev) ;
+            (now, Some ev)
+        | None -> (
+            let max_wait = Mtime.Span.(10 * s) in
+            let max_deadline =
+              Mtime.add_span now max_wait |> Option.value ~default:now
+            in
+            match Timer_wheel.next_deadline wheel with
+            | Some next when Mtime.is_earlier next ~than:max_deadline ->
+                (* not expired: wait till time or interrupted *)
+                (next, None)
+            | Some _ | None ->
+                (* empty: wait till we get something *)
+                (max_deadline, None)
           )
       in
       match item with
@@ -105,7 +148,7 @@ let loop () =
       | None -> (
           (* Sleep until next event. *)
           let sleep =
-            Mtime.(Span.abs_diff deadline now)
+            Mtime.span deadline now
             |> Mtime.Span.(add ms)
             |> Clock.Timer.span_to_s
           in
@@ -28,5 +28,13 @@ val add_to_queue : string -> func_ty -> float -> (unit -> unit) -> unit
 val remove_from_queue : string -> unit
 (** Remove a scheduled item by name *)
 
+val set_slack : Mtime.span -> unit
+(** Maximum delay applied to timers in order to coalesce their expiries.
+    Affects only timers scheduled afterwards. *)
+
+val latency_stats :
+  unit -> (string * Xapi_stdext_threads.Timer_wheel.timer_stats) list
+(** Expiry latency statistics of the currently scheduled timers by name. *)
+
 val loop : unit -> unit
 (** The scheduler's main loop, started by {!Xapi} on start-up. *)
@@ -107,6 +107,15 @@ let test_wakeup mtime_span () =
   let expected = Mtime.Span.(100 * ms) in
   Alcotest.check mtime_span "small time" expected elapsed
 
+let test_remove_duplicate () =
+  let which = Event.new_channel () in
+  Scheduler.add_to_queue "dup" Scheduler.OneShot 0.1 (send which "first") ;
+  Scheduler.add_to_queue "dup" Scheduler.OneShot 0.2 (send which "second") ;
+  (* removes the first one added *)
+  Scheduler.remove_from_queue "dup" ;
+  start_schedule () ;
+  Alcotest.(check string) "same event name" "second" (receive which)
+
 let tests =
   let mtime_span = mtime_span () in
   [
@@ -114,6 +123,7 @@ let tests =
   ; ("test_remove_self", `Quick, test_remove_self mtime_span)
   ; ("test_empty", `Quick, test_empty mtime_span)
   ; ("test_wakeup", `Quick, test_wakeup mtime_span)
+  ; ("test_remove_duplicate", `Quick, test_remove_duplicate)
   ]
 
 let () = Alcotest.run "Scheduler" [("generic", tests)]
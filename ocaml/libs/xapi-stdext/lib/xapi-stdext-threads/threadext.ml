@@ -57,7 +57,56 @@ let thread_iter f xs =
 module Delay = struct
   type t
 
-  external make : unit -> t = "caml_xapi_delay_create"
+  type stats = {
+      signals: int64
+    ; slow_signals: int64
+    ; signaled_waits: int64
+    ; timed_out_waits: int64
+    ; wakeup_total: Mtime.span
+    ; wakeup_max: Mtime.span
+    ; reacquire_total: Mtime.span
+    ; reacquire_max: Mtime.span
+  }
+
+  external make : string option -> t = "caml_xapi_delay_create"
+
+  let make ?name () = make name
+
+  external dump_stats :
+       unit
+    -> (string * (int64 * int64 * int64 * int64 * int64 * int64 * int64 * int64))
+       list = "caml_xapi_delay_dump_stats"
+
+  let dump_stats () =
+    let span = Mtime.Span.of_uint64_ns in
+    dump_stats ()
+    |> List.map
+         (fun
+           ( name
+           , ( signals
+             , slow_signals
+             , signaled_waits
+             , timed_out_waits
+             , wakeup_total
+             , wakeup_max
+             , reacquire_total
+             , reacquire_max
+             )
+           )
+         ->
+           ( name
+           , {
+               signals
+             ; slow_signals
+             ; signaled_waits
+             ; timed_out_waits
+             ; wakeup_total= span wakeup_total
+             ; wakeup_max= span wakeup_max
+             ; reacquire_total= span reacquire_total
+             ; reacquire_max= span reacquire_max
+             }
+           )
+       )
 
   external signal : t -> unit = "caml_xapi_delay_signal"
 
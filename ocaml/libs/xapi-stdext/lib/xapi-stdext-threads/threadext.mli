@@ -23,7 +23,26 @@ val thread_iter : ('a -> unit) -> 'a list -> unit
 module Delay : sig
   type t
 
-  val make : unit -> t
+  (** Statistics collected for named delays *)
+  type stats = {
+      signals: int64  (** Calls to 'signal' *)
+    ; slow_signals: int64
+          (** Signals which had to release the runtime lock as the delay was
+              busy *)
+    ; signaled_waits: int64  (** Waits terminated by a signal *)
+    ; timed_out_waits: int64  (** Waits terminated by the timeout *)
+    ; wakeup_total: Mtime.span
+          (** Total time from signal to the waiting thread running again *)
+    ; wakeup_max: Mtime.span  (** Maximum time from signal to wake up *)
+    ; reacquire_total: Mtime.span
+          (** Total time spent waiting to reacquire the runtime lock *)
+    ; reacquire_max: Mtime.span
+          (** Maximum time spent waiting to reacquire the runtime lock *)
+  }
+
+  val make : ?name:string -> unit -> t
+  (** Create a new delay. If [name] is passed the delay is instrumented
+      and its statistics are reported by {!dump_stats}. *)
 
   val wait : t -> float -> bool
   (** Blocks the calling thread for a given period of time with the option of
@@ -35,6 +54,9 @@ module Delay : sig
 
   val signal : t -> unit
   (** Sends a signal to a waiting thread. See 'wait' *)
+
+  val dump_stats : unit -> (string * stats) list
+  (** Statistics of all named delays currently alive *)
 end
 
 val wait_timed_read : Unix.file_descr -> float -> bool
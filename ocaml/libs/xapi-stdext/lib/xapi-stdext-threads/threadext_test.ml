@@ -66,12 +66,31 @@ let other_thread () =
   delay_wait_check ~min:0.2 ~max:0.25 d 1.0 false ;
   Thread.join th
 
+(*
+Named delays collect statistics
+- one wait terminated by a signal, one by timeout
+- stats are reported by name
+*)
+let named_stats () =
+  let d = Delay.make ~name:"test_named_stats" () in
+  Delay.signal d ;
+  delay_wait_check ~min:0. ~max:0.05 d 1.0 false ;
+  delay_wait_check ~min:0.05 ~max:0.1 d 0.05 true ;
+  match List.assoc_opt "test_named_stats" (Delay.dump_stats ()) with
+  | None ->
+      Alcotest.fail "named delay not reported"
+  | Some stats ->
+      Alcotest.(check int64) "signals" 1L stats.Delay.signals ;
+      Alcotest.(check int64) "signaled waits" 1L stats.signaled_waits ;
+      Alcotest.(check int64) "timed out waits" 1L stats.timed_out_waits
+
 let tests =
   [
     ("simple", `Quick, simple)
   ; ("no_signal", `Quick, no_signal)
   ; ("collapsed", `Quick, collapsed)
   ; ("other_thread", `Quick, other_thread)
+  ; ("named_stats", `Quick, named_stats)
   ]
 
 let test_create_ambient_storage () =
@@ -0,0 +1,93 @@
+(*
+ * Copyright (C) 2025 Cloud Software Group
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *)
+
+type t
+
+type handle = int
+
+type timer_stats = {
+    fired: int
+  ; last_latency: Mtime.span
+  ; max_latency: Mtime.span
+  ; total_latency: Mtime.span
+}
+
+type stats = {
+    pending: int
+  ; added: int
+  ; cancelled: int
+  ; expired: int
+  ; cascaded: int
+  ; coalesced: int
+}
+
+external create : int64 -> int64 -> int64 -> t = "caml_xapi_timer_wheel_create"
+
+external set_slack : t -> int64 -> unit = "caml_xapi_timer_wheel_set_slack"
+
+external add : t -> int64 -> handle = "caml_xapi_timer_wheel_add"
+
+external rearm : t -> handle -> int64 -> unit = "caml_xapi_timer_wheel_rearm"
+
+external cancel : t -> handle -> unit = "caml_xapi_timer_wheel_cancel"
+
+external next_deadline : t -> int64 = "caml_xapi_timer_wheel_next_deadline"
+
+external pop_expired : t -> int64 -> handle
+  = "caml_xapi_timer_wheel_pop_expired"
+
+external timer_stats : t -> handle -> int * int * int * int
+  = "caml_xapi_timer_wheel_timer_stats"
+
+external stats : t -> int * int * int * int * int * int
+  = "caml_xapi_timer_wheel_stats"
+
+let ns_of_span span = Mtime.Span.to_uint64_ns span
+
+let ns_of_time time = Mtime.to_uint64_ns time
+
+let span_of_ns ns = Int64.of_int ns |> Mtime.Span.of_uint64_ns
+
+let create ?(tick = Mtime.Span.ms) ?(slack = Mtime.Span.zero) () =
+  create (ns_of_span tick) (ns_of_span slack)
+    (Mtime_clock.now () |> ns_of_time)
+
+let set_slack t slack = set_slack t (ns_of_span slack)
+
+let add t deadline = add t (ns_of_time deadline)
+
+let rearm t handle deadline = rearm t handle (ns_of_time deadline)
+
+let next_deadline t =
+  match next_deadline t with
+  | -1L ->
+      None
+  | ns ->
+      Some (Mtime.of_uint64_ns ns)
+
+let pop_expired t now =
+  match pop_expired t (ns_of_time now) with -1 -> None | handle -> Some handle
+
+let timer_stats t handle =
+  let fired, last, max, total = timer_stats t handle in
+  {
+    fired
+  ; last_latency= span_of_ns last
+  ; max_latency= span_of_ns max
+  ; total_latency= span_of_ns total
+  }
+
+let stats t =
+  let pending, added, cancelled, expired, cascaded, coalesced = stats t in
+  {pending; added; cancelled; expired; cascaded; coalesced}
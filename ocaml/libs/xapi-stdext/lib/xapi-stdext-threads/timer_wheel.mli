@@ -0,0 +1,82 @@
+(*
+ * Copyright (C) 2025 Cloud Software Group
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *)
+(** Hierarchical timer wheel.
+
+    Timers are identified by a {!handle}. Adding, re-arming and cancelling a
+    timer are O(1) operations. Deadlines are rounded up to the tick of the
+    wheel and can be delayed up to the [slack] of the wheel in order to make
+    near timers expire together.
+
+    The wheel does not do any locking, accesses must be serialised by the
+    caller. *)
+
+type t
+
+type handle = private int
+
+type timer_stats = {
+    fired: int  (** Number of times the timer expired *)
+  ; last_latency: Mtime.span
+        (** Delay between the deadline and the last expiry *)
+  ; max_latency: Mtime.span  (** Maximum delay between deadline and expiry *)
+  ; total_latency: Mtime.span  (** Sum of all delays *)
+}
+
+type stats = {
+    pending: int  (** Timers waiting to expire *)
+  ; added: int  (** Timers added since creation *)
+  ; cancelled: int  (** Timers cancelled before expiring *)
+  ; expired: int  (** Total expiries *)
+  ; cascaded: int  (** Timers moved between wheel levels *)
+  ; coalesced: int  (** Timers delayed to coalesce with others *)
+}
+
+val create : ?tick:Mtime.span -> ?slack:Mtime.span -> unit -> t
+(** [create ?tick ?slack ()] creates an empty wheel. [tick] is the
+    granularity of the wheel, 1 millisecond by default. [slack] is the
+    maximum delay a timer can be subject to in order to be coalesced with
+    others, 0 by default.
+    @raise Invalid_argument if [tick] is zero. *)
+
+val set_slack : t -> Mtime.span -> unit
+(** Change the slack used for timers armed from now on. *)
+
+val add : t -> Mtime.t -> handle
+(** [add wheel deadline] adds a timer expiring at [deadline]. *)
+
+val rearm : t -> handle -> Mtime.t -> unit
+(** [rearm wheel handle deadline] sets a new deadline for an existing timer,
+    expired or not. Latency statistics are preserved.
+    @raise Not_found if [handle] was cancelled. *)
+
+val cancel : t -> handle -> unit
+(** [cancel wheel handle] removes a timer and releases its handle.
+    Expired timers have to be cancelled too to release their resources.
+    @raise Not_found if [handle] was already cancelled. *)
+
+val next_deadline : t -> Mtime.t option
+(** Returns the time the wheel should be checked again or [None] if no
+    timer is pending. The value can be earlier than the next timer deadline
+    as the wheel could need to reorganise itself. *)
+
+val pop_expired : t -> Mtime.t -> handle option
+(** [pop_expired wheel now] returns a timer expired at or before [now].
+    Timers are returned in expiry order, each expired timer is returned once. *)
+
+val timer_stats : t -> handle -> timer_stats
+(** Latency statistics of a given timer.
+    @raise Not_found if [handle] was cancelled. *)
+
+val stats : t -> stats
+(** Global statistics of the wheel. *)
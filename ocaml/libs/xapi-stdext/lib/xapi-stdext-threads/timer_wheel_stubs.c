@@ -0,0 +1,559 @@
+/*
+ * Copyright (C) 2025 Cloud Software Group
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+/*
+ * Hierarchical timer wheel.
+ *
+ * Time is divided in ticks of a configurable length. Level 0 has one slot
+ * per tick, each upper level has slots covering 64 slots of the level below.
+ * A timer is placed in the lowest level able to contain its expiry; when the
+ * wheel reaches the start of an upper level slot the timers in it are moved
+ * down ("cascaded"). Insertion and cancellation are O(1), each timer is
+ * cascaded at most WHEEL_LEVELS times.
+ *
+ * Timers are kept in a single array and linked using indexes so they can be
+ * identified from OCaml using a simple integer handle. The handle contains a
+ * generation number to detect stale handles.
+ *
+ * No locking is done here, the caller must serialise the accesses. All
+ * functions are short and non blocking so they are called holding the
+ * OCaml runtime lock.
+ */
+
+#include <caml/mlvalues.h>
+#include <caml/memory.h>
+#include <caml/alloc.h>
+#include <caml/custom.h>
+#include <caml/fail.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1u << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 6
+/* number of ticks covered by the wheel */
+#define WHEEL_RANGE (UINT64_C(1) << (WHEEL_BITS * WHEEL_LEVELS))
+
+#define NIL (-1)
+
+/* timer states */
+enum {
+	TIMER_FREE,
+	TIMER_PENDING,
+	TIMER_EXPIRED,
+	TIMER_FIRED,
+};
+
+typedef struct tw_timer {
+	int32_t prev, next;
+	uint32_t gen;
+	uint8_t state;
+	/* level and slot, valid if state is TIMER_PENDING */
+	uint8_t level, slot;
+	/* tick the timer is placed at, includes coalescing */
+	uint64_t expires;
+	/* requested deadline */
+	uint64_t deadline_ns;
+	/* latency statistics */
+	uint64_t fired;
+	uint64_t last_latency_ns;
+	uint64_t max_latency_ns;
+	uint64_t total_latency_ns;
+} tw_timer;
+
+typedef struct tw_list {
+	int32_t head, tail;
+} tw_list;
+
+typedef struct timer_wheel {
+	uint64_t tick_ns;
+	uint64_t slack_ns;
+	/* last processed tick */
+	uint64_t now;
+	tw_list slots[WHEEL_LEVELS][WHEEL_SIZE];
+	uint64_t occupied[WHEEL_LEVELS];
+	/* expired timers, in expiry order */
+	tw_list expired;
+	tw_timer *timers;
+	uint32_t capacity;
+	int32_t free_list;
+	uint32_t pending;
+	/* global statistics */
+	uint64_t added;
+	uint64_t cancelled;
+	uint64_t fired;
+	uint64_t cascaded;
+	uint64_t coalesced;
+} timer_wheel;
+
+static inline uint64_t level_mask(unsigned level)
+{
+	return (UINT64_C(1) << (WHEEL_BITS * level)) - 1;
+}
+
+static inline unsigned level_index(uint64_t tick, unsigned level)
+{
+	return (tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+}
+
+static void list_append(timer_wheel *w, tw_list *l, int32_t idx)
+{
+	tw_timer *t = &w->timers[idx];
+
+	t->next = NIL;
+	t->prev = l->tail;
+	if (l->tail != NIL)
+		w->timers[l->tail].next = idx;
+	else
+		l->head = idx;
+	l->tail = idx;
+}
+
+static void list_unlink(timer_wheel *w, tw_list *l, int32_t idx)
+{
+	tw_timer *t = &w->timers[idx];
+
+	if (t->prev != NIL)
+		w->timers[t->prev].next = t->next;
+	else
+		l->head = t->next;
+	if (t->next != NIL)
+		w->timers[t->next].prev = t->prev;
+	else
+		l->tail = t->prev;
+	t->prev = t->next = NIL;
+}
+
+static void list_init(tw_list *l)
+{
+	l->head = l->tail = NIL;
+}
+
+static void wheel_init(timer_wheel *w, uint64_t tick_ns, uint64_t slack_ns,
+		       uint64_t now_ns)
+{
+	memset(w, 0, sizeof(*w));
+	w->tick_ns = tick_ns;
+	w->slack_ns = slack_ns;
+	w->now = now_ns / tick_ns;
+	for (unsigned l = 0; l < WHEEL_LEVELS; ++l)
+		for (unsigned s = 0; s < WHEEL_SIZE; ++s)
+			list_init(&w->slots[l][s]);
+	list_init(&w->expired);
+	w->free_list = NIL;
+}
+
+static void wheel_destroy(timer_wheel *w)
+{
+	caml_stat_free(w->timers);
+	w->timers = NULL;
+}
+
+// Allocate a timer, returns its index or NIL if out of memory.
+static int32_t timer_alloc(timer_wheel *w)
+{
+	if (w->free_list == NIL) {
+		uint32_t capacity = w->capacity ? w->capacity * 2 : 64;
+		tw_timer *timers;
+
+		if (capacity > INT32_MAX)
+			return NIL;
+		timers = caml_stat_resize_noexc(w->timers,
+						capacity * sizeof(*timers));
+		if (!timers)
+			return NIL;
+		w->timers = timers;
+		for (uint32_t i = capacity; i-- > w->capacity; ) {
+			memset(&timers[i], 0, sizeof(timers[i]));
+			timers[i].state = TIMER_FREE;
+			timers[i].next = w->free_list;
+			w->free_list = (int32_t) i;
+		}
+		w->capacity = capacity;
+	}
+
+	int32_t idx = w->free_list;
+	tw_timer *t = &w->timers[idx];
+	w->free_list = t->next;
+	uint32_t gen = t->gen + 1;
+	memset(t, 0, sizeof(*t));
+	t->gen = gen;
+	t->prev = t->next = NIL;
+	return idx;
+}
+
+static void timer_free(timer_wheel *w, int32_t idx)
+{
+	tw_timer *t = &w->timers[idx];
+
+	t->state = TIMER_FREE;
+	t->prev = NIL;
+	t->next = w->free_list;
+	w->free_list = idx;
+}
+
+// Choose the tick for a deadline.
+// Among the ticks in [deadline, deadline + slack] pick the one with more
+// trailing zeroes so timers with overlapping ranges end up in the same tick.
+static uint64_t wheel_coalesce(timer_wheel *w, uint64_t deadline_ns)
+{
+	uint64_t first = deadline_ns / w->tick_ns;
+	if (deadline_ns % w->tick_ns)
+		++first;
+	if (w->slack_ns == 0 || UINT64_MAX - deadline_ns < w->slack_ns)
+		return first;
+
+	uint64_t last = (deadline_ns + w->slack_ns) / w->tick_ns;
+	if (last <= first)
+		return first;
+	for (int bit = 63; bit > 0; --bit) {
+		uint64_t tick = last & ~((UINT64_C(1) << bit) - 1);
+		if (tick >= first) {
+			if (tick != first)
+				++w->coalesced;
+			return tick;
+		}
+	}
+	return last;
+}
+
+// Place a timer in the wheel given its expire tick.
+static void wheel_place(timer_wheel *w, int32_t idx)
+{
+	tw_timer *t = &w->timers[idx];
+
+	if (t->expires <= w->now) {
+		t->state = TIMER_EXPIRED;
+		list_append(w, &w->expired, idx);
+		return;
+	}
+
+	uint64_t delta = t->expires - w->now;
+	/* too far in the future, park it in the last slot reachable,
+	 * it will be moved down by the cascades */
+	uint64_t expires = t->expires;
+	if (delta >= WHEEL_RANGE) {
+		expires = w->now + WHEEL_RANGE - 1;
+		delta = WHEEL_RANGE - 1;
+	}
+
+	unsigned level = 0;
+	while (delta >= (UINT64_C(1) << (WHEEL_BITS * (level + 1))))
+		++level;
+
+	unsigned slot = level_index(expires, level);
+	t->state = TIMER_PENDING;
+	t->level = level;
+	t->slot = slot;
+	list_append(w, &w->slots[level][slot], idx);
+	w->occupied[level] |= UINT64_C(1) << slot;
+	++w->pending;
+}
+
+static void wheel_unplace(timer_wheel *w, int32_t idx)
+{
+	tw_timer *t = &w->timers[idx];
+
+	switch (t->state) {
+	case TIMER_PENDING: {
+		tw_list *l = &w->slots[t->level][t->slot];
+		list_unlink(w, l, idx);
+		if (l->head == NIL)
+			w->occupied[t->level] &= ~(UINT64_C(1) << t->slot);
+		--w->pending;
+		break;
+	}
+	case TIMER_EXPIRED:
+		list_unlink(w, &w->expired, idx);
+		break;
+	}
+	t->state = TIMER_FIRED;
+}
+
+// Move all timers in a slot to the proper position based on current time.
+static void wheel_cascade(timer_wheel *w, unsigned level, unsigned slot)
+{
+	tw_list *l = &w->slots[level][slot];
+	int32_t idx = l->head;
+
+	list_init(l);
+	w->occupied[level] &= ~(UINT64_C(1) << slot);
+	while (idx != NIL) {
+		int32_t next = w->timers[idx].next;
+		--w->pending;
+		if (level)
+			++w->cascaded;
+		wheel_place(w, idx);
+		idx = next;
+	}
+}
+
+// Compute next tick where something has to be done (a level 0 slot
+// expires or an upper slot has to be cascaded).
+// Returns UINT64_MAX if nothing is pending.
+static uint64_t wheel_next_tick(const timer_wheel *w)
+{
+	uint64_t res = UINT64_MAX;
+
+	for (unsigned level = 0; level < WHEEL_LEVELS; ++level) {
+		uint64_t occupied = w->occupied[level];
+		if (!occupied)
+			continue;
+
+		/* find first occupied slot after current one */
+		unsigned cur = level_index(w->now, level);
+		unsigned shift = (cur + 1) & WHEEL_MASK;
+		uint64_t rotated = shift ?
+			(occupied >> shift) | (occupied << (WHEEL_SIZE - shift)) :
+			occupied;
+		unsigned slot = (__builtin_ctzll(rotated) + shift) & WHEEL_MASK;
+
+		uint64_t base = w->now & ~level_mask(level + 1);
+		uint64_t tick = base | ((uint64_t) slot << (WHEEL_BITS * level));
+		if (tick <= w->now)
+			tick += UINT64_C(1) << (WHEEL_BITS * (level + 1));
+		if (tick < res)
+			res = tick;
+	}
+	return res;
+}
+
+// Process timers up to the given time.
+static void wheel_advance(timer_wheel *w, uint64_t now_ns)
+{
+	uint64_t target = now_ns / w->tick_ns;
+
+	while (w->now < target) {
+		uint64_t tick = wheel_next_tick(w);
+		if (tick > target) {
+			w->now = target;
+			break;
+		}
+		w->now = tick;
+
+		/* cascade upper levels whose slot starts at this tick */
+		for (unsigned level = 1; level < WHEEL_LEVELS; ++level) {
+			if (tick & level_mask(level))
+				break;
+			wheel_cascade(w, level, level_index(tick, level));
+		}
+		wheel_cascade(w, 0, level_index(tick, 0));
+	}
+}
+
+static int32_t wheel_pop_expired(timer_wheel *w, uint64_t now_ns)
+{
+	int32_t idx = w->expired.head;
+
+	if (idx == NIL)
+		return NIL;
+
+	tw_timer *t = &w->timers[idx];
+	list_unlink(w, &w->expired, idx);
+	t->state = TIMER_FIRED;
+
+	uint64_t latency = now_ns > t->deadline_ns ? now_ns - t->deadline_ns : 0;
+	++t->fired;
+	t->last_latency_ns = latency;
+	if (latency > t->max_latency_ns)
+		t->max_latency_ns = latency;
+	t->total_latency_ns += latency;
+	++w->fired;
+	return idx;
+}
+
+static void wheel_arm(timer_wheel *w, int32_t idx, uint64_t deadline_ns)
+{
+	tw_timer *t = &w->timers[idx];
+
+	t->deadline_ns = deadline_ns;
+	t->expires = wheel_coalesce(w, deadline_ns);
+	wheel_place(w, idx);
+}
+
+/* OCaml bindings */
+
+// handles are composed by index (lower 32 bits) and generation
+#define HANDLE_INDEX_BITS 32
+#define HANDLE_GEN_MASK ((UINT32_C(1) << 30) - 1)
+
+static inline value handle_val(const timer_wheel *w, int32_t idx)
+{
+	uint64_t gen = w->timers[idx].gen & HANDLE_GEN_MASK;
+	return Val_long((intnat) ((gen << HANDLE_INDEX_BITS) | (uint32_t) idx));
+}
+
+// Get timer index from handle, raises Not_found for stale handles.
+static int32_t index_val(const timer_wheel *w, value v_handle)
+{
+	uint64_t handle = (uint64_t) Long_val(v_handle);
+	uint64_t idx = handle & 0xffffffffu;
+	uint32_t gen = (uint32_t) (handle >> HANDLE_INDEX_BITS);
+
+	if (idx >= w->capacity || w->timers[idx].state == TIMER_FREE
+	    || (w->timers[idx].gen & HANDLE_GEN_MASK) != gen)
+		caml_raise_not_found();
+	return (int32_t) idx;
+}
+
+#define wheel_val(v) (*((timer_wheel **)Data_custom_val(v)))
+
+static void wheel_finalize(value v_wheel)
+{
+	timer_wheel *w = wheel_val(v_wheel);
+	wheel_destroy(w);
+	caml_stat_free(w);
+}
+
+static struct custom_operations wheel_ops = {
+	"xapi.timer_wheel",
+	wheel_finalize,
+	custom_compare_default,
+	custom_hash_default,
+	custom_serialize_default,
+	custom_deserialize_default,
+	custom_compare_ext_default,
+	custom_fixed_length_default
+};
+
+CAMLprim value caml_xapi_timer_wheel_create(value v_tick, value v_slack,
+					    value v_now)
+{
+	CAMLparam3(v_tick, v_slack, v_now);
+	CAMLlocal1(res);
+	timer_wheel *w;
+	int64_t tick = Int64_val(v_tick);
+	int64_t slack = Int64_val(v_slack);
+
+	if (tick <= 0 || slack < 0)
+		caml_invalid_argument("Timer_wheel.create");
+
+	w = caml_stat_alloc(sizeof(*w));
+	wheel_init(w, tick, slack, (uint64_t) Int64_val(v_now));
+	res = caml_alloc_custom(&wheel_ops, sizeof(timer_wheel *), 0, 1);
+	wheel_val(res) = w;
+	CAMLreturn(res);
+}
+
+CAMLprim value caml_xapi_timer_wheel_set_slack(value v_wheel, value v_slack)
+{
+	timer_wheel *w = wheel_val(v_wheel);
+	int64_t slack = Int64_val(v_slack);
+
+	if (slack < 0)
+		caml_invalid_argument("Timer_wheel.set_slack");
+	w->slack_ns = slack;
+	return Val_unit;
+}
+
+CAMLprim value caml_xapi_timer_wheel_add(value v_wheel, value v_deadline)
+{
+	timer_wheel *w = wheel_val(v_wheel);
+	int32_t idx = timer_alloc(w);
+
+	if (idx == NIL)
+		caml_raise_out_of_memory();
+	++w->added;
+	wheel_arm(w, idx, (uint64_t) Int64_val(v_deadline));
+	return handle_val(w, idx);
+}
+
+CAMLprim value caml_xapi_timer_wheel_rearm(value v_wheel, value v_handle,
+					   value v_deadline)
+{
+	timer_wheel *w = wheel_val(v_wheel);
+	int32_t idx = index_val(w, v_handle);
+
+	wheel_unplace(w, idx);
+	wheel_arm(w, idx, (uint64_t) Int64_val(v_deadline));
+	return Val_unit;
+}
+
+CAMLprim value caml_xapi_timer_wheel_cancel(value v_wheel, value v_handle)
+{
+	timer_wheel *w = wheel_val(v_wheel);
+	int32_t idx = index_val(w, v_handle);
+
+	if (w->timers[idx].state != TIMER_FIRED)
+		++w->cancelled;
+	wheel_unplace(w, idx);
+	timer_free(w, idx);
+	return Val_unit;
+}
+
+CAMLprim value caml_xapi_timer_wheel_next_deadline(value v_wheel)
+{
+	CAMLparam1(v_wheel);
+	timer_wheel *w = wheel_val(v_wheel);
+	uint64_t tick;
+	int64_t res;
+
+	if (w->expired.head != NIL)
+		tick = w->now;
+	else
+		tick = wheel_next_tick(w);
+
+	if (tick == UINT64_MAX || tick > INT64_MAX / w->tick_ns)
+		res = -1;
+	else
+		res = tick * w->tick_ns;
+	CAMLreturn(caml_copy_int64(res));
+}
+
+CAMLprim value caml_xapi_timer_wheel_pop_expired(value v_wheel, value v_now)
+{
+	timer_wheel *w = wheel_val(v_wheel);
+	uint64_t now = (uint64_t) Int64_val(v_now);
+	int32_t idx;
+
+	wheel_advance(w, now);
+	idx = wheel_pop_expired(w, now);
+	if (idx == NIL)
+		return Val_long(-1);
+	return handle_val(w, idx);
+}
+
+CAMLprim value caml_xapi_timer_wheel_timer_stats(value v_wheel, value v_handle)
+{
+	CAMLparam2(v_wheel, v_handle);
+	CAMLlocal1(res);
+	timer_wheel *w = wheel_val(v_wheel);
+	const tw_timer *t = &w->timers[index_val(w, v_handle)];
+
+	res = caml_alloc_tuple(4);
+	Store_field(res, 0, Val_long(t->fired));
+	Store_field(res, 1, Val_long(t->last_latency_ns));
+	Store_field(res, 2, Val_long(t->max_latency_ns));
+	Store_field(res, 3, Val_long(t->total_latency_ns));
+	CAMLreturn(res);
+}
+
+CAMLprim value caml_xapi_timer_wheel_stats(value v_wheel)
+{
+	CAMLparam1(v_wheel);
+	CAMLlocal1(res);
+	const timer_wheel *w = wheel_val(v_wheel);
+
+	res = caml_alloc_tuple(6);
+	Store_field(res, 0, Val_long(w->pending));
+	Store_field(res, 1, Val_long(w->added));
+	Store_field(res, 2, Val_long(w->cancelled));
+	Store_field(res, 3, Val_long(w->fired));
+	Store_field(res, 4, Val_long(w->cascaded));
+	Store_field(res, 5, Val_long(w->coalesced));
+	CAMLreturn(res);
+}
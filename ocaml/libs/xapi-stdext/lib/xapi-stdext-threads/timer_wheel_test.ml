@@ -0,0 +1,125 @@
+(*
+ * Copyright (C) 2025 Cloud Software Group
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *)
+
+module Timer_wheel = Xapi_stdext_threads.Timer_wheel
+
+let after base span = Mtime.add_span base span |> Option.get
+
+let pop_all wheel now =
+  let rec loop acc =
+    match Timer_wheel.pop_expired wheel now with
+    | Some h ->
+        loop (h :: acc)
+    | None ->
+        List.rev acc
+  in
+  loop []
+
+let handle =
+  let pp fmt (h : Timer_wheel.handle) = Fmt.int fmt (h :> int) in
+  Alcotest.testable pp ( = )
+
+(* timers expire in order and not before their deadline *)
+let test_order () =
+  let wheel = Timer_wheel.create () in
+  let base = Mtime_clock.now () in
+  let spans = Mtime.Span.[5 * s; 10 * ms; 70 * ms; 5 * min; 2 * ms] in
+  let handles =
+    List.map (fun span -> (span, Timer_wheel.add wheel (after base span))) spans
+  in
+  let expect span =
+    List.filter (fun (s, _) -> Mtime.Span.compare s span <= 0) handles
+    |> List.sort (fun (a, _) (b, _) -> Mtime.Span.compare a b)
+    |> List.map snd
+  in
+  let check_at span seen =
+    let now = after base span in
+    let got = seen @ pop_all wheel now in
+    Alcotest.(check (list handle)) "expired timers" (expect span) got ;
+    got
+  in
+  let seen = check_at Mtime.Span.(5 * ms) [] in
+  let seen = check_at Mtime.Span.(50 * ms) seen in
+  let seen = check_at Mtime.Span.(1 * s) seen in
+  let seen = check_at Mtime.Span.(1 * min) seen in
+  let _ = check_at Mtime.Span.(1 * hour) seen in
+  let stats = Timer_wheel.stats wheel in
+  Alcotest.(check int) "no pending" 0 stats.Timer_wheel.pending
+
+(* cancelled timers do not expire and their handles are invalid *)
+let test_cancel () =
+  let wheel = Timer_wheel.create () in
+  let base = Mtime_clock.now () in
+  let h1 = Timer_wheel.add wheel (after base Mtime.Span.(10 * ms)) in
+  let h2 = Timer_wheel.add wheel (after base Mtime.Span.(20 * ms)) in
+  Timer_wheel.cancel wheel h1 ;
+  Alcotest.check_raises "stale handle" Not_found (fun () ->
+      Timer_wheel.cancel wheel h1
+  ) ;
+  let h3 = Timer_wheel.add wheel (after base Mtime.Span.(30 * ms)) in
+  Alcotest.(check bool) "handle not reused" true (h1 <> h3) ;
+  let got = pop_all wheel (after base Mtime.Span.(1 * s)) in
+  Alcotest.(check (list handle)) "expired timers" [h2; h3] got
+
+(* rearm keeps latency statistics *)
+let test_rearm () =
+  let wheel = Timer_wheel.create () in
+  let base = Mtime_clock.now () in
+  let h = Timer_wheel.add wheel (after base Mtime.Span.(10 * ms)) in
+  let now = after base Mtime.Span.(15 * ms) in
+  Alcotest.(check (list handle)) "first expiry" [h] (pop_all wheel now) ;
+  Timer_wheel.rearm wheel h (after now Mtime.Span.(10 * ms)) ;
+  Alcotest.(check (list handle)) "not yet" [] (pop_all wheel now) ;
+  let now = after now Mtime.Span.(12 * ms) in
+  Alcotest.(check (list handle)) "second expiry" [h] (pop_all wheel now) ;
+  let stats = Timer_wheel.timer_stats wheel h in
+  Alcotest.(check int) "fired" 2 stats.Timer_wheel.fired ;
+  Alcotest.(check int64)
+    "max latency"
+    Mtime.Span.(5 * ms |> to_uint64_ns)
+    (Mtime.Span.to_uint64_ns stats.max_latency)
+
+(* timers with overlapping slack expire together *)
+let test_coalesce () =
+  let wheel = Timer_wheel.create ~slack:Mtime.Span.(100 * ms) () in
+  (* a tick aligned to 1024 ticks, the best candidate to coalesce timers
+     which can expire around it *)
+  let aligned =
+    let ms = Mtime.Span.(to_uint64_ns ms) in
+    let now = Mtime.to_uint64_ns (Mtime_clock.now ()) in
+    Int64.(mul (mul (add (div (div now ms) 1024L) 2L) 1024L) ms)
+    |> Mtime.of_uint64_ns
+  in
+  let before span = Mtime.sub_span aligned span |> Option.get in
+  let ms = Mtime.Span.ms in
+  let handles =
+    List.map
+      (fun span -> Timer_wheel.add wheel (before span))
+      Mtime.Span.[60 * ms; 30 * ms; 10 * ms]
+  in
+  Alcotest.(check (list handle)) "delayed" [] (pop_all wheel (before ms)) ;
+  Alcotest.(check (list handle))
+    "all together" handles (pop_all wheel aligned) ;
+  let stats = Timer_wheel.stats wheel in
+  Alcotest.(check int) "coalesced" 3 stats.Timer_wheel.coalesced
+
+let tests =
+  [
+    ("test_order", `Quick, test_order)
+  ; ("test_cancel", `Quick, test_cancel)
+  ; ("test_rearm", `Quick, test_rearm)
+  ; ("test_coalesce", `Quick, test_coalesce)
+  ]
+
+let () = Alcotest.run "Timer_wheel" [("generic", tests)]
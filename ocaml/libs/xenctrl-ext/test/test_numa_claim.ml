@@ -0,0 +1,62 @@
+open Xenctrlext
+
+(* nodes on a line, one hop between neighbours *)
+let distance a b = if a = b then 10 else 10 + (11 * abs (a - b))
+
+let split = Alcotest.(option (list (pair int int)))
+
+let check name ~available ~preference nr_pages expected () =
+  Alcotest.check split name expected
+    (NumaClaim.split ~distance ~available ~preference nr_pages)
+
+let tests =
+  [
+    ( "Fewest nodes"
+    , `Quick
+    , check "one node is enough" ~available:[|100; 300; 100; 100|]
+        ~preference:[0; 1; 2; 3] 250
+        (Some [(1, 250)])
+    )
+  ; ( "Nearest nodes"
+    , `Quick
+    , check "the preferred node is far from the others"
+        ~available:[|150; 150; 150; 150|] ~preference:[3; 0; 1] 200
+        (Some [(0, 150); (1, 50)])
+    )
+  ; ( "Preferred nodes"
+    , `Quick
+    , check "same number of nodes and distance"
+        ~available:[|100; 100; 100; 100|] ~preference:[2; 0] 50
+        (Some [(2, 50)])
+    )
+  ; ( "Nodes without memory"
+    , `Quick
+    , check "skipped" ~available:[|0; 100|] ~preference:[0; 1] 50
+        (Some [(1, 50)])
+    )
+  ; ( "Invalid preference"
+    , `Quick
+    , check "duplicates and unknown nodes ignored" ~available:[|100; 100|]
+        ~preference:[5; -1; 1; 1; 0; 2] 150
+        (Some [(1, 100); (0, 50)])
+    )
+  ; ( "Not enough memory"
+    , `Quick
+    , check "on all nodes" ~available:[|100; 100|] ~preference:[0; 1] 300 None
+    )
+  ; ( "Not enough memory on the preferred nodes"
+    , `Quick
+    , check "other nodes unused" ~available:[|100; 100|] ~preference:[0] 150
+        None
+    )
+  ; ( "No pages"
+    , `Quick
+    , check "empty split" ~available:[|100|] ~preference:[0] 0 (Some [])
+    )
+  ; ( "Negative pages"
+    , `Quick
+    , check "empty split" ~available:[|100|] ~preference:[0] (-1) (Some [])
+    )
+  ]
+
+let () = Alcotest.run "NUMA claims" [("split", tests)]
@@ -0,0 +1,65 @@
+open Xenctrlext
+
+let runstate =
+  let pp ppf r =
+    Format.fprintf ppf "{state=%ld; missed_changes=%ld; times=%Ld %Ld..%Ld}"
+      r.state r.missed_changes r.state_entry_time r.time0 r.time5
+  in
+  Alcotest.testable pp ( = )
+
+let row state missed_changes =
+  {
+    state
+  ; missed_changes
+  ; state_entry_time= 1000L
+  ; time0= 10L
+  ; time1= 11L
+  ; time2= 12L
+  ; time3= 13L
+  ; time4= 14L
+  ; time5= 15L
+  }
+
+(* fill the batch the way the stub does *)
+let set batch i r =
+  batch.{i, 0} <- Int64.of_int32 r.state ;
+  batch.{i, 1} <- Int64.of_int32 r.missed_changes ;
+  batch.{i, 2} <- r.state_entry_time ;
+  batch.{i, 3} <- r.time0 ;
+  batch.{i, 4} <- r.time1 ;
+  batch.{i, 5} <- r.time2 ;
+  batch.{i, 6} <- r.time3 ;
+  batch.{i, 7} <- r.time4 ;
+  batch.{i, 8} <- r.time5
+
+let test_rows () =
+  let batch = runstate_batch_create 3 in
+  set batch 0 (row 0l 0l) ;
+  set batch 1 (row 2l 5l) ;
+  (* failed query: negative state, errno in the second column *)
+  Bigarray.Array2.fill (Bigarray.Array2.slice_left batch 2) 0L ;
+  batch.{2, 0} <- -1L ;
+  batch.{2, 1} <- 3L ;
+  Alcotest.(check (option runstate))
+    "first row" (Some (row 0l 0l)) (runstate_batch_get batch 0) ;
+  Alcotest.(check (option runstate))
+    "second row" (Some (row 2l 5l)) (runstate_batch_get batch 1) ;
+  Alcotest.(check (option runstate))
+    "failed row" None (runstate_batch_get batch 2)
+
+let test_reused () =
+  let batch = runstate_batch_create 1 in
+  set batch 0 (row 1l 1l) ;
+  Alcotest.(check (option runstate))
+    "first sample" (Some (row 1l 1l)) (runstate_batch_get batch 0) ;
+  batch.{0, 0} <- -1L ;
+  Alcotest.(check (option runstate))
+    "failed in the next sample" None (runstate_batch_get batch 0)
+
+let tests =
+  [
+    ("Rows", `Quick, test_rows)
+  ; ("Reused batch", `Quick, test_reused)
+  ]
+
+let () = Alcotest.run "Runstate batch" [("runstate_batch_get", tests)]
@@ -108,6 +108,38 @@ external domain_get_runstate_info : handle -> int -> runstateinfo
 (* this is always in our patchqueue, but not part of upstream Xen *)
 let domain_get_runstate_info = wrap1 ~__FUNCTION__ domain_get_runstate_info
 
+type runstate_batch =
+  (int64, Bigarray.int64_elt, Bigarray.c_layout) Bigarray.Array2.t
+
+let runstate_batch_create n =
+  Bigarray.(Array2.create int64 c_layout n 9)
+
+external domain_get_runstate_info_batch :
+  handle -> domid array -> runstate_batch -> unit
+  = "stub_xenctrlext_get_runstate_info_batch"
+
+let domain_get_runstate_info_batch xc domids batch =
+  wrap ~__FUNCTION__ @@ fun () ->
+  domain_get_runstate_info_batch xc domids batch
+
+let runstate_batch_get batch i =
+  let ( .%{} ) = Bigarray.Array2.get in
+  if batch.%{i, 0} < 0L then
+    None
+  else
+    Some
+      {
+        state= Int64.to_int32 batch.%{i, 0}
+      ; missed_changes= Int64.to_int32 batch.%{i, 1}
+      ; state_entry_time= batch.%{i, 2}
+      ; time0= batch.%{i, 3}
+      ; time1= batch.%{i, 4}
+      ; time2= batch.%{i, 5}
+      ; time3= batch.%{i, 6}
+      ; time4= batch.%{i, 7}
+      ; time5= batch.%{i, 8}
+      }
+
 external get_max_nr_cpus : handle -> int = "stub_xenctrlext_get_max_nr_cpus"
 
 external domain_set_target : handle -> domid -> domid -> unit
@@ -140,6 +172,13 @@ let vcpu_setaffinity_soft xc domid vcpu affinity =
   wrap3 ~__FUNCTION__ vcpu_setaffinity_soft xc domid vcpu affinity
   |> handle_outcome ~default:()
 
+external vcpu_getaffinity :
+  handle -> domid -> int -> bool array * bool array
+  = "stub_xenctrlext_vcpu_getaffinity"
+
+let vcpu_getaffinity xc domid vcpu =
+  wrap ~__FUNCTION__ @@ fun () -> vcpu_getaffinity xc domid vcpu
+
 type meminfo = {memfree: int64; memsize: int64}
 
 type numainfo = {memory: meminfo array; distances: int array array}
@@ -183,6 +222,202 @@ module HostNuma = struct
   let numa_get_meminfo = wrap0 ~__FUNCTION__ numa_get_meminfo
 end
 
+module NumaSnapshot = struct
+  type raw = {
+      size: int array
+    ; free: int array
+    ; claimed: int array
+    ; distances: int array
+    ; cpu_core: int array
+    ; cpu_socket: int array
+    ; cpu_node: int array
+  }
+
+  external query : handle -> raw = "stub_xenctrlext_numa_snapshot"
+
+  type t = {raw: raw; generation: int; topology_generation: int}
+
+  let same_topology a b =
+    a.distances = b.distances
+    && a.cpu_core = b.cpu_core
+    && a.cpu_socket = b.cpu_socket
+    && a.cpu_node = b.cpu_node
+
+  let last = Atomic.make None
+
+  let rec publish raw =
+    let prev = Atomic.get last in
+    let next =
+      match prev with
+      | Some t when t.raw = raw ->
+          t
+      | Some t ->
+          let topology_generation =
+            if same_topology t.raw raw then
+              t.topology_generation
+            else
+              t.topology_generation + 1
+          in
+          {raw; generation= t.generation + 1; topology_generation}
+      | None ->
+          {raw; generation= 0; topology_generation= 0}
+    in
+    match prev with
+    | Some t when t == next ->
+        next
+    | _ ->
+        if Atomic.compare_and_set last prev (Some next) then
+          next
+        else
+          publish raw
+
+  let get handle = wrap ~__FUNCTION__ @@ fun () -> publish (query handle)
+
+  let generation t = t.generation
+
+  let topology_generation t = t.topology_generation
+
+  let nodes t = Array.length t.raw.size
+
+  let cpus t = Array.length t.raw.cpu_node
+
+  let size t node = t.raw.size.(node)
+
+  let free t node = t.raw.free.(node)
+
+  let claimed t node = t.raw.claimed.(node)
+
+  let distance t a b = t.raw.distances.((a * nodes t) + b)
+
+  let distances t =
+    let n = nodes t in
+    Array.init n (fun a -> Array.sub t.raw.distances (a * n) n)
+
+  let cpu_core t cpu = t.raw.cpu_core.(cpu)
+
+  let cpu_socket t cpu = t.raw.cpu_socket.(cpu)
+
+  let cpu_node t cpu = t.raw.cpu_node.(cpu)
+
+  let cpu_to_node t = Array.copy t.raw.cpu_node
+end
+
+external domain_node_setaffinity : handle -> domid -> bool array -> unit
+  = "stub_xenctrlext_domain_node_setaffinity"
+
+let domain_node_setaffinity handle domid nodemap =
+  wrap ~__FUNCTION__ @@ fun () -> domain_node_setaffinity handle domid nodemap
+
+module NumaClaim = struct
+  type split = (int * int) list
+
+  let page_size = 4096
+
+  let split ~distance ~available ~preference nr_pages =
+    let nodes = Array.length available in
+    (* keep the first occurrence of each valid node *)
+    let preference =
+      List.fold_left
+        (fun acc n ->
+          if n < 0 || n >= nodes || List.mem n acc then acc else n :: acc
+        )
+        [] preference
+      |> List.rev
+    in
+    let rank = Array.make nodes max_int in
+    List.iteri (fun i n -> rank.(n) <- i) preference ;
+    (* Starting from [anchor], add the nearest nodes until the claim fits,
+       preferring the larger ones when at the same distance *)
+    let from anchor =
+      let key n = (distance anchor n, -available.(n), rank.(n)) in
+      let others =
+        List.filter (( <> ) anchor) preference
+        |> List.stable_sort (fun a b -> compare (key a) (key b))
+      in
+      let rec take acc remaining = function
+        | _ when remaining <= 0 ->
+            Some (List.rev acc)
+        | [] ->
+            None
+        | n :: rest when available.(n) <= 0 ->
+            take acc remaining rest
+        | n :: rest ->
+            let pages = min available.(n) remaining in
+            take ((n, pages) :: acc) (remaining - pages) rest
+      in
+      take [] nr_pages (anchor :: others)
+    in
+    (* fewest nodes first, then nearest, then most preferred *)
+    let cost split =
+      let nodes = List.map fst split in
+      let distances =
+        List.concat_map (fun a -> List.map (fun b -> distance a b) nodes) nodes
+      in
+      ( List.length split
+      , List.fold_left max 0 distances
+      , List.fold_left ( + ) 0 distances
+      , rank.(fst (List.hd split))
+      )
+    in
+    if nr_pages <= 0 then
+      Some []
+    else
+      let candidates =
+        preference
+        |> List.filter (fun n -> available.(n) > 0)
+        |> List.filter_map from
+        |> List.map (fun split -> (cost split, split))
+        |> List.sort (fun (a, _) (b, _) -> compare a b)
+      in
+      match candidates with [] -> None | (_, split) :: _ -> Some split
+
+  type claimed = On_node of int | On_host of split
+
+  (* Xen holds a single claim per domain, either on one node or on the whole
+     host. A claim spanning nodes is made on the host, and the node affinity
+     of the domain restricted to the nodes of the split so that its memory is
+     allocated from them. *)
+  let claim_nodes handle domid ~nodes split nr_pages =
+    let ( let* ) = Result.bind in
+    let* () = domain_claim_pages handle domid nr_pages in
+    let nodemap = Array.make nodes false in
+    List.iter (fun (n, _) -> nodemap.(n) <- true) split ;
+    domain_node_setaffinity handle domid nodemap |> handle_outcome ~default:() ;
+    Ok (On_host split)
+
+  let claim handle domid ~preference nr_pages =
+    let ( let* ) = Result.bind in
+    if nr_pages <= 0 then
+      Ok (On_host [])
+    else
+      let* snapshot = NumaSnapshot.get handle in
+      let nodes = NumaSnapshot.nodes snapshot in
+      let available =
+        Array.init nodes (fun n ->
+            max 0
+              (NumaSnapshot.free snapshot n - NumaSnapshot.claimed snapshot n)
+            / page_size
+        )
+      in
+      let distance = NumaSnapshot.distance snapshot in
+      match split ~distance ~available ~preference nr_pages with
+      | None ->
+          error ~__FUNCTION__ Unix.ENOMEM __FUNCTION__
+      | Some ([(node, _)] as split) -> (
+          let numa_node = NumaNode.from node in
+          match domain_claim_pages handle domid ~numa_node nr_pages with
+          | Ok () ->
+              Ok (On_node node)
+          | Error ((Unix.ENOMEM, _) as e) ->
+              Error e
+          | Error _ ->
+              (* no claims on a single node in this version of Xen *)
+              claim_nodes handle domid ~nodes split nr_pages
+        )
+      | Some split ->
+          claim_nodes handle domid ~nodes split nr_pages
+end
+
 let get_nr_nodes handle =
   let meminfo = HostNuma.numa_get_meminfo handle in
   Result.map Array.length meminfo
@@ -55,6 +55,28 @@ type runstateinfo = {
 
 val domain_get_runstate_info : handle -> int -> runstateinfo outcome
 
+(** Runstates of several domains, one row per domain with the columns state,
+    missed_changes, state_entry_time and time0 to time5 of [runstateinfo].
+    A row with a negative state holds the errno of the failed query in its
+    second column instead. *)
+type runstate_batch =
+  (int64, Bigarray.int64_elt, Bigarray.c_layout) Bigarray.Array2.t
+
+val runstate_batch_create : int -> runstate_batch
+(** [runstate_batch_create n] allocates a batch for up to [n] domains. Reuse
+    it across samples to avoid allocating. *)
+
+val domain_get_runstate_info_batch :
+  handle -> domid array -> runstate_batch -> unit outcome
+(** [domain_get_runstate_info_batch xc domids batch] stores the runstate of
+    [domids.(i)] in row [i] of [batch], querying all of them without taking
+    the runtime lock in between. Failures of single domains, e.g. destroyed
+    since they were listed, are recorded in their rows. *)
+
+val runstate_batch_get : runstate_batch -> int -> runstateinfo option
+(** [runstate_batch_get batch i] is the runstate in row [i], [None] if the
+    query of that domain failed *)
+
 external get_max_nr_cpus : handle -> int = "stub_xenctrlext_get_max_nr_cpus"
 
 external domain_set_target : handle -> domid -> domid -> unit
@@ -87,6 +109,11 @@ val vcpu_setaffinity_hard : handle -> domid -> int -> bool array -> unit
 
 val vcpu_setaffinity_soft : handle -> domid -> int -> bool array -> unit
 
+val vcpu_getaffinity :
+  handle -> domid -> int -> (bool array * bool array) outcome
+(** [vcpu_getaffinity xc domid vcpu] is the hard and soft affinity of [vcpu],
+    one element per pCPU *)
+
 val numainfo : handle -> numainfo
 
 val cputopoinfo : handle -> cputopo array
@@ -111,9 +138,98 @@ val domain_claim_pages :
     Returns {`Not_available msg} if a single numa node is requested and xen does not
     provide page claiming for single numa nodes. *)
 
+val domain_node_setaffinity : handle -> domid -> bool array -> unit outcome
+(** [domain_node_setaffinity handle domid nodemap] restricts the NUMA nodes
+    memory of [domid] is allocated from to those set in [nodemap] *)
+
 val get_nr_nodes : handle -> int outcome
 (** Returns the count of NUMA nodes available in the system. *)
 
+(** Topology and memory of the NUMA nodes of the host, queried at once.
+    Values are kept unboxed in flat arrays and are immutable. *)
+module NumaSnapshot : sig
+  type t
+
+  val get : handle -> t outcome
+  (** [get handle] queries the current state. If nothing changed since the
+      previous call the previous snapshot is returned, physically equal. *)
+
+  val generation : t -> int
+  (** Incremented every time [get] observes a change, of memory or
+      topology *)
+
+  val topology_generation : t -> int
+  (** Incremented every time [get] observes a change of distances or CPU
+      maps: anything derived from these can be cached until it changes *)
+
+  val nodes : t -> int
+
+  val cpus : t -> int
+
+  val size : t -> int -> int
+  (** [size t node] is the memory of [node] in bytes, as are [free] and
+      [claimed] *)
+
+  val free : t -> int -> int
+
+  val claimed : t -> int -> int
+  (** 0 if Xen does not report memory claimed per node *)
+
+  val distance : t -> int -> int -> int
+  (** [distance t a b] is the distance from node [a] to node [b] *)
+
+  val distances : t -> int array array
+  (** Fresh copy of the distances as a matrix *)
+
+  val cpu_core : t -> int -> int
+
+  val cpu_socket : t -> int -> int
+
+  val cpu_node : t -> int -> int
+
+  val cpu_to_node : t -> int array
+  (** Fresh copy of the node of each CPU *)
+end
+
+(** Memory claims spanning several NUMA nodes *)
+module NumaClaim : sig
+  type split = (int * int) list
+  (** Pages to allocate from each node, the first node being the one the
+      others were chosen to be close to *)
+
+  val split :
+       distance:(int -> int -> int)
+    -> available:int array
+    -> preference:int list
+    -> int
+    -> split option
+  (** [split ~distance ~available ~preference nr_pages] chooses the fewest
+      nodes of [preference] that together have [nr_pages] [available], and
+      among those the nearest to each other, then the earliest in
+      [preference]. Nodes are filled in order: the first one as much as
+      possible, then the nearest to it. [None] if the nodes of [preference]
+      don't have enough pages altogether. *)
+
+  (** Where the pages of a domain were claimed *)
+  type claimed =
+    | On_node of int  (** from this node *)
+    | On_host of split
+        (** from the whole host, the node affinity of the domain being the
+            nodes of the split so that its memory is allocated from them *)
+
+  val claim : handle -> domid -> preference:int list -> int -> claimed outcome
+  (** [claim handle domid ~preference nr_pages] claims [nr_pages] for
+      [domid] from the nodes chosen by [split] according to the memory free
+      and not claimed on the host.
+
+      Xen only holds one claim per domain. When the split spans several
+      nodes, or Xen can't claim pages from a single node, the pages are
+      claimed from the whole host and the node affinity of [domid] is set to
+      the nodes of the split. Returns [ENOMEM] if the pages can't be
+      claimed, and [On_host []] without claiming anything if [nr_pages] is
+      not positive. *)
+end
+
 module DomainNuma : sig
   type domain_numainfo_node_pages = {
       tot_pages_per_node: int64 array (* page=4k bytes *)
@@ -149,6 +149,60 @@ CAMLprim value stub_xenctrlext_get_runstate_info(value xch_val,
 #endif
 }
 
+/* Columns of a row of the runstate batch, see runstate_batch in
+   xenctrlext.mli */
+#define RUNSTATE_COLUMNS 9
+
+CAMLprim value stub_xenctrlext_get_runstate_info_batch(value xch_val,
+                                                       value domids,
+                                                       value batch)
+{
+    CAMLparam3(xch_val, domids, batch);
+#if defined(XENCTRL_HAS_GET_RUNSTATE_INFO)
+    xc_interface *xch = xch_of_val(xch_val);
+    struct caml_ba_array *ba = Caml_ba_array_val(batch);
+    int64_t *rows = ba->data;
+    mlsize_t n = Wosize_val(domids), i;
+    uint32_t *c_domids;
+
+    if (ba->num_dims != 2 || ba->dim[0] < n
+        || ba->dim[1] != RUNSTATE_COLUMNS)
+        caml_invalid_argument("runstate batch too small");
+
+    c_domids = caml_stat_alloc(n * sizeof(*c_domids) + 1);
+    for (i = 0; i < n; i++)
+        c_domids[i] = Int_val(Field(domids, i));
+
+    /* the data of the bigarray is outside the OCaml heap, it does not move
+       and is kept alive by the batch parameter */
+    caml_release_runtime_system();
+    for (i = 0; i < n; i++) {
+        int64_t *row = rows + i * RUNSTATE_COLUMNS;
+        xc_runstate_info_t info;
+
+        if (xc_get_runstate_info(xch, c_domids[i], &info) < 0) {
+            /* domain destroyed since it was listed, most likely; clear
+               the values of the previous sample */
+            memset(row, 0, RUNSTATE_COLUMNS * sizeof(*row));
+            row[0] = -1;
+            row[1] = errno;
+            continue;
+        }
+        row[0] = info.state;
+        row[1] = info.missed_changes;
+        row[2] = info.state_entry_time;
+        for (int t = 0; t < 6; t++)
+            row[3 + t] = info.time[t];
+    }
+    caml_acquire_runtime_system();
+
+    caml_stat_free(c_domids);
+    CAMLreturn(Val_unit);
+#else
+    caml_failwith("XENCTRL_HAS_GET_RUNSTATE_INFO not defined");
+#endif
+}
+
 static int xcext_domain_send_s3resume(xc_interface *xch,
                                       unsigned int domid)
 {
@@ -403,6 +457,61 @@ CAMLprim value stub_xenctrlext_vcpu_setaffinity_soft(value xch_val,
     CAMLreturn(Val_unit);
 }
 
+static value alloc_cpumap(const xc_cpumap_t cpumap, int len)
+{
+    CAMLparam0();
+    CAMLlocal1(result);
+    int i;
+
+    result = caml_alloc(len, 0);
+    for (i = 0; i < len; i++)
+        Store_field(result, i, Val_bool(cpumap[i / 8] & (1 << (i & 7))));
+    CAMLreturn(result);
+}
+
+CAMLprim value stub_xenctrlext_vcpu_getaffinity(value xch_val,
+                                                value domid_val,
+                                                value vcpu_val)
+{
+    CAMLparam3(xch_val, domid_val, vcpu_val);
+    CAMLlocal3(hard, soft, result);
+    uint32_t domid = Int_val(domid_val);
+    int rc, len, vcpu = Int_val(vcpu_val);
+    xc_interface *xch = xch_of_val(xch_val);
+    xc_cpumap_t hard_map, soft_map;
+
+    len = xc_get_max_cpus(xch);
+    if (len < 0)
+        failwith_xc(xch);
+    hard_map = xc_cpumap_alloc(xch);
+    soft_map = xc_cpumap_alloc(xch);
+    if (hard_map == NULL || soft_map == NULL) {
+        free(hard_map);
+        free(soft_map);
+        failwith_xc(xch);
+    }
+
+    caml_release_runtime_system();
+    rc = xc_vcpu_getaffinity(xch, domid, vcpu, hard_map, soft_map,
+                             XEN_VCPUAFFINITY_HARD | XEN_VCPUAFFINITY_SOFT);
+    caml_acquire_runtime_system();
+    if (rc < 0) {
+        free(hard_map);
+        free(soft_map);
+        failwith_xc(xch);
+    }
+
+    hard = alloc_cpumap(hard_map, len);
+    soft = alloc_cpumap(soft_map, len);
+    free(hard_map);
+    free(soft_map);
+
+    result = caml_alloc_tuple(2);
+    Store_field(result, 0, hard);
+    Store_field(result, 1, soft);
+    CAMLreturn(result);
+}
+
 CAMLprim value stub_xenctrlext_numainfo(value xch_val)
 {
     CAMLparam1(xch_val);
@@ -616,6 +725,38 @@ CAMLprim value stub_xenctrlext_domain_claim_pages(value xch_val,
     CAMLreturn(Val_unit);
 }
 
+CAMLprim value stub_xenctrlext_domain_node_setaffinity(value xch_val,
+                                                      value domid_val,
+                                                      value nodemap_val)
+{
+    CAMLparam3(xch_val, domid_val, nodemap_val);
+    xc_interface *xch = xch_of_val(xch_val);
+    uint32_t domid = Int_val(domid_val);
+    int i, rc, len = xc_get_max_nodes(xch);
+    xc_nodemap_t nodemap;
+
+    if (len < 0)
+        failwith_xc(xch);
+    if (Wosize_val(nodemap_val) < len)
+        len = Wosize_val(nodemap_val);
+
+    nodemap = xc_nodemap_alloc(xch);
+    if (nodemap == NULL)
+        failwith_xc(xch);
+    for (i = 0; i < len; i++)
+        if (Bool_val(Field(nodemap_val, i)))
+            nodemap[i / 8] |= 1 << (i & 7);
+
+    caml_release_runtime_system();
+    rc = xc_domain_node_setaffinity(xch, domid, nodemap);
+    caml_acquire_runtime_system();
+    free(nodemap);
+    if (rc < 0)
+        failwith_xc(xch);
+
+    CAMLreturn(Val_unit);
+}
+
 #ifdef XEN_DOMCTL_NUMA_OP_GET_NODE_PAGES
 CAMLprim value stub_xc_domain_numa_get_node_pages(value xch_val,
                                                   value domid);
@@ -732,6 +873,154 @@ CAMLprim value stub_xenctrlext_numa_meminfo(value xch_val)
 }
 
 
+/* Flat NUMA topology and memory of the host, see NumaSnapshot in
+   xenctrlext.mli */
+struct numa_snapshot {
+    unsigned nodes, cpus;
+    uint64_t *size, *free, *claimed;
+    uint32_t *distance;
+    xc_cputopo_t *cputopo;
+};
+
+static void numa_snapshot_free(struct numa_snapshot *s)
+{
+    free(s->size);
+    free(s->free);
+    free(s->claimed);
+    free(s->distance);
+    free(s->cputopo);
+}
+
+/* Query all the hypercalls, called without the runtime lock.
+   Returns 0, or -1 with errno set */
+static int numa_snapshot_query(xc_interface *xch, struct numa_snapshot *s)
+{
+    unsigned nodes = 0, cpus = 0, i;
+    xc_meminfo_t *meminfo = NULL;
+    int err;
+
+    if (xc_numainfo(xch, &nodes, NULL, NULL) < 0
+        || xc_cputopoinfo(xch, &cpus, NULL) < 0)
+        return -1;
+
+    meminfo = calloc(nodes, sizeof(*meminfo));
+    s->size = calloc(nodes, sizeof(*s->size));
+    s->free = calloc(nodes, sizeof(*s->free));
+    s->claimed = calloc(nodes, sizeof(*s->claimed));
+    s->distance = calloc(nodes * nodes, sizeof(*s->distance));
+    s->cputopo = calloc(cpus, sizeof(*s->cputopo));
+    if (!meminfo || !s->size || !s->free || !s->claimed || !s->distance
+        || !s->cputopo) {
+        errno = ENOMEM;
+        goto fail;
+    }
+
+    if (xc_numainfo(xch, &nodes, meminfo, s->distance) < 0
+        || xc_cputopoinfo(xch, &cpus, s->cputopo) < 0)
+        goto fail;
+
+    for (i = 0; i < nodes; i++) {
+        s->size[i] = meminfo[i].memsize;
+        s->free[i] = meminfo[i].memfree;
+    }
+
+#ifdef XEN_SYSCTL_numa_meminfo
+    /* claimed memory needs the newer hypercall, keep claimed=0 without it */
+    {
+        unsigned max_nodes = nodes;
+        xen_sysctl_node_meminfo_t *numa_meminfo =
+            calloc(nodes, sizeof(*numa_meminfo));
+
+        if (numa_meminfo
+            && xc_numa_meminfo(xch, &max_nodes, numa_meminfo) == 0
+            && max_nodes == nodes) {
+            for (i = 0; i < nodes; i++) {
+                s->size[i] = numa_meminfo[i].size;
+                s->free[i] = numa_meminfo[i].free;
+                s->claimed[i] = numa_meminfo[i].claimed;
+            }
+        }
+        free(numa_meminfo);
+    }
+#endif
+
+    free(meminfo);
+    s->nodes = nodes;
+    s->cpus = cpus;
+    return 0;
+
+ fail:
+    err = errno;
+    free(meminfo);
+    numa_snapshot_free(s);
+    errno = err;
+    return -1;
+}
+
+static value alloc_int_array(unsigned len, const void *base, size_t stride,
+                             int is_64)
+{
+    CAMLparam0();
+    CAMLlocal1(result);
+    unsigned i;
+
+    if (len == 0)
+        CAMLreturn(Atom(0));
+    result = caml_alloc(len, 0);
+    for (i = 0; i < len; i++) {
+        const char *p = (const char *) base + i * stride;
+        Store_field(result, i,
+                    Val_long(is_64 ? *(const uint64_t *) p
+                             : *(const uint32_t *) p));
+    }
+    CAMLreturn(result);
+}
+
+/* handle -> NumaSnapshot.raw */
+CAMLprim value stub_xenctrlext_numa_snapshot(value xch_val)
+{
+    CAMLparam1(xch_val);
+    CAMLlocal1(result);
+    xc_interface *xch = xch_of_val(xch_val);
+    struct numa_snapshot s = { 0 };
+    int rc, the_errno;
+
+    caml_release_runtime_system();
+    rc = numa_snapshot_query(xch, &s);
+    the_errno = errno;
+    caml_acquire_runtime_system();
+    if (rc < 0) {
+        /* the error of libxc is stale when an allocation failed */
+        if (the_errno == ENOMEM)
+            caml_raise_out_of_memory();
+        raise_unix_errno_msg(the_errno,
+                             "Error when trying to query the NUMA topology");
+    }
+
+    result = caml_alloc_tuple(7);
+    Store_field(result, 0,
+                alloc_int_array(s.nodes, s.size, sizeof(*s.size), 1));
+    Store_field(result, 1,
+                alloc_int_array(s.nodes, s.free, sizeof(*s.free), 1));
+    Store_field(result, 2,
+                alloc_int_array(s.nodes, s.claimed, sizeof(*s.claimed), 1));
+    Store_field(result, 3,
+                alloc_int_array(s.nodes * s.nodes, s.distance,
+                                sizeof(*s.distance), 0));
+    Store_field(result, 4,
+                alloc_int_array(s.cpus, &s.cputopo[0].core,
+                                sizeof(*s.cputopo), 0));
+    Store_field(result, 5,
+                alloc_int_array(s.cpus, &s.cputopo[0].socket,
+                                sizeof(*s.cputopo), 0));
+    Store_field(result, 6,
+                alloc_int_array(s.cpus, &s.cputopo[0].node,
+                                sizeof(*s.cputopo), 0));
+    numa_snapshot_free(&s);
+
+    CAMLreturn(result);
+}
+
 /*
 * Local variables:
 * indent-tabs-mode: t
@@ -0,0 +1,43 @@
+(*
+ * Copyright (C) Cloud Software Group
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *)
+
+(* Local authentication through the PAM module stack compared with the
+   /etc/shadow fast path. Needs root and a local account, given by
+   BENCH_PAM_USER and BENCH_PAM_PASSWORD. *)
+
+open Bechamel
+
+let username = Option.value ~default:"root" (Sys.getenv_opt "BENCH_PAM_USER")
+
+let password = Option.value ~default:"" (Sys.getenv_opt "BENCH_PAM_PASSWORD")
+
+let pam () = Pam.authenticate username password
+
+let shadow () =
+  if not (Pam.Local_shadow.verify ~username ~password) then
+    failwith "shadow fast path rejected the credentials"
+
+let benchmarks =
+  [
+    Test.make ~name:"PAM" (Staged.stage pam)
+  ; Test.make ~name:"shadow fast path" (Staged.stage shadow)
+  ]
+
+let () =
+  (* the PAM test must not take the fast path *)
+  ignore (Pam.Local_shadow.configure false) ;
+  (* check the credentials once, instead of measuring failures *)
+  pam () ;
+  shadow () ;
+  Bechamel_simple_cli.cli benchmarks
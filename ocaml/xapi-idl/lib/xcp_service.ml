@@ -31,6 +31,14 @@ let log_destination = ref "syslog:daemon"
 
 let log_level = ref Syslog.Debug
 
+let syslog_async_capacity = ref 0
+
+let syslog_overflow = ref Syslog.Async.Drop_oldest
+
+let syslog_dedup_interval = ref 0.
+
+let syslog_rate_limits = ref ""
+
 let common_prefix = "org.xen.xapi."
 
 let finally f g =
@@ -246,6 +254,58 @@ let common_options =
     , (fun () -> Syslog.string_of_level !log_level)
     , "Log level"
     )
+  ; ( "syslog-async-capacity"
+    , Arg.Int
+        (fun x ->
+          syslog_async_capacity := x ;
+          if x > 0 then
+            Syslog.Async.start ~capacity:x ~overflow:!syslog_overflow ()
+        )
+    , (fun () -> string_of_int !syslog_async_capacity)
+    , "Size of the queue of the asynchronous syslog writer, 0 to write log \
+       messages synchronously"
+    )
+  ; ( "syslog-overflow"
+    , Arg.String
+        (fun x ->
+          try
+            syslog_overflow := Syslog.Async.overflow_of_string x ;
+            Syslog.Async.set_overflow !syslog_overflow
+          with e ->
+            error "Processing syslog-overflow = %s: %s" x
+              (Printexc.to_string e)
+        )
+    , (fun () -> Syslog.Async.string_of_overflow !syslog_overflow)
+    , "What to do when the asynchronous syslog queue is full: drop-oldest, \
+       block or drop"
+    )
+  ; ( "syslog-dedup-interval"
+    , Arg.Float
+        (fun x ->
+          syslog_dedup_interval := x ;
+          if x > 0. then
+            Syslog.Filter.set_dedup ~interval:x
+          else
+            Syslog.Filter.disable_dedup ()
+        )
+    , (fun () -> string_of_float !syslog_dedup_interval)
+    , "Suppress repeated log messages, reporting the repetitions at least \
+       every given seconds. 0 disables deduplication"
+    )
+  ; ( "syslog-rate-limit"
+    , Arg.String
+        (fun x ->
+          try
+            Syslog.Filter.set_rate_limits_of_string x ;
+            syslog_rate_limits := x
+          with e ->
+            error "Processing syslog-rate-limit = %s: %s" x
+              (Printexc.to_string e)
+        )
+    , (fun () -> !syslog_rate_limits)
+    , "Space separated list of FACILITY[.LEVEL]=BURST/SECONDS rules limiting \
+       identical log messages, FACILITY and LEVEL can be *"
+    )
   ; ( "inventory"
     , Arg.Set_string Inventory.inventory_filename
     , (fun () -> !Inventory.inventory_filename)
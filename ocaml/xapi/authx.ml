@@ -154,7 +154,15 @@ module AuthX : Auth_signature.AUTH_MODULE = struct
       try
         Pam.authenticate username password
         (* no exception raised, then authentication succeeded *)
-      with Failure msg -> raise (Auth_signature.Auth_failure msg)
+      with
+      | Failure msg ->
+          raise (Auth_signature.Auth_failure msg)
+      | Pam.Queue_full ->
+          (* as for local authentication, the pool of PAM workers is full *)
+          let stats = Pam.Pool.stats () in
+          debug "Rejected PAM authentication: %d waiting, %d rejected so far"
+            stats.queued stats.rejected ;
+          raise Api_errors.(Server_error (too_busy, []))
     in
     try get_subject_identifier ~__context username
     with Not_found ->
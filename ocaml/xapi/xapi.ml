@@ -940,7 +940,15 @@ let server_init () =
     Xapi_session.set_local_auth_max_threads
       (Db.Pool.get_local_auth_max_threads ~__context ~self:pool) ;
     Xapi_session.set_ext_auth_max_threads
-      (Db.Pool.get_ext_auth_max_threads ~__context ~self:pool)
+      (Db.Pool.get_ext_auth_max_threads ~__context ~self:pool) ;
+    Pam.Cache.configure ~ttl:!Xapi_globs.local_auth_cache_ttl ;
+    if !Xapi_globs.local_auth_shadow_fast_path then
+      if Pam.Local_shadow.configure true then
+        debug "Local authentication verifies /etc/shadow directly"
+      else
+        warn
+          "Not verifying /etc/shadow directly: PAM configuration is not plain \
+           pam_unix"
   in
 
   let call_extauth_hook_script_after_xapi_initialize ~__context =
@@ -550,7 +550,7 @@ module Watcher = struct
   let stabilising_period = Mtime.Span.(5 * s)
 
   (* The delay on which the watcher will wait. *)
-  let delay = Delay.make ()
+  let delay = Delay.make ~name:"xapi_clustering.watcher" ()
 
   let finish_watch = Atomic.make false
 
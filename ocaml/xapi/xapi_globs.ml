@@ -1429,6 +1429,19 @@ let nvidia_t4_sriov = ref Nvidia_DEFAULT
     we stop gpumon. *)
 let nvidia_gpumon_detach = ref false
 
+(* Local authentications waiting for a PAM worker before new ones are
+   rejected with TOO_BUSY, the number of workers is
+   pool.local_auth_max_threads *)
+let local_auth_max_queue = ref 256
+
+(* Seconds a successful local authentication is remembered so that repeated
+   logins skip PAM, 0 disables the cache *)
+let local_auth_cache_ttl = ref 0
+
+(* Verify local passwords against /etc/shadow without PAM when the PAM
+   configuration of xapi is plain pam_unix *)
+let local_auth_shadow_fast_path = ref false
+
 let failed_login_alert_freq = ref 3600
 
 let factory_ntp_servers = ref []
@@ -1709,6 +1722,24 @@ let other_options =
     , "The default name of gpg key file used by YUM and RPM to verify metadata \
        and packages in repository"
     )
+  ; ( "local-auth-max-queue"
+    , Arg.Set_int local_auth_max_queue
+    , (fun () -> string_of_int !local_auth_max_queue)
+    , "Maximum number of local authentications waiting for a PAM worker; \
+       more are rejected with TOO_BUSY"
+    )
+  ; ( "local-auth-cache-ttl"
+    , Arg.Set_int local_auth_cache_ttl
+    , (fun () -> string_of_int !local_auth_cache_ttl)
+    , "Seconds a successful local authentication is cached to skip PAM on \
+       repeated logins; 0 (default) disables the cache"
+    )
+  ; ( "local-auth-shadow-fast-path"
+    , Arg.Bool (fun b -> local_auth_shadow_fast_path := b)
+    , (fun () -> string_of_bool !local_auth_shadow_fast_path)
+    , "Verify local passwords against /etc/shadow without going through PAM, \
+       only if PAM is configured to use pam_unix alone"
+    )
   ; ( "failed-login-alert-freq"
     , Arg.Set_int failed_login_alert_freq
     , (fun () -> string_of_int !failed_login_alert_freq)
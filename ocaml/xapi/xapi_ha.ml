@@ -302,7 +302,7 @@ module Monitor = struct
   let m = Mutex.create ()
 
   (* We use this for interruptible sleeping *)
-  let delay = Delay.make ()
+  let delay = Delay.make ~name:"xapi_ha.monitor" ()
 
   let thread = ref None
 
@@ -264,7 +264,9 @@ let throttle_auth_external = Locking_helpers.Semaphore.create "External auth"
 let with_throttle = Locking_helpers.Semaphore.execute
 
 let set_local_auth_max_threads n =
-  Locking_helpers.Semaphore.set_max throttle_auth_internal @@ Int64.to_int n
+  Locking_helpers.Semaphore.set_max throttle_auth_internal @@ Int64.to_int n ;
+  Pam.Pool.configure ~max_workers:(Int64.to_int n)
+    ~max_queue:!Xapi_globs.local_auth_max_queue
 
 let set_ext_auth_max_threads n =
   Locking_helpers.Semaphore.set_max throttle_auth_external @@ Int64.to_int n
@@ -274,13 +276,18 @@ let do_external_auth ~__context uname pwd =
       (Ext_auth.d ()).authenticate_username_password ~__context uname pwd
   )
 
+(* Concurrency is limited by the pool of PAM workers, which rejects the
+   request rather than queueing it behind too many others *)
 let do_local_auth uname pwd =
-  with_throttle throttle_auth_internal (fun () ->
-      try Pam.authenticate uname pwd
-      with Failure msg ->
-        raise
-          Api_errors.(Server_error (session_authentication_failed, [uname; msg]))
-  )
+  try Pam.authenticate uname pwd with
+  | Failure msg ->
+      raise
+        Api_errors.(Server_error (session_authentication_failed, [uname; msg]))
+  | Pam.Queue_full ->
+      let stats = Pam.Pool.stats () in
+      debug "Rejected local authentication: %d waiting, %d rejected so far"
+        stats.queued stats.rejected ;
+      raise Api_errors.(Server_error (too_busy, []))
 
 let do_local_change_password uname newpwd =
   with_throttle throttle_auth_internal (fun () ->
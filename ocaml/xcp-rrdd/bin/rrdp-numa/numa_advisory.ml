@@ -0,0 +1,37 @@
+(*
+ * Copyright (C) Cloud Software Group
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *)
+
+type t = {mutable above: int; mutable degraded: bool}
+
+let hysteresis = 0.8
+
+let create () = {above= 0; degraded= false}
+
+type change = Unchanged | Degraded | Restored
+
+let update t ~threshold ~samples ~fraction =
+  if fraction > threshold then
+    t.above <- t.above + 1
+  else
+    t.above <- 0 ;
+  if (not t.degraded) && t.above >= samples then (
+    t.degraded <- true ;
+    Degraded
+  ) else if t.degraded && fraction < threshold *. hysteresis then (
+    t.degraded <- false ;
+    Restored
+  ) else
+    Unchanged
+
+let degraded t = t.degraded
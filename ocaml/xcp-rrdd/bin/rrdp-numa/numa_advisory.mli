@@ -0,0 +1,36 @@
+(*
+ * Copyright (C) Cloud Software Group
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *)
+
+(** Whether the NUMA locality of a VM is degraded, from successive samples of
+    the fraction of its memory on nodes its vCPUs cannot run on *)
+
+type t
+
+val hysteresis : float
+(** Locality must improve below this fraction of the threshold to be
+    restored *)
+
+val create : unit -> t
+(** [create ()] is the state of a VM whose locality is not degraded *)
+
+type change = Unchanged | Degraded | Restored
+
+val update : t -> threshold:float -> samples:int -> fraction:float -> change
+(** [update t ~threshold ~samples ~fraction] records a sample of the fraction
+    of remote memory. Locality becomes degraded after [samples] consecutive
+    samples above [threshold], so that a VM being built or migrated in is not
+    reported, and is restored by a sample below [threshold *. hysteresis]. *)
+
+val degraded : t -> bool
+(** [degraded t] is whether the locality is degraded *)
@@ -0,0 +1,205 @@
+(*
+ * Copyright (C) Cloud Software Group
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *)
+
+(* Reports how much of the memory of each VM is on NUMA nodes its vCPUs
+   cannot run on, and warns about VMs whose locality degraded, e.g. after a
+   migration or ballooning. The memory used by a VM on each node is reported
+   by xcp-rrdd-squeezed as memory_numa_node_<n>. *)
+
+open Rrdd_plugin
+
+module Process = Process (struct let name = "xcp-rrdd-numa" end)
+
+open Process
+
+(* Fraction of remote memory above which the locality of a VM is degraded *)
+let threshold = ref 0.25
+
+(* Consecutive samples above [threshold] before warning, so that a VM being
+   built or migrated in is not reported *)
+let samples = ref 12
+
+(* Advisory state of the running VMs, by UUID *)
+let advisories : (string, Numa_advisory.t) Hashtbl.t = Hashtbl.create 64
+
+(* Nodes of the CPUs vCPUs of [domid] can run on: the soft affinity within
+   the hard one, or the hard one if they don't overlap, as Xen does *)
+let affinity_nodes handle ~cpu_to_node ~nodes ~vcpus domid =
+  let used = Array.make nodes false in
+  let node_of_cpu cpu =
+    if cpu < Array.length cpu_to_node then cpu_to_node.(cpu) else -1
+  in
+  for vcpu = 0 to vcpus - 1 do
+    match Xenctrlext.vcpu_getaffinity handle domid vcpu with
+    | Ok (hard, soft) ->
+        let both =
+          Array.mapi (fun i h -> h && i < Array.length soft && soft.(i)) hard
+        in
+        let effective = if Array.exists Fun.id both then both else hard in
+        Array.iteri
+          (fun cpu allowed ->
+            let node = node_of_cpu cpu in
+            if allowed && node >= 0 && node < nodes then used.(node) <- true
+          )
+          effective
+    | Error _ ->
+        Array.fill used 0 nodes true
+  done ;
+  used
+
+let update_advisory ~uuid ~domid ~fraction ~remote =
+  let a =
+    match Hashtbl.find_opt advisories uuid with
+    | Some a ->
+        a
+    | None ->
+        let a = Numa_advisory.create () in
+        Hashtbl.replace advisories uuid a ;
+        a
+  in
+  ( match
+      Numa_advisory.update a ~threshold:!threshold ~samples:!samples ~fraction
+    with
+  | Numa_advisory.Degraded ->
+      D.warn
+        "NUMA locality of VM %s (domid %d) degraded: %.0f%% of its memory \
+         (%Ld MiB) is on nodes its vCPUs do not run on"
+        uuid domid (100. *. fraction)
+        (Int64.shift_right remote 20)
+  | Numa_advisory.Restored ->
+      D.info "NUMA locality of VM %s (domid %d) restored: %.0f%% remote memory"
+        uuid domid (100. *. fraction)
+  | Numa_advisory.Unchanged ->
+      ()
+  ) ;
+  Numa_advisory.degraded a
+
+let dss_of_vm handle ~cpu_to_node ~nodes (dom, uuid, domid) =
+  match Xenctrlext.DomainNuma.domain_get_numa_info_node_pages handle domid with
+  | Error _ ->
+      None
+  | Ok pages ->
+      let vcpus = dom.Xenctrl.max_vcpu_id + 1 in
+      let used = affinity_nodes handle ~cpu_to_node ~nodes ~vcpus domid in
+      let total, remote =
+        pages.Xenctrlext.DomainNuma.tot_pages_per_node
+        |> Array.mapi (fun node pages -> (node, Int64.shift_left pages 12))
+        |> Array.fold_left
+             (fun (total, remote) (node, bytes) ->
+               let local = node < nodes && used.(node) in
+               ( Int64.add total bytes
+               , if local then remote else Int64.add remote bytes
+               )
+             )
+             (0L, 0L)
+      in
+      let fraction =
+        if total > 0L then Int64.to_float remote /. Int64.to_float total else 0.
+      in
+      let degraded = update_advisory ~uuid ~domid ~fraction ~remote in
+      let affinity =
+        Array.fold_left (fun n u -> if u then n + 1 else n) 0 used
+      in
+      Some
+        ( degraded
+        , [
+            ( Rrd.VM uuid
+            , Ds.ds_make ~name:"numa_memory_remote" ~units:"B"
+                ~description:
+                  "Memory of the VM on NUMA nodes its vCPUs do not run on"
+                ~value:(Rrd.VT_Int64 remote) ~ty:Rrd.Gauge ~min:0.0
+                ~default:false ()
+            )
+          ; ( Rrd.VM uuid
+            , Ds.ds_make ~name:"numa_memory_remote_fraction"
+                ~units:"(fraction)"
+                ~description:
+                  "Fraction of the memory of the VM on NUMA nodes its vCPUs do \
+                   not run on"
+                ~value:(Rrd.VT_Float fraction) ~ty:Rrd.Gauge ~min:0.0 ~max:1.0
+                ~default:true ()
+            )
+          ; ( Rrd.VM uuid
+            , Ds.ds_make ~name:"numa_affinity_nodes" ~units:"count"
+                ~description:"Number of NUMA nodes the vCPUs of the VM run on"
+                ~value:(Rrd.VT_Int64 (Int64.of_int affinity)) ~ty:Rrd.Gauge
+                ~min:0.0 ~default:false ()
+            )
+          ; ( Rrd.VM uuid
+            , Ds.ds_make ~name:"numa_locality_degraded" ~units:"(boolean)"
+                ~description:
+                  "Whether the NUMA locality of the VM has been degraded for a \
+                   while"
+                ~value:(Rrd.VT_Int64 (if degraded then 1L else 0L))
+                ~ty:Rrd.Gauge ~min:0.0 ~max:1.0 ~default:true ()
+            )
+          ]
+        )
+
+let generate_sources xc () =
+  let handle = Xenctrlext.get_handle () in
+  match Xenctrlext.NumaSnapshot.get handle with
+  | Error _ ->
+      []
+  | Ok snapshot when Xenctrlext.NumaSnapshot.nodes snapshot < 2 ->
+      []
+  | Ok snapshot ->
+      let cpu_to_node = Xenctrlext.NumaSnapshot.cpu_to_node snapshot
+      and nodes = Xenctrlext.NumaSnapshot.nodes snapshot in
+      let _, domains, _ = Xenctrl_lib.domain_snapshot xc in
+      (* forget about VMs that are not running anymore *)
+      let running = Hashtbl.create (List.length domains) in
+      List.iter (fun (_, uuid, _) -> Hashtbl.replace running uuid ()) domains ;
+      Hashtbl.filter_map_inplace
+        (fun uuid a -> if Hashtbl.mem running uuid then Some a else None)
+        advisories ;
+      let vms =
+        List.filter_map (dss_of_vm handle ~cpu_to_node ~nodes) domains
+      in
+      let degraded = List.filter fst vms |> List.length in
+      ( Rrd.Host
+      , Ds.ds_make ~name:"numa_vms_locality_degraded" ~units:"count"
+          ~description:"Number of VMs whose NUMA locality has been degraded"
+          ~value:(Rrd.VT_Int64 (Int64.of_int degraded)) ~ty:Rrd.Gauge ~min:0.0
+          ~default:true ()
+      )
+      :: List.concat_map snd vms
+
+(* 4 data sources per VM take less than 1024 bytes *)
+let bytes_per_vm = 1024
+
+let shared_page_count =
+  1 + (((Rrd_interface.max_supported_vms * bytes_per_vm) + 4095) / 4096)
+
+let () =
+  Arg.parse
+    [
+      ( "-threshold"
+      , Arg.Set_float threshold
+      , "fraction of remote memory above which locality is degraded (default \
+         0.25)"
+      )
+    ; ( "-samples"
+      , Arg.Set_int samples
+      , "consecutive samples above the threshold before warning (default 12)"
+      )
+    ]
+    (fun _ -> raise (Arg.Bad "unexpected argument"))
+    "xcp-rrdd-numa [options]: report the NUMA locality of VMs" ;
+  Process.initialise () ;
+  Xenctrl.with_intf (fun xc ->
+      Process.main_loop ~neg_shift:0.5
+        ~target:(Reporter.Local shared_page_count) ~protocol:Rrd_interface.V2
+        ~dss_f:(generate_sources xc)
+  )
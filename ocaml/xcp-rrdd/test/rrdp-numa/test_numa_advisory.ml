@@ -0,0 +1,93 @@
+open Numa_advisory
+
+let threshold = 0.25
+
+let samples = 3
+
+let change =
+  Alcotest.testable
+    (Fmt.of_to_string (function
+      | Unchanged ->
+          "Unchanged"
+      | Degraded ->
+          "Degraded"
+      | Restored ->
+          "Restored"
+      ))
+    ( = )
+
+(* Feed [fractions] to a new advisory and check the change after each *)
+let check fractions expected () =
+  let t = create () in
+  let changes =
+    List.map (fun fraction -> update t ~threshold ~samples ~fraction) fractions
+  in
+  Alcotest.(check (list change)) "changes" expected changes ;
+  let last =
+    List.fold_left
+      (fun degraded -> function
+        | Degraded ->
+            true
+        | Restored ->
+            false
+        | Unchanged ->
+            degraded
+        )
+      false changes
+  in
+  Alcotest.(check bool) "degraded" last (degraded t)
+
+let high = 0.5
+
+(* below the threshold but not enough to restore the locality *)
+let marginal = threshold *. ((1. +. hysteresis) /. 2.)
+
+let low = threshold *. hysteresis /. 2.
+
+let tests =
+  [
+    ( "Not above the threshold"
+    , `Quick
+    , check
+        [0.; low; threshold; threshold]
+        [Unchanged; Unchanged; Unchanged; Unchanged]
+    )
+  ; ( "Degraded after consecutive samples"
+    , `Quick
+    , check [high; high; high] [Unchanged; Unchanged; Degraded]
+    )
+  ; ( "Interrupted samples"
+    , `Quick
+    , check
+        [high; high; marginal; high; high]
+        [Unchanged; Unchanged; Unchanged; Unchanged; Unchanged]
+    )
+  ; ( "Reported once"
+    , `Quick
+    , check
+        [high; high; high; high; high]
+        [Unchanged; Unchanged; Degraded; Unchanged; Unchanged]
+    )
+  ; ( "Hysteresis"
+    , `Quick
+    , check
+        [high; high; high; marginal; marginal; low]
+        [Unchanged; Unchanged; Degraded; Unchanged; Unchanged; Restored]
+    )
+  ; ( "Degraded again"
+    , `Quick
+    , check
+        [high; high; high; low; high; high; high]
+        [
+          Unchanged
+        ; Unchanged
+        ; Degraded
+        ; Restored
+        ; Unchanged
+        ; Unchanged
+        ; Degraded
+        ]
+    )
+  ]
+
+let () = Alcotest.run "NUMA locality advisory" [("advisory", tests)]
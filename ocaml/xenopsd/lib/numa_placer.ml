@@ -0,0 +1,156 @@
+(*
+ * Copyright (C) Cloud Software Group, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *)
+open Topology
+
+module D = Debug.Make (struct let name = "numa_placer" end)
+
+type weights = {memory: float; distance: float; load: float}
+
+(* Spreading over two nodes one hop apart (distance 21) costs about as much as
+   running one more vCPU per CPU on a single node *)
+let default_weights = {memory= 0.5; distance= 1.0; load= 0.5}
+
+type plan = {
+    nodes: NUMA.node list
+  ; affinity: CPUSet.t
+  ; memory: (NUMA.node * int64) list
+  ; score: float
+}
+
+let pp_dump =
+  Fmt.(
+    Dump.record
+      [
+        Dump.field "nodes" (fun t -> t.nodes) (Dump.list NUMA.pp_dump_node)
+      ; Dump.field "affinity" (fun t -> t.affinity) CPUSet.pp_dump
+      ; Dump.field "memory"
+          (fun t -> t.memory)
+          (Dump.list (Dump.pair NUMA.pp_dump_node int64))
+      ; Dump.field "score" (fun t -> t.score) float
+      ]
+  )
+
+module Load = struct
+  type t = (int, NUMA.node list * int) Hashtbl.t
+
+  let create () = Hashtbl.create 64
+
+  let add t ~domid nodes ~vcpus = Hashtbl.replace t domid (nodes, vcpus)
+
+  let remove t ~domid = Hashtbl.remove t domid
+
+  let vcpus t ~nodes =
+    let load = Array.make nodes 0. in
+    Hashtbl.iter
+      (fun _ (placed, vcpus) ->
+        let share = float vcpus /. float (max 1 (List.length placed)) in
+        List.iter
+          (fun (NUMA.Node n) -> if n < nodes then load.(n) <- load.(n) +. share)
+          placed
+      )
+      t ;
+    load
+end
+
+(* Split [memory] between [nodes] proportionally to what they have available,
+   the last node gets what is left after rounding *)
+let split_memory (nodes : NUMAResource.t array) placed memory =
+  let available (NUMA.Node n) = Int64.to_float nodes.(n).NUMAResource.memfree in
+  let total = List.fold_left (fun acc n -> acc +. available n) 0. placed in
+  let rec split acc remaining = function
+    | [] ->
+        List.rev acc
+    | [node] ->
+        List.rev ((node, remaining) :: acc)
+    | node :: rest ->
+        let share =
+          if total > 0. then
+            Int64.of_float (Int64.to_float memory *. available node /. total)
+          else
+            0L
+        in
+        let share = min share remaining in
+        split ((node, share) :: acc) (Int64.sub remaining share) rest
+  in
+  split [] memory placed
+
+let plan ?(weights = default_weights) ?(max_plans = 8) host nodes ~load ~vm =
+  let vcpus = vm.NUMARequest.vcpus in
+  let evaluate (avg, candidate) =
+    let placed =
+      candidate
+      |> List.of_seq
+      |> List.sort (fun (NUMA.Node a) (NUMA.Node b) -> compare a b)
+    in
+    let allocated =
+      List.fold_left
+        (fun acc (NUMA.Node n) -> NUMAResource.union acc nodes.(n))
+        NUMAResource.empty placed
+    in
+    if not (NUMARequest.fits vm allocated) then
+      None
+    else
+      let memory_used =
+        if allocated.NUMAResource.memfree > 0L then
+          Int64.to_float vm.NUMARequest.memory
+          /. Int64.to_float allocated.NUMAResource.memfree
+        else
+          0.
+      in
+      (* distances are normalized to 10 for local accesses *)
+      let distance = (avg -. 10.) /. 10. in
+      let cpus = CPUSet.cardinal allocated.NUMAResource.affinity in
+      let vcpus_per_cpu =
+        List.fold_left
+          (fun acc (NUMA.Node n) ->
+            acc +. if n < Array.length load then load.(n) else 0.
+          )
+          (float vcpus) placed
+        /. float (max 1 cpus)
+      in
+      let score =
+        (weights.memory *. memory_used)
+        +. (weights.distance *. distance)
+        +. (weights.load *. vcpus_per_cpu)
+      in
+      Some
+        {
+          nodes= placed
+        ; affinity= allocated.NUMAResource.affinity
+        ; memory= split_memory nodes placed vm.NUMARequest.memory
+        ; score
+        }
+  in
+  let by_score a b =
+    match Float.compare a.score b.score with
+    | 0 ->
+        compare a.nodes b.nodes
+    | c ->
+        c
+  in
+  (* Candidates come in order of increasing distance, the ones further down
+     the sequence can only win on memory and load, a few times [max_plans] is
+     enough to find them *)
+  let plans =
+    NUMA.candidates host
+    |> Seq.filter_map evaluate
+    |> Seq.take (4 * max_plans)
+    |> List.of_seq
+    |> List.sort by_score
+    |> List.filteri (fun i _ -> i < max_plans)
+  in
+  D.debug "Requested resources: %s, plans: %s"
+    (Fmt.to_to_string NUMARequest.pp_dump vm)
+    (Fmt.to_to_string (Fmt.Dump.list pp_dump) plans) ;
+  plans
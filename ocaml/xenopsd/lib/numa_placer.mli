@@ -0,0 +1,79 @@
+(*
+ * Copyright (C) Cloud Software Group, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *)
+
+open Topology
+
+(** Relative importance of the terms of the score of a set of nodes, see
+    {!plan} *)
+type weights = {memory: float; distance: float; load: float}
+
+val default_weights : weights
+
+(** Placement of a VM on a set of NUMA nodes *)
+type plan = private {
+    nodes: NUMA.node list  (** nodes in increasing order *)
+  ; affinity: CPUSet.t  (** CPUs of [nodes], to be used as vCPU affinity *)
+  ; memory: (NUMA.node * int64) list
+        (** memory to allocate from each of [nodes], in bytes, proportional
+            to the memory available on each node *)
+  ; score: float  (** lower is better *)
+}
+
+(** vCPUs placed on each NUMA node by previous plans *)
+module Load : sig
+  type t
+
+  val create : unit -> t
+
+  val add : t -> domid:int -> NUMA.node list -> vcpus:int -> unit
+  (** [add t ~domid nodes ~vcpus] records that the [vcpus] of [domid] run on
+      [nodes], replacing any previous record for [domid] *)
+
+  val remove : t -> domid:int -> unit
+  (** [remove t ~domid] forgets about [domid], e.g. when it is destroyed *)
+
+  val vcpus : t -> nodes:int -> float array
+  (** [vcpus t ~nodes] is the number of vCPUs on each of the first [nodes]
+      NUMA nodes. The vCPUs of a domain spanning several nodes are shared
+      equally between them. *)
+end
+
+val plan :
+     ?weights:weights
+  -> ?max_plans:int
+  -> NUMA.t
+  -> NUMAResource.t array
+  -> load:float array
+  -> vm:NUMARequest.t
+  -> plan list
+(** [plan host nodes ~load ~vm] is the list of sets of nodes that can host
+    [vm], best first, at most [max_plans] of them (default 8).
+
+    [nodes.(i)] is the resource of NUMA node [i], its memory being what is
+    free and not claimed by other domains, and [load.(i)] is the number of
+    vCPUs already running on it.
+
+    The score of a set of nodes is the weighted sum of:
+    - the fraction of the available memory of the set the VM would use,
+    - how much slower the average memory access within the set is compared to
+      a local one,
+    - the number of vCPUs per CPU of the set once the VM runs on it.
+
+    Sets are considered in order of increasing distance, and only the first
+    feasible ones are scored, so that hosts with many nodes do not cause an
+    exponential blowup. Callers should try the plans in order, moving to the
+    next one if claiming the memory of a plan fails. *)
+
+val pp_dump : plan Fmt.t
+(** [pp_dump ppf plan] pretty-prints [plan] on [ppf] *)
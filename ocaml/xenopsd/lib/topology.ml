@@ -298,6 +298,11 @@ module NUMA = struct
 
   let node_of_cpu t i = t.cpu_to_node.(i)
 
+  let node t i =
+    if i < 0 || i >= Array.length t.distances then
+      invalid_arg (Printf.sprintf "NUMA.node: no node %d" i) ;
+    node_of_int i
+
   let nodes t =
     seq_range 0 (Array.length t.distances) |> Seq.map (fun i -> Node i)
 
@@ -148,6 +148,10 @@ module NUMA : sig
   val node_of_cpu : t -> int -> node
   (** [node_of_cpu t cpu] is the NUMA node containing CPU [cpu] *)
 
+  val node : t -> int -> node
+  (** [node t i] is NUMA node [i] of [t]. Raises [Invalid_argument] if there
+      is no such node. *)
+
   val nodes : t -> node Seq.t
   (** [nodes t] is the list of NUMA nodes *)
 
@@ -0,0 +1,252 @@
+(* Replays a recorded boot storm against a simulated NUMA host and reports the
+   memory locality achieved by the placement policies.
+
+   A recording has one event per line, ordered by time in milliseconds:
+     <time> start <domid> <vcpus> <memory MiB>
+     <time> stop <domid>
+   Lines starting with '#' are ignored.
+
+   Memory a VM couldn't be placed for is striped across all nodes, as Xen does
+   by default. Locality is reported as the average distance between the nodes
+   of the vCPUs of a VM and the nodes its memory is on, weighted by the amount
+   of memory (10 is local), and the fraction of VMs on a single node. *)
+
+open Topology
+
+type event = Start of {domid: int; vcpus: int; memory: int64} | Stop of int
+
+let mib = Int64.shift_left 1L 20
+
+let parse_line line =
+  match String.split_on_char ' ' line |> List.filter (( <> ) "") with
+  | [] ->
+      None
+  | time :: _ when time.[0] = '#' ->
+      None
+  | [time; "start"; domid; vcpus; memory] ->
+      Some
+        ( int_of_string time
+        , Start
+            {
+              domid= int_of_string domid
+            ; vcpus= int_of_string vcpus
+            ; memory= Int64.(mul (of_string memory) mib)
+            }
+        )
+  | [time; "stop"; domid] ->
+      Some (int_of_string time, Stop (int_of_string domid))
+  | _ ->
+      failwith (Printf.sprintf "Invalid event: %S" line)
+
+let read_events path =
+  let ic = open_in path in
+  let rec lines acc =
+    match input_line ic with
+    | line ->
+        lines (line :: acc)
+    | exception End_of_file ->
+        List.rev acc
+  in
+  Fun.protect (fun () -> lines []) ~finally:(fun () -> close_in ic)
+  |> List.filter_map parse_line
+  |> List.stable_sort (fun (a, _) (b, _) -> compare a b)
+  |> List.map snd
+
+(* Same matrix as the synthetic one of test_topology *)
+let make_host ~nodes ~cpus_per_node =
+  let distances =
+    Array.init nodes (fun i ->
+        Array.init nodes (fun j -> 10 + (11 * abs (j - i)))
+    )
+  in
+  let cpu_to_node =
+    Array.init (nodes * cpus_per_node) (fun cpu -> cpu / cpus_per_node)
+  and node_cores = Array.make nodes (cpus_per_node / 2) in
+  match NUMA.make ~distances ~cpu_to_node ~node_cores with
+  | Some host ->
+      host
+  | None ->
+      failwith "Invalid host topology"
+
+(* Spread [memory] over [nodes] proportionally to their free memory *)
+let spread free nodes memory =
+  let total =
+    List.fold_left (fun acc (NUMA.Node n) -> acc +. free.(n)) 0. nodes
+  in
+  List.map
+    (fun (NUMA.Node n as node) ->
+      let share = if total > 0. then free.(n) /. total else 0. in
+      (node, Int64.to_float memory *. share)
+    )
+    nodes
+
+type placement = {cpu_nodes: NUMA.node list; memory: (NUMA.node * float) list}
+
+type stats = {
+    mutable placed: int
+  ; mutable failed: int
+  ; mutable single_node: int
+  ; mutable distance: float
+}
+
+module Policy = struct
+  type t = {
+      name: string
+    ; place:
+           NUMA.t
+        -> NUMAResource.t array
+        -> domid:int
+        -> vm:NUMARequest.t
+        -> placement option
+    ; release: domid:int -> unit
+  }
+
+  let softaffinity =
+    let place host nodes ~domid:_ ~vm =
+      Softaffinity.plan host nodes ~vm
+      |> Option.map (fun (affinity, placed) ->
+          let free =
+            Array.map (fun r -> Int64.to_float r.NUMAResource.memfree) nodes
+          in
+          let cpu_nodes =
+            CPUSet.elements affinity
+            |> List.map (NUMA.node_of_cpu host)
+            |> List.sort_uniq compare
+          in
+          {cpu_nodes; memory= spread free placed vm.NUMARequest.memory}
+      )
+    in
+    {name= "softaffinity"; place; release= (fun ~domid:_ -> ())}
+
+  let placer () =
+    let load = Numa_placer.Load.create () in
+    let place host nodes ~domid ~vm =
+      let vcpus = Numa_placer.Load.vcpus load ~nodes:(Array.length nodes) in
+      match Numa_placer.plan host nodes ~load:vcpus ~vm with
+      | [] ->
+          None
+      | plan :: _ ->
+          Numa_placer.Load.add load ~domid plan.Numa_placer.nodes
+            ~vcpus:vm.NUMARequest.vcpus ;
+          Some
+            {
+              cpu_nodes= plan.Numa_placer.nodes
+            ; memory=
+                List.map
+                  (fun (n, m) -> (n, Int64.to_float m))
+                  plan.Numa_placer.memory
+            }
+    in
+    {
+      name= "placer"
+    ; place
+    ; release= (fun ~domid -> Numa_placer.Load.remove load ~domid)
+    }
+end
+
+let average_distance host {cpu_nodes; memory} =
+  let total = List.fold_left (fun acc (_, m) -> acc +. m) 0. memory in
+  let per_cpu_node c =
+    List.fold_left
+      (fun acc (n, m) -> acc +. (float (NUMA.distance host c n) *. m))
+      0. memory
+    /. total
+  in
+  List.fold_left (fun acc c -> acc +. per_cpu_node c) 0. cpu_nodes
+  /. float (List.length cpu_nodes)
+
+let replay ~host ~memory_per_node (policy : Policy.t) events =
+  let all_nodes = List.of_seq (NUMA.nodes host) in
+  let free =
+    Array.make (List.length all_nodes) (Int64.to_float memory_per_node)
+  in
+  let running = Hashtbl.create 64 in
+  let stats = {placed= 0; failed= 0; single_node= 0; distance= 0.} in
+  let start ~domid ~vcpus ~memory =
+    let nodes =
+      Array.map
+        (fun (NUMA.Node n as node) ->
+          NUMA.resource host node ~memory:(Int64.of_float (max 0. free.(n)))
+        )
+        (Array.of_list all_nodes)
+    in
+    let vm = NUMARequest.make ~memory ~vcpus ~cores:0 in
+    let placement =
+      match policy.place host nodes ~domid ~vm with
+      | Some p ->
+          stats.placed <- stats.placed + 1 ;
+          if List.length p.cpu_nodes = 1 && List.length p.memory = 1 then
+            stats.single_node <- stats.single_node + 1 ;
+          p
+      | None ->
+          stats.failed <- stats.failed + 1 ;
+          {cpu_nodes= all_nodes; memory= spread free all_nodes memory}
+    in
+    List.iter
+      (fun (NUMA.Node n, m) -> free.(n) <- free.(n) -. m)
+      placement.memory ;
+    stats.distance <- stats.distance +. average_distance host placement ;
+    Hashtbl.replace running domid placement
+  in
+  let stop domid =
+    Option.iter
+      (fun p ->
+        List.iter
+          (fun (NUMA.Node n, m) -> free.(n) <- free.(n) +. m)
+          p.memory ;
+        policy.release ~domid ;
+        Hashtbl.remove running domid
+      )
+      (Hashtbl.find_opt running domid)
+  in
+  List.iter
+    (function
+      | Start {domid; vcpus; memory} ->
+          start ~domid ~vcpus ~memory
+      | Stop domid ->
+          stop domid
+      )
+    events ;
+  let vms = stats.placed + stats.failed in
+  Printf.printf "%-14s %6d %6d %9.1f%% %9.2f\n" policy.name vms stats.failed
+    (100. *. float stats.single_node /. float (max 1 vms))
+    (stats.distance /. float (max 1 vms))
+
+let () =
+  let nodes = ref 4 in
+  let cpus_per_node = ref 16 in
+  let memory_per_node = ref 65536 in
+  let recordings = ref [] in
+  Arg.parse
+    [
+      ("-nodes", Arg.Set_int nodes, "NUMA nodes of the host (default 4)")
+    ; ( "-cpus-per-node"
+      , Arg.Set_int cpus_per_node
+      , "CPUs per node (default 16)"
+      )
+    ; ( "-mem-per-node"
+      , Arg.Set_int memory_per_node
+      , "memory per node in MiB (default 65536)"
+      )
+    ]
+    (fun path -> recordings := path :: !recordings)
+    "numa_sim.exe [options] recording...: replay boot storms" ;
+  Debug.disable "numa_placer" ;
+  Debug.disable "softaffinity" ;
+  let memory_per_node = Int64.(mul (of_int !memory_per_node) mib) in
+  List.iter
+    (fun path ->
+      let events = read_events path in
+      Printf.printf "%s: %d nodes, %d CPUs and %Ld MiB per node\n" path !nodes
+        !cpus_per_node (Int64.div memory_per_node mib) ;
+      Printf.printf "%-14s %6s %6s %10s %9s\n" "policy" "vms" "failed"
+        "single" "distance" ;
+      (* NUMA.t keeps track of node usage, use a fresh one for each policy *)
+      List.iter
+        (fun policy ->
+          let host = make_host ~nodes:!nodes ~cpus_per_node:!cpus_per_node in
+          replay ~host ~memory_per_node policy events
+        )
+        [Policy.softaffinity; Policy.placer ()]
+    )
+    (List.rev !recordings)
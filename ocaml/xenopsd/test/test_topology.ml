@@ -334,6 +334,64 @@ let distances_tests =
   in
   ("Distance matrices", List.map test_of_spec specs)
 
+let placer_tests =
+  let gib n = Int64.shift_left (Int64.of_int n) 30 in
+  let _, host = make_numa ~numa:2 ~cores:16 in
+  let resources available =
+    NUMA.nodes host
+    |> Seq.map (fun (NUMA.Node i as n) ->
+        NUMA.resource host n ~memory:(gib available.(i))
+    )
+    |> Array.of_seq
+  in
+  let best ?(load = [|0.; 0.|]) available ~memory ~vcpus =
+    let vm = NUMARequest.make ~memory:(gib memory) ~vcpus ~cores:0 in
+    match Numa_placer.plan host (resources available) ~load ~vm with
+    | [] ->
+        Alcotest.fail "No NUMA plan"
+    | plan :: _ ->
+        ( List.map (fun (NUMA.Node n) -> n) plan.Numa_placer.nodes
+        , List.map (fun (NUMA.Node n, m) -> (n, m)) plan.Numa_placer.memory
+        )
+  in
+  let check name expected actual =
+    Alcotest.(check (pair (list int) (list (pair int int64))))
+      name expected actual
+  in
+  let single_node () =
+    check "A VM that fits a node uses one node"
+      ([0], [(0, gib 4)])
+      (best [|16; 16|] ~memory:4 ~vcpus:4)
+  and claimed_memory () =
+    check "Memory claimed by other VMs is not available"
+      ([1], [(1, gib 4)])
+      (best [|2; 16|] ~memory:4 ~vcpus:4)
+  and vcpu_load () =
+    check "The least loaded node is chosen"
+      ([1], [(1, gib 4)])
+      (best ~load:[|16.; 0.|] [|16; 16|] ~memory:4 ~vcpus:4)
+  and split () =
+    check "Memory is split proportionally to what is available"
+      ([0; 1], [(0, gib 10); (1, gib 20)])
+      (best [|12; 24|] ~memory:30 ~vcpus:4)
+  and no_plan () =
+    let vm = NUMARequest.make ~memory:(gib 64) ~vcpus:4 ~cores:0 in
+    Alcotest.(check int)
+      "No plan for a VM larger than the host" 0
+      (List.length
+         (Numa_placer.plan host (resources [|16; 16|]) ~load:[|0.; 0.|] ~vm)
+      )
+  in
+  ( "NUMA placer"
+  , [
+      ("Single node", `Quick, single_node)
+    ; ("Claimed memory", `Quick, claimed_memory)
+    ; ("vCPU load", `Quick, vcpu_load)
+    ; ("Split across nodes", `Quick, split)
+    ; ("No plan", `Quick, no_plan)
+    ]
+  )
+
 let () =
   Debug.log_to_stdout () ;
-  Alcotest.run "Topology" [allocate_tests; distances_tests]
+  Alcotest.run "Topology" [allocate_tests; distances_tests; placer_tests]
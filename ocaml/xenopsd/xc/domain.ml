@@ -806,6 +806,11 @@ let sysrq ~xs domid key =
   let path = xs.Xs.getdomainpath domid ^ "/control/sysrq" in
   xs.Xs.write path (String.make 1 key)
 
+let numa_mutex = Mutex.create ()
+
+(* vCPUs of the domains placed by [numa_placement], protected by [numa_mutex] *)
+let numa_load = Numa_placer.Load.create ()
+
 let destroy (task : Xenops_task.task_handle) ~xc ~xs ~qemu_domid ~vtpm ~dm domid
     =
   let dom_path = xs.Xs.getdomainpath domid in
@@ -864,6 +869,7 @@ let destroy (task : Xenops_task.task_handle) ~xc ~xs ~qemu_domid ~vtpm ~dm domid
   debug "VM = %s; domid = %d; Domain.destroy calling Xenctrl.domain_destroy"
     (Uuidx.to_string uuid) domid ;
   log_exn_continue "Xenctrl.domain_destroy" (Xenctrl.domain_destroy xc) domid ;
+  with_lock numa_mutex (fun () -> Numa_placer.Load.remove numa_load ~domid) ;
   log_exn_continue "Error stoping device-model, already dead ?"
     (fun () -> Device.Dm.stop ~xs ~qemu_domid ~vtpm ~dm domid)
     () ;
@@ -973,50 +979,60 @@ let create_channels ~xc uuid domid =
     (Uuidx.to_string uuid) domid store console ;
   (store, console)
 
+(* The hierarchy only depends on the topology, rebuild it only when the
+   topology generation of the snapshot changes *)
 let numa_hierarchy =
-  let open Xenctrlext in
-  let open Topology in
-  lazy
-    (let xcext = get_handle () in
-     let distances = (numainfo xcext).distances in
-     let topoinfo = cputopoinfo xcext in
-     let core t = t.core and node t = t.node in
-     let cpu_to_node = topoinfo |> Array.map node
-     and node_cores =
-       let module IntSet = Set.Make (Int) in
-       let a = Array.make (Array.length distances) IntSet.empty in
-       Array.iter
-         (fun t -> a.(node t) <- IntSet.add (core t) a.(node t))
-         topoinfo ;
-       Array.map IntSet.cardinal a
-     in
-     NUMA.make ~distances ~cpu_to_node ~node_cores
-    )
-
-let numa_mutex = Mutex.create ()
+  let cache = ref None in
+  fun snapshot ->
+    let open Xenctrlext in
+    let open Topology in
+    let generation = NumaSnapshot.topology_generation snapshot in
+    match !cache with
+    | Some (g, host) when g = generation ->
+        host
+    | _ ->
+        let distances = NumaSnapshot.distances snapshot in
+        let cpu_to_node = NumaSnapshot.cpu_to_node snapshot
+        and node_cores =
+          let module IntSet = Set.Make (Int) in
+          let a = Array.make (NumaSnapshot.nodes snapshot) IntSet.empty in
+          for cpu = 0 to NumaSnapshot.cpus snapshot - 1 do
+            let node = NumaSnapshot.cpu_node snapshot cpu in
+            a.(node) <- IntSet.add (NumaSnapshot.cpu_core snapshot cpu) a.(node)
+          done ;
+          Array.map IntSet.cardinal a
+        in
+        let host = NUMA.make ~distances ~cpu_to_node ~node_cores in
+        cache := Some (generation, host) ;
+        host
 
-let node_mem_claimable_for_new_vm ~node ~domid m =
-  let open Xenctrlext.HostNuma in
+let node_mem_claimable_for_new_vm ~node ~domid snapshot =
+  let open Xenctrlext.NumaSnapshot in
   let nodeid = Fmt.str "%a" Topology.NUMA.pp_dump_node node in
-  let available = Int64.sub m.free m.claimed in
+  let (Topology.NUMA.Node i) = node in
+  let free = free snapshot i and claimed = claimed snapshot i in
+  let available = Int64.of_int (free - claimed) in
   D.debug
-    "mem_claimable_for_new_vm: NUMA nodeid=%s, domid=%d: memfree=%Ld \
-     memsize=%Ld claimed=%Ld: available=%Ld"
-    nodeid domid m.free m.size m.claimed available ;
+    "mem_claimable_for_new_vm: NUMA nodeid=%s, domid=%d: memfree=%d \
+     memsize=%d claimed=%d: available=%Ld"
+    nodeid domid free (size snapshot i) claimed available ;
   available
 
 let numa_init () =
   let xcext = Xenctrlext.get_handle () in
-  let host = Lazy.force numa_hierarchy in
-  D.debug "Host NUMA information: %s"
-    (Fmt.to_to_string (Fmt.Dump.option Topology.NUMA.pp_dump) host) ;
-  Xenctrlext.HostNuma.numa_get_meminfo xcext
-  |> Result.iter
-     @@ Array.iteri (fun i m ->
-         let open Xenctrlext.HostNuma in
-         D.debug "NUMA node %d: %Ld/%Ld/%Ld memory free" i m.free m.size
-           m.claimed
-     )
+  match Xenctrlext.NumaSnapshot.get xcext with
+  | Error (err, fn) ->
+      D.warn "Host NUMA information not available: %s: %s" fn
+        (Unix.error_message err)
+  | Ok snapshot ->
+      let host = with_lock numa_mutex (fun () -> numa_hierarchy snapshot) in
+      D.debug "Host NUMA information: %s"
+        (Fmt.to_to_string (Fmt.Dump.option Topology.NUMA.pp_dump) host) ;
+      for i = 0 to Xenctrlext.NumaSnapshot.nodes snapshot - 1 do
+        let open Xenctrlext.NumaSnapshot in
+        D.debug "NUMA node %d: %d/%d/%d memory free" i (free snapshot i)
+          (size snapshot i) (claimed snapshot i)
+      done
 
 let set_affinity = function
   | Xenops_server.Hard ->
@@ -1030,74 +1046,112 @@ let numa_placement domid ~vcpus ~cores ~memory affinity =
   with_lock numa_mutex (fun () ->
       let ( let* ) = Option.bind in
       let xcext = get_handle () in
-      let* host = Lazy.force numa_hierarchy in
-      let* numa_meminfo =
-        HostNuma.numa_get_meminfo xcext
-        |> Result.map Array.to_seq
-        |> Result.to_option
-      in
+      let* snapshot = NumaSnapshot.get xcext |> Result.to_option in
+      let* host = numa_hierarchy snapshot in
       let nodes =
-        Seq.map2
-          (fun node m ->
+        Seq.map
+          (fun node ->
+            (* claims of other domains can exceed what is still free *)
             NUMA.resource host node
-              ~memory:(node_mem_claimable_for_new_vm ~node ~domid m)
+              ~memory:
+                (max 0L (node_mem_claimable_for_new_vm ~node ~domid snapshot))
           )
-          (NUMA.nodes host) numa_meminfo
+          (NUMA.nodes host)
+        |> Array.of_seq
       in
       let vm = NUMARequest.make ~memory ~vcpus ~cores in
-      let nodea = Array.of_seq nodes in
-      let cpu_affinity, memory_plan =
-        match Softaffinity.plan ~vm host nodea with
-        | None ->
-            D.debug "NUMA-aware placement failed for domid %d" domid ;
-            (None, [])
-        | Some (cpu_affinity, mem_plan) ->
-            (Some cpu_affinity, mem_plan)
+      let load = Numa_placer.Load.vcpus numa_load ~nodes:(Array.length nodes) in
+      let nr_pages = Memory.pages_of_bytes_used memory |> Int64.to_int in
+      let set_vcpu_affinity placed =
+        let cpus =
+          List.fold_left
+            (fun acc node -> CPUSet.union acc (NUMA.cpuset_of_node host node))
+            CPUSet.empty placed
+        in
+        if not (CPUSet.is_empty cpus) then (
+          D.debug "%s: setting vcpu affinity for domain %d: %s" __FUNCTION__
+            domid
+            (Fmt.to_to_string CPUSet.pp_dump cpus) ;
+          let cpus = CPUSet.to_mask cpus in
+          for i = 0 to vcpus - 1 do
+            set_affinity affinity xcext domid i cpus
+          done ;
+          Numa_placer.Load.add numa_load ~domid placed ~vcpus
+        )
       in
-      let set_vcpu_affinity = function
-        | None ->
-            D.debug "%s: not setting vcpu affinity for domain %d" __FUNCTION__
-              domid
-        | Some cpu_affinity ->
-            D.debug "%s: setting vcpu affinity for domain %d: %s" __FUNCTION__
-              domid
-              (Fmt.to_to_string CPUSet.pp_dump cpu_affinity) ;
-            let cpus = CPUSet.to_mask cpu_affinity in
-            for i = 0 to vcpus - 1 do
-              set_affinity affinity xcext domid i cpus
-            done
+      (* Claim the memory on the fewest, nearest nodes of [preference] and run
+         the vCPUs there. Returns the node if the memory was claimed from a
+         single one, the domain must then allocate it from that node. *)
+      let claim preference =
+        let preference = List.map (fun (NUMA.Node n) -> n) preference in
+        NumaClaim.claim xcext domid ~preference nr_pages
+        |> Result.map (function
+          | NumaClaim.On_node node ->
+              D.debug "NUMAClaim domid %d: claimed %d pages on node %d" domid
+                nr_pages node ;
+              set_vcpu_affinity [NUMA.node host node] ;
+              Some node
+          | NumaClaim.On_host split ->
+              D.debug
+                "NUMAClaim domid %d: claimed %d pages on the host, from: %s"
+                domid nr_pages
+                (Fmt.to_to_string Fmt.(Dump.list (Dump.pair int int)) split) ;
+              List.map (fun (n, _) -> NUMA.node host n) split
+              |> set_vcpu_affinity ;
+              None
+          )
       in
-      (* Xen only allows a single node when using memory claims, or none at all. *)
-      let* numa_node, node =
-        match memory_plan with
-        | [Node node] ->
-            Some (Xenctrlext.NumaNode.from node, node)
-        | [] | _ :: _ :: _ ->
-            D.debug
-              "%s: domain %d can't fit a single NUMA node, falling back to \
-               default behaviour"
-              __FUNCTION__ domid ;
-            None
+      (* Plans are tried best first, moving to the next one when the memory
+         can't be claimed, e.g. because it was allocated since the snapshot
+         was taken. Claims are made while holding [numa_mutex] so the next
+         placement sees them in its snapshot. *)
+      let rec place = function
+        | [] -> (
+            (* the best locality that is still available, rather than none *)
+            let by_memory (NUMA.Node a) (NUMA.Node b) =
+              compare nodes.(b).NUMAResource.memfree
+                nodes.(a).NUMAResource.memfree
+            in
+            let preference =
+              List.sort by_memory (List.of_seq (NUMA.nodes host))
+            in
+            match claim preference with
+            | Ok node ->
+                Some node
+            | Error (err, fn) ->
+                D.info "%s: NUMA-aware placement failed for domain %d: %s: %s"
+                  __FUNCTION__ domid fn (Unix.error_message err) ;
+                None
+          )
+        | (plan : Numa_placer.plan) :: rest -> (
+            let by_share (_, a) (_, b) = Int64.compare b a in
+            let preference =
+              List.stable_sort by_share plan.memory |> List.map fst
+            in
+            match claim preference with
+            | Ok node ->
+                Some node
+            | Error (Unix.ENOMEM, _) ->
+                D.info
+                  "%s: unable to claim enough memory on nodes %s for domain \
+                   %d, trying the next plan"
+                  __FUNCTION__
+                  (Fmt.to_to_string
+                     Fmt.(Dump.list NUMA.pp_dump_node)
+                     plan.nodes
+                  )
+                  domid ;
+                place rest
+            | Error (err, fn) ->
+                (* claims are not available, keep the vCPUs close to the nodes
+                   and let the caller deal with it *)
+                D.debug "NUMAClaim domid %d: claim not available: %s: %s" domid
+                  fn (Unix.error_message err) ;
+                set_vcpu_affinity plan.nodes ;
+                None
+          )
       in
-      let nr_pages = Memory.pages_of_bytes_used memory |> Int64.to_int in
-      D.debug "NUMAClaim domid %d: local claim on node %d: %d pages" domid node
-        nr_pages ;
-      match Xenctrlext.domain_claim_pages xcext domid ~numa_node nr_pages with
-      | Ok () ->
-          set_vcpu_affinity cpu_affinity ;
-          Some (node, memory)
-      | Error (Unix.ENOMEM, _) ->
-          D.info
-            "%s: unable to claim enough memory, domain %d won't be hosted in a \
-             single NUMA node."
-            __FUNCTION__ domid ;
-          None
-      | Error (err, fn) ->
-          (* Xen does not provide the interface to claim pages from a single NUMA node, ignore the error and continue. *)
-          D.debug "NUMAClaim domid %d: local claim not available: %s: %s" domid
-            fn (Unix.error_message err) ;
-          set_vcpu_affinity cpu_affinity ;
-          None
+      place (Numa_placer.plan host nodes ~load ~vm)
   )
 
 let build_pre ~xc ~xs ~vcpus ~memory ~hard_affinity domid =
@@ -1208,8 +1262,7 @@ let build_pre ~xc ~xs ~vcpus ~memory ~hard_affinity domid =
               match numa_placement domid ~vcpus ~cores ~memory affinity with
               | None ->
                   (* Always perform a global claim when NUMA placement is
-                     enabled, and single node claims failed or were
-                     unavailable:
+                     enabled, and NUMA claims failed or were unavailable:
                      This tries to ensures that memory allocated for this
                      domain won't use up memory claimed by other domains.
                      If claims are mixed with non-claims then Xen can't
@@ -1245,8 +1298,8 @@ let build_pre ~xc ~xs ~vcpus ~memory ~hard_affinity domid =
                         Xenctrlext.handle_outcome ~default:() e
                   in
                   None
-              | Some (plan, _) ->
-                  Some plan
+              | Some node ->
+                  node
         )
   in
   let store_chan, console_chan = create_channels ~xc uuid domid in
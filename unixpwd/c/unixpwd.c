@@ -15,9 +15,12 @@
 #define _GNU_SOURCE
 
 #include <errno.h>
+#include <fcntl.h>
 #include <malloc.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <shadow.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,6 +29,8 @@
 #include <unistd.h>
 #include <limits.h>
 
+#include "unixpwd.h"
+
 #ifdef DEVELOPMENT
 #define ETC_PASSWD   "passwd"
 #define TMP_PASSWD   "passwd.XXXXXX"
@@ -40,13 +45,191 @@
 
 #define BUFLEN 4096
 
+/*
+ * Optional cache of the password field of /etc/passwd and /etc/shadow.
+ * Each file is parsed once into a hash table keyed by user name and parsed
+ * again when its inode, size or modification time changes, which also
+ * catches updates by other programs. Users not in the files are looked up
+ * through NSS as without the cache.
+ */
+
+struct pwcache_entry {
+    char           *user;
+    char           *password;
+};
+
+struct pwcache {
+    const char     *path;
+    struct stat     stat;
+    size_t          size;       /* power of 2, 0 if not loaded */
+    struct pwcache_entry *entries;
+    char           *data;
+};
+
+static pthread_mutex_t pwcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static int      pwcache_enabled;
+static struct pwcache pwcache_passwd = {.path = ETC_PASSWD };
+static struct pwcache pwcache_shadow = {.path = ETC_SPASSWD };
+
+static          uint32_t
+pwcache_hash(const char *s)
+{
+    uint32_t        h = 2166136261u;
+
+    while (*s)
+        h = (h ^ (unsigned char) *s++) * 16777619u;
+    return h;
+}
+
+static void
+pwcache_clear(struct pwcache *c)
+{
+    free(c->entries);
+    free(c->data);
+    c->entries = NULL;
+    c->data = NULL;
+    c->size = 0;
+}
+
+static int
+pwcache_same_file(const struct stat *a, const struct stat *b)
+{
+    return a->st_ino == b->st_ino && a->st_dev == b->st_dev
+        && a->st_size == b->st_size
+        && a->st_mtim.tv_sec == b->st_mtim.tv_sec
+        && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+/*
+ * (Re)load the cache from its file if it changed, called with
+ * pwcache_lock held. Returns 0 if the cache can be used.
+ */
+static int
+pwcache_load(struct pwcache *c)
+{
+    struct stat     st;
+    FILE           *f;
+    size_t          lines = 0,
+                    i;
+    char           *p,
+                   *end;
+
+    if (stat(c->path, &st) != 0) {
+        pwcache_clear(c);
+        return -1;
+    }
+    if (c->size && pwcache_same_file(&st, &c->stat))
+        return 0;
+    pwcache_clear(c);
+
+    f = fopen(c->path, "re");
+    if (!f)
+        return -1;
+    if (fstat(fileno(f), &st) != 0
+        || (c->data = malloc(st.st_size + 1)) == NULL
+        || fread(c->data, 1, st.st_size, f) != (size_t) st.st_size) {
+        fclose(f);
+        pwcache_clear(c);
+        return -1;
+    }
+    fclose(f);
+    c->data[st.st_size] = 0;
+
+    for (p = c->data; *p; p++)
+        lines += *p == '\n';
+    for (c->size = 16; c->size < 2 * (lines + 1); c->size *= 2);
+    c->entries = calloc(c->size, sizeof(*c->entries));
+    if (!c->entries) {
+        pwcache_clear(c);
+        return -1;
+    }
+
+    for (p = c->data; *p; p = end) {
+        char           *user = p,
+                       *password,
+                       *colon;
+
+        end = strchr(p, '\n');
+        if (end)
+            *end++ = 0;
+        else
+            end = p + strlen(p);
+        /* skip NIS compat entries, they are left to NSS */
+        if (*user == '+' || *user == '-' || !(colon = strchr(user, ':')))
+            continue;
+        *colon = 0;
+        password = colon + 1;
+        colon = strchr(password, ':');
+        if (colon)
+            *colon = 0;
+        /* first entry wins, as for a file scan */
+        for (i = pwcache_hash(user) & (c->size - 1); c->entries[i].user;
+             i = (i + 1) & (c->size - 1))
+            if (!strcmp(c->entries[i].user, user))
+                break;
+        if (!c->entries[i].user) {
+            c->entries[i].user = user;
+            c->entries[i].password = password;
+        }
+    }
+    c->stat = st;
+    return 0;
+}
+
+/*
+ * Look up user in the cache. Returns a copy of the password, NULL with
+ * errno 0 if the cache cannot answer.
+ */
+static char    *
+pwcache_get(struct pwcache *c, const char *user)
+{
+    char           *password = NULL;
+    size_t          i;
+
+    pthread_mutex_lock(&pwcache_lock);
+    if (pwcache_enabled && pwcache_load(c) == 0) {
+        for (i = pwcache_hash(user) & (c->size - 1); c->entries[i].user;
+             i = (i + 1) & (c->size - 1))
+            if (!strcmp(c->entries[i].user, user)) {
+                password = strdup(c->entries[i].password);
+                break;
+            }
+    }
+    pthread_mutex_unlock(&pwcache_lock);
+    errno = 0;
+    return password;
+}
+
+static void
+pwcache_invalidate(struct pwcache *c)
+{
+    pthread_mutex_lock(&pwcache_lock);
+    pwcache_clear(c);
+    pthread_mutex_unlock(&pwcache_lock);
+}
+
+void
+unixpwd_cache_enable(int enable)
+{
+    pthread_mutex_lock(&pwcache_lock);
+    pwcache_enabled = enable;
+    if (!enable) {
+        pwcache_clear(&pwcache_passwd);
+        pwcache_clear(&pwcache_shadow);
+    }
+    pthread_mutex_unlock(&pwcache_lock);
+}
+
 char           *
 unixpwd_getpwd(const char *user)
 {
     struct passwd   pwd,
                    *pw;
     char            buf[BUFLEN];
+    char           *cached;
 
+    if ((cached = pwcache_get(&pwcache_passwd, user)) != NULL)
+        return cached;
     errno = 0;
     if (getpwnam_r(user, &pwd, buf, BUFLEN, &pw) == 0 && pw)
         return strdup(pw->pw_passwd);
@@ -61,7 +244,10 @@ unixpwd_getspw(const char *user)
     struct spwd     spw,
                    *sp;
     char            buf[BUFLEN];
+    char           *cached;
 
+    if ((cached = pwcache_get(&pwcache_shadow, user)) != NULL)
+        return cached;
     errno = 0;
     if (getspnam_r(user, &spw, buf, BUFLEN, &sp) == 0 && sp)
         return strdup(sp->sp_pwdp);
@@ -80,129 +266,202 @@ unixpwd_get(const char *user)
     return (spw ? spw : unixpwd_getpwd(user));
 }
 
-int
-unixpwd_setpwd(const char *user, char *password)
+static int
+unixpwd_update_cmp(const void *a, const void *b)
 {
+    const struct unixpwd_update *x = a,
+        *y = b;
 
-    struct passwd   pwd,
-                   *pw;
-    char            buf[BUFLEN];
-    int             tmp;
-    FILE           *tmp_file;
-    char            tmp_name[PATH_MAX];
-    struct stat     statbuf;
-    int             rc;
-    int             updated = 0;
-
-    strncpy(tmp_name, TMP_PASSWD, sizeof tmp_name);
-    tmp = mkstemp(tmp_name);
-    if (tmp == -1)
-        return errno;
-    if (stat(ETC_PASSWD, &statbuf) != 0
-        || fchown(tmp, statbuf.st_uid, statbuf.st_gid) != 0
-        || fchmod(tmp, statbuf.st_mode) != 0
-        || (tmp_file = fdopen(tmp, "w")) == NULL) {
-        rc = errno ? errno : EPERM;
-        close(tmp);
-        return rc;
-    }
+    return strcmp(x->user, y->user);
+}
 
-    setpwent();
-    while (1) {
-        rc = getpwent_r(&pwd, buf, BUFLEN, &pw);
-        if (rc != 0 || !pw)
-            break;
-        if (!strcmp(user, pw->pw_name)) {
-            pw->pw_passwd = password;
-            updated++;
-        }
-        putpwent(pw, tmp_file);
-    }
-    endpwent();
+/*
+ * fsync the directory containing path so that a rename into it is
+ * durable
+ */
+static int
+fsync_dir(const char *path)
+{
+    char            dir[PATH_MAX];
+    char           *slash;
+    int             fd,
+                    rc = 0;
 
-    fclose(tmp_file);
-    if (rc != ENOENT) {
-        unlink(tmp_name);
-        return rc;
-    }
-    if (!updated) {
-        unlink(tmp_name);
-        return EINVAL;
-    }
-    if (rename(tmp_name, ETC_PASSWD) != 0) {
+    strncpy(dir, path, sizeof dir - 1);
+    dir[sizeof dir - 1] = 0;
+    slash = strrchr(dir, '/');
+    if (!slash)
+        strcpy(dir, ".");
+    else if (slash == dir)
+        dir[1] = 0;
+    else
+        *slash = 0;
+    fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return errno;
+    if (fsync(fd) != 0)
         rc = errno;
-        unlink(tmp_name);
-        return rc;
-    }
-    return 0;
+    close(fd);
+    return rc;
 }
 
-
-int
-unixpwd_setspw(const char *user, char *password)
+/*
+ * Rewrite /etc/passwd (shadow == 0) or /etc/shadow with the n updates
+ * applied in a single pass. The temporary file is prepared before taking
+ * lckpwdf, which is released as soon as the file is renamed into place.
+ */
+static int
+unixpwd_update_file(int shadow, const struct unixpwd_update *updates,
+                    size_t n)
 {
-
-    struct spwd     spw,
-                   *sp;
+    const char     *path = shadow ? ETC_SPASSWD : ETC_PASSWD;
+    struct unixpwd_update *sorted,
+                   *found,
+                    key;
+    char           *updated;
     char            buf[BUFLEN];
     int             tmp;
-    FILE           *tmp_file = NULL;
+    FILE           *tmp_file;
     char            tmp_name[PATH_MAX];
     struct stat     statbuf;
-    int             rc;
-    int             updated = 0;
+    int             rc = 0;
+    size_t          i;
 
-    strncpy(tmp_name, TMP_SPASSWD, sizeof tmp_name);
+    if (n == 0)
+        return 0;
+    sorted = malloc(n * sizeof(*sorted));
+    updated = calloc(n, 1);
+    if (!sorted || !updated) {
+        free(sorted);
+        free(updated);
+        return ENOMEM;
+    }
+    memcpy(sorted, updates, n * sizeof(*sorted));
+    qsort(sorted, n, sizeof(*sorted), unixpwd_update_cmp);
+    for (i = 1; i < n; i++)
+        if (!strcmp(sorted[i - 1].user, sorted[i].user))
+            rc = EINVAL;
+    if (rc) {
+        free(sorted);
+        free(updated);
+        return rc;
+    }
+
+    strncpy(tmp_name, shadow ? TMP_SPASSWD : TMP_PASSWD, sizeof tmp_name);
     tmp = mkstemp(tmp_name);
-    if (tmp == -1)
-        return errno;
-    if (stat(ETC_SPASSWD, &statbuf) != 0
+    if (tmp == -1) {
+        rc = errno;
+        free(sorted);
+        free(updated);
+        return rc;
+    }
+    if (stat(path, &statbuf) != 0
         || fchown(tmp, statbuf.st_uid, statbuf.st_gid) != 0
         || fchmod(tmp, statbuf.st_mode) != 0
         || (tmp_file = fdopen(tmp, "w")) == NULL) {
         rc = errno ? errno : EPERM;
         close(tmp);
         unlink(tmp_name);
+        free(sorted);
+        free(updated);
         return rc;
     }
+    setvbuf(tmp_file, NULL, _IOFBF, 64 * 1024);
+
     if (lckpwdf() != 0) {
-        if (tmp_file)
-            fclose(tmp_file);
-        close(tmp);
+        fclose(tmp_file);
         unlink(tmp_name);
+        free(sorted);
+        free(updated);
         return ENOLCK;
     }
 
-    setspent();
-    while (1) {
-        rc = getspent_r(&spw, buf, BUFLEN, &sp);
-        if (rc != 0 || !sp)
-            break;
-        if (!strcmp(user, sp->sp_namp)) {
-            sp->sp_pwdp = password;
-            updated++;
+    if (shadow) {
+        struct spwd     spw,
+                       *sp;
+
+        setspent();
+        while ((rc = getspent_r(&spw, buf, BUFLEN, &sp)) == 0 && sp) {
+            key.user = sp->sp_namp;
+            found = bsearch(&key, sorted, n, sizeof(*sorted),
+                            unixpwd_update_cmp);
+            if (found) {
+                sp->sp_pwdp = found->password;
+                updated[found - sorted] = 1;
+            }
+            putspent(sp, tmp_file);
         }
-        putspent(sp, tmp_file);
-    }
-    endspent();
+        endspent();
+    } else {
+        struct passwd   pwd,
+                       *pw;
 
-    fclose(tmp_file);
-    if (rc != ENOENT) {
-        ulckpwdf();
-        unlink(tmp_name);
-        return rc;
+        setpwent();
+        while ((rc = getpwent_r(&pwd, buf, BUFLEN, &pw)) == 0 && pw) {
+            key.user = pw->pw_name;
+            found = bsearch(&key, sorted, n, sizeof(*sorted),
+                            unixpwd_update_cmp);
+            if (found) {
+                pw->pw_passwd = found->password;
+                updated[found - sorted] = 1;
+            }
+            putpwent(pw, tmp_file);
+        }
+        endpwent();
     }
-    if (!updated) {
-        ulckpwdf();
-        unlink(tmp_name);
-        return EINVAL;
+
+    if (rc == ENOENT) {
+        rc = 0;
+        for (i = 0; i < n; i++)
+            if (!updated[i])
+                rc = EINVAL;
     }
-    if (rename(tmp_name, ETC_SPASSWD) != 0) {
+    if (fflush(tmp_file) != 0 || fsync(fileno(tmp_file)) != 0)
+        rc = rc ? rc : errno;
+    if (fclose(tmp_file) != 0)
+        rc = rc ? rc : errno;
+    if (rc == 0 && rename(tmp_name, path) != 0)
         rc = errno;
-        ulckpwdf();
+    ulckpwdf();
+    free(sorted);
+    free(updated);
+
+    if (rc != 0) {
         unlink(tmp_name);
         return rc;
     }
-    ulckpwdf();
-    return 0;
+    pwcache_invalidate(shadow ? &pwcache_shadow : &pwcache_passwd);
+    /*
+     * the updates are applied from here on, an error only means that
+     * the rename may not survive a crash, see unixpwd.h
+     */
+    return fsync_dir(path);
+}
+
+int
+unixpwd_setpwd_batch(const struct unixpwd_update *updates, size_t n)
+{
+    return unixpwd_update_file(0, updates, n);
+}
+
+int
+unixpwd_setspw_batch(const struct unixpwd_update *updates, size_t n)
+{
+    return unixpwd_update_file(1, updates, n);
+}
+
+int
+unixpwd_setpwd(const char *user, char *password)
+{
+    struct unixpwd_update update = {user, password };
+
+    return unixpwd_setpwd_batch(&update, 1);
+}
+
+int
+unixpwd_setspw(const char *user, char *password)
+{
+    struct unixpwd_update update = {user, password };
+
+    return unixpwd_setspw_batch(&update, 1);
 }
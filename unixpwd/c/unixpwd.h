@@ -12,6 +12,8 @@
  * GNU Lesser General Public License for more details.
  */
 
+#include <stddef.h>
+
 /*
  * get password for user. The result must be passed to free(). On error,
  * returns NULL and errno set. unixpwd_get tries to obtain the shadow
@@ -33,3 +35,34 @@ char           *unixpwd_getspw(const char *user);
 
 int             unixpwd_setpwd(const char *user, char *password);
 int             unixpwd_setspw(const char *user, char *password);
+
+/*
+ * update the password of n users in /etc/passwd and /etc/shadow
+ * respectively with a single rewrite of the file, which is fsynced
+ * before it is renamed into place. Either all or none of the updates
+ * are applied. Return 0 on success and errno otherwise. Specific errors:
+ * EINVAL: no password entry exists for one of the users, or a user is
+ * listed twice ENOLCK: can't acquire lock. An error syncing the directory
+ * after the rename is returned with the updates applied, but they may
+ * not survive a crash. unixpwd_setpwd and unixpwd_setspw are batches of
+ * one.
+ */
+
+struct unixpwd_update {
+    const char     *user;
+    char           *password;
+};
+
+int             unixpwd_setpwd_batch(const struct unixpwd_update *updates,
+                                     size_t n);
+int             unixpwd_setspw_batch(const struct unixpwd_update *updates,
+                                     size_t n);
+
+/*
+ * enable (non-zero) or disable a cache for unixpwd_getpwd and
+ * unixpwd_getspw. The cache indexes /etc/passwd and /etc/shadow by user
+ * name and is refreshed when a file changes. Users not found in the files
+ * are looked up through NSS. Disabled by default.
+ */
+
+void            unixpwd_cache_enable(int enable);
@@ -132,3 +132,62 @@ caml_unixpwd_setspw(value caml_user, value caml_password)
         caml_failwith(strerror(rc));
     CAMLreturn(Val_unit);
 }
+
+/*
+ * (user * password) list -> unit
+ */
+static          value
+unixpwd_set_batch(value caml_updates,
+                  int (*set)(const struct unixpwd_update *, size_t))
+{
+    CAMLparam1(caml_updates);
+    CAMLlocal2(l, pair);
+    struct unixpwd_update *updates;
+    size_t          n = 0,
+                    i;
+    int             rc;
+
+    for (l = caml_updates; l != Val_emptylist; l = Field(l, 1))
+        n++;
+    updates = caml_stat_calloc_noexc(n ? n : 1, sizeof(*updates));
+    if (!updates)
+        caml_raise_out_of_memory();
+    for (i = 0, l = caml_updates; i < n; i++, l = Field(l, 1)) {
+        pair = Field(l, 0);
+        updates[i].user = caml_stat_strdup(String_val(Field(pair, 0)));
+        updates[i].password = caml_stat_strdup(String_val(Field(pair, 1)));
+    }
+
+    caml_release_runtime_system();
+    rc = set(updates, n);
+    caml_acquire_runtime_system();
+
+    for (i = 0; i < n; i++) {
+        caml_stat_free((char *) updates[i].user);
+        caml_stat_free(updates[i].password);
+    }
+    caml_stat_free(updates);
+    if (rc != 0)
+        caml_failwith(strerror(rc));
+    CAMLreturn(Val_unit);
+}
+
+CAMLprim        value
+caml_unixpwd_setpwd_batch(value caml_updates)
+{
+    return unixpwd_set_batch(caml_updates, unixpwd_setpwd_batch);
+}
+
+CAMLprim        value
+caml_unixpwd_setspw_batch(value caml_updates)
+{
+    return unixpwd_set_batch(caml_updates, unixpwd_setspw_batch);
+}
+
+CAMLprim        value
+caml_unixpwd_cache_enable(value caml_enable)
+{
+    CAMLparam1(caml_enable);
+    unixpwd_cache_enable(Bool_val(caml_enable));
+    CAMLreturn(Val_unit);
+}
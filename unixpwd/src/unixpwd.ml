@@ -22,6 +22,14 @@ module Stubs = struct
   external setpwd : string -> string -> unit = "caml_unixpwd_setpwd"
 
   external setspw : string -> string -> unit = "caml_unixpwd_setspw"
+
+  external setpwd_batch : (string * string) list -> unit
+    = "caml_unixpwd_setpwd_batch"
+
+  external setspw_batch : (string * string) list -> unit
+    = "caml_unixpwd_setspw_batch"
+
+  external cache_enable : bool -> unit = "caml_unixpwd_cache_enable"
 end
 
 exception Error of string
@@ -37,3 +45,9 @@ let get user = wrap (fun () -> Stubs.get user)
 let setpwd user pwd = wrap (fun () -> Stubs.setpwd user pwd)
 
 let setspw user pwd = wrap (fun () -> Stubs.setspw user pwd)
+
+let setpwd_batch updates = wrap (fun () -> Stubs.setpwd_batch updates)
+
+let setspw_batch updates = wrap (fun () -> Stubs.setspw_batch updates)
+
+let cache_enable enable = Stubs.cache_enable enable
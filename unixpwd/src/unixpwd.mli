@@ -40,3 +40,26 @@ val setspw : string -> string -> unit
  * for [user] in /etc/passwd and /etc/shadow, respectively. They raise
  * [Error] on error.
  *)
+
+val setpwd_batch : (string * string) list -> unit
+
+val setspw_batch : (string * string) list -> unit
+
+(* [setpwd_batch [(user, pw); ...]] and [setspw_batch] set the
+ * (encrypted) password of several users with a single rewrite of
+ * /etc/passwd and /etc/shadow, respectively. The new file is synced to
+ * disk before it replaces the old one. Either all or none of the updates
+ * are applied. They raise [Error] on error, including when a user has no
+ * entry or is listed twice. If syncing the directory fails after the new
+ * file replaced the old one, [Error] is raised with the updates applied,
+ * though they may not survive a crash.
+ *)
+
+val cache_enable : bool -> unit
+
+(* [cache_enable true] makes [getpwd], [getspw] and [get] look up users
+ * in an index of /etc/passwd and /etc/shadow instead of scanning the
+ * files through NSS on every call. The index is rebuilt when a file
+ * changes. Users not found in the files are still looked up through NSS.
+ * The cache is disabled by default.
+ *)
@@ -1,23 +1,130 @@
 let default_user = "unixpwd"
 
+let default_other = "unixpwd2"
+
 let cycle user rounds n =
   let pw = Printf.sprintf "unixpwd-%06d" n in
   Unixpwd.setspw user pw ;
   assert (Unixpwd.getspw user = pw) ;
   Unixpwd.setpwd user pw ;
   assert (Unixpwd.getpwd user = pw) ;
+  Unixpwd.setspw_batch [(user, pw ^ "-batch")] ;
+  assert (Unixpwd.getspw user = pw ^ "-batch") ;
   if n mod (rounds / 80) = 0 then (
     print_char '=' ; flush stdout
   )
 
-let main () =
-  let rounds = 500_000 in
-  let user = match Sys.argv with [|_; name|] -> name | _ -> default_user in
+let read_file path =
+  let ic = open_in path in
+  Fun.protect
+    (fun () -> really_input_string ic (in_channel_length ic))
+    ~finally:(fun () -> close_in ic)
+
+(* [batch] fails without touching [path] *)
+let check_rejected path batch =
+  let before = read_file path in
+  ( match batch () with
+  | () ->
+      assert false
+  | exception Unixpwd.Error _ ->
+      ()
+  ) ;
+  assert (read_file path = before)
+
+let check_batches user other =
+  Unixpwd.setspw_batch [(user, "unixpwd-spw-1"); (other, "unixpwd-spw-2")] ;
+  assert (Unixpwd.getspw user = "unixpwd-spw-1") ;
+  assert (Unixpwd.getspw other = "unixpwd-spw-2") ;
+  Unixpwd.setpwd_batch [(other, "unixpwd-pwd-2"); (user, "unixpwd-pwd-1")] ;
+  assert (Unixpwd.getpwd user = "unixpwd-pwd-1") ;
+  assert (Unixpwd.getpwd other = "unixpwd-pwd-2") ;
+  Unixpwd.setspw_batch [] ;
+  (* either all or none of the updates are applied *)
+  let missing = "unixpwd-no-such-user" in
+  check_rejected "/etc/shadow" (fun () ->
+      Unixpwd.setspw_batch [(user, "dup-1"); (other, "x"); (user, "dup-2")]
+  ) ;
+  check_rejected "/etc/shadow" (fun () ->
+      Unixpwd.setspw_batch [(user, "x"); (missing, "x")]
+  ) ;
+  check_rejected "/etc/passwd" (fun () ->
+      Unixpwd.setpwd_batch [(other, "dup-1"); (other, "dup-2")]
+  ) ;
+  check_rejected "/etc/passwd" (fun () ->
+      Unixpwd.setpwd_batch [(missing, "x"); (user, "x")]
+  ) ;
+  assert (Unixpwd.getspw user = "unixpwd-spw-1") ;
+  assert (Unixpwd.getpwd other = "unixpwd-pwd-2")
+
+(* Set the password field of [user] in [path] behind the back of unixpwd,
+   in place or by replacing the file with a new one *)
+let rewrite ~replace path user pw =
+  let content =
+    String.split_on_char '\n' (read_file path)
+    |> List.map (fun line ->
+           match String.split_on_char ':' line with
+           | name :: _ :: fields when name = user ->
+               String.concat ":" (name :: pw :: fields)
+           | _ ->
+               line
+       )
+    |> String.concat "\n"
+  in
+  let st = Unix.stat path in
+  let write file =
+    let oc =
+      open_out_gen [Open_wronly; Open_creat; Open_trunc] st.Unix.st_perm file
+    in
+    Fun.protect
+      (fun () -> output_string oc content)
+      ~finally:(fun () -> close_out oc)
+  in
+  if replace then (
+    let tmp = path ^ ".unixpwd-test" in
+    write tmp ;
+    Unix.chown tmp st.Unix.st_uid st.Unix.st_gid ;
+    Unix.rename tmp path
+  ) else
+    write path
+
+(* Lookups through the cache see the updates made through unixpwd and the
+   files being changed by someone else. Passwords differ in length so that
+   a rewrite in place is noticed even within one tick of the clock. *)
+let check_cache user =
+  List.iter
+    (fun (replace, pw) ->
+      assert (Unixpwd.getspw user <> pw) ;
+      rewrite ~replace "/etc/shadow" user pw ;
+      assert (Unixpwd.getspw user = pw) ;
+      assert (Unixpwd.getpwd user <> pw) ;
+      rewrite ~replace "/etc/passwd" user pw ;
+      assert (Unixpwd.getpwd user = pw)
+    )
+    [(true, "unixpwd-replaced"); (false, "unixpwd-rewritten-in-place")]
+
+let pass user rounds =
   for n = 1 to rounds do
     cycle user rounds n
   done ;
   print_char '\n'
 
+let main () =
+  let rounds = 5_000 in
+  let user, other =
+    match Sys.argv with
+    | [|_; user; other|] ->
+        (user, other)
+    | _ ->
+        (default_user, default_other)
+  in
+  pass user rounds ;
+  check_batches user other ;
+  Unixpwd.cache_enable true ;
+  pass user rounds ;
+  check_batches user other ;
+  check_cache user ;
+  Unixpwd.cache_enable false
+
 let () =
   if !Sys.interactive then
     ()